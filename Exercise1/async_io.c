@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "async_io.h"
+#include "io_ring.h"
+
+typedef struct {
+	pthread_t thread;
+	bool running;
+	bool stopping;
+	Async_io_job_t* queue_head; /* waiting jobs, oldest first */
+	Async_io_job_t* queue_tail;
+	Async_io_job_t* current; /* job the I/O thread is running */
+	Async_io_job_t* done_head; /* finished jobs not taken yet, oldest first */
+	Async_io_job_t* done_tail;
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t job_done;
+}Async_io_t;
+
+static Async_io_t io = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work_ready = PTHREAD_COND_INITIALIZER,
+	.job_done = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * PURPOSE: Run one job on the I/O thread
+ * INPUTS: Address of the job
+ * RETURN: Nothing, the outcome is left in the job
+ **/
+
+static void run_job (Async_io_job_t* job) {
+	if (job->kind == ASYNC_IO_WRITE) {
+		job->ok = write_matrix_ex(job->filename, job->matrix, job->flags);
+		/* drop the snapshot here, the matrix it was taken from keeps its data */
+		destroy_matrix(&job->matrix);
+	}
+	else {
+		job->ok = read_matrix(job->filename, &job->matrix);
+	}
+}
+
+/*
+ * PURPOSE: I/O thread loop, runs queued jobs in order until stopped and idle
+ * INPUTS: Unused
+ * RETURN: NULL
+ **/
+
+static void* io_main (void* arg) {
+	(void)arg;
+	pthread_mutex_lock(&io.lock);
+	for (;;) {
+		while (io.queue_head == NULL && !io.stopping) {
+			pthread_cond_wait(&io.work_ready, &io.lock);
+		}
+		Async_io_job_t* job = io.queue_head;
+		if (job == NULL) {
+			break;
+		}
+		io.queue_head = job->next;
+		if (io.queue_head == NULL) {
+			io.queue_tail = NULL;
+		}
+		job->next = NULL;
+		io.current = job;
+		pthread_mutex_unlock(&io.lock);
+
+		run_job(job);
+
+		pthread_mutex_lock(&io.lock);
+		io.current = NULL;
+		if (io.done_tail) {
+			io.done_tail->next = job;
+		}
+		else {
+			io.done_head = job;
+		}
+		io.done_tail = job;
+		pthread_cond_broadcast(&io.job_done);
+	}
+	pthread_mutex_unlock(&io.lock);
+	io_ring_release();
+	return NULL;
+}
+
+/*
+ * PURPOSE: Start the I/O thread
+ * INPUTS: Nothing
+ * RETURN: True if it is running, false if it couldn't start (reads and
+ *  writes then stay synchronous)
+ **/
+
+bool init_async_io (void) {
+	if (io.running) return true;
+
+	io.stopping = false;
+	if (pthread_create(&io.thread, NULL, io_main, NULL) != 0) {
+		return false;
+	}
+	io.running = true;
+	return true;
+}
+
+/*
+ * PURPOSE: Finish every queued job and stop the I/O thread. Finished jobs
+ *  stay around for async_io_take_done
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+void shutdown_async_io (void) {
+	if (!io.running) return;
+
+	pthread_mutex_lock(&io.lock);
+	io.stopping = true;
+	pthread_cond_signal(&io.work_ready);
+	pthread_mutex_unlock(&io.lock);
+	pthread_join(io.thread, NULL);
+	io.running = false;
+}
+
+/*
+ * PURPOSE: Name of the matrix the last unfinished write to a file stores in it
+ * INPUTS: Filename, buffer of MATRIX_NAME_LEN bytes for the name
+ * RETURN: True if a write to the file is queued or running
+ **/
+
+static bool pending_write_name (const char* filename, char* name) {
+	const Async_io_job_t* last = NULL;
+	pthread_mutex_lock(&io.lock);
+	if (io.current && io.current->kind == ASYNC_IO_WRITE && strcmp(io.current->filename, filename) == 0) {
+		last = io.current;
+	}
+	for (const Async_io_job_t* job = io.queue_head; job; job = job->next) {
+		if (job->kind == ASYNC_IO_WRITE && strcmp(job->filename, filename) == 0) {
+			last = job;
+		}
+	}
+	if (last) {
+		/* the snapshot is only dropped once the write has run, after the name is copied */
+		memcpy(name, last->matrix->name, MATRIX_NAME_LEN);
+	}
+	pthread_mutex_unlock(&io.lock);
+	return last != NULL;
+}
+
+/*
+ * PURPOSE: Allocate a job and hand it to the I/O thread
+ * INPUTS: Kind, filename, write flags, snapshot to write (NULL for a read)
+ * RETURN: True if queued, false if the thread isn't running or on allocation failure
+ **/
+
+static bool queue_job (Async_io_kind_t kind, const char* filename, unsigned int flags, Matrix_t* m) {
+	if (!io.running) {
+		return false;
+	}
+	Async_io_job_t* job = calloc(1, sizeof(Async_io_job_t));
+	if (!job) {
+		return false;
+	}
+	job->filename = strdup(filename);
+	if (!job->filename) {
+		free(job);
+		return false;
+	}
+	job->kind = kind;
+	job->flags = flags;
+	job->matrix = m;
+	if (kind == ASYNC_IO_READ && !pending_write_name(filename, job->name)) {
+		/* a file no queued write replaces is read as it is now */
+		if (!read_matrix_name(filename, job->name)) {
+			job->name[0] = '\0';
+		}
+	}
+
+	pthread_mutex_lock(&io.lock);
+	if (io.queue_tail) {
+		io.queue_tail->next = job;
+	}
+	else {
+		io.queue_head = job;
+	}
+	io.queue_tail = job;
+	pthread_cond_signal(&io.work_ready);
+	pthread_mutex_unlock(&io.lock);
+	return true;
+}
+
+/*
+ * PURPOSE: Queue a write of a matrix to the file named after it. The data
+ *  written is the matrix as it is now, pinned by a copy-on-write duplicate
+ * INPUTS: Address of the matrix, write_matrix_ex flags
+ * RETURN: True if queued, false if the caller has to write synchronously
+ **/
+
+bool async_write_matrix (Matrix_t* m, unsigned int flags) {
+	if (m == NULL || !io.running) return false;
+
+	Matrix_t* snapshot = NULL;
+	if (!create_matrix_copy(&snapshot, m->name, m)) {
+		return false;
+	}
+	if (!queue_job(ASYNC_IO_WRITE, m->name, flags, snapshot)) {
+		destroy_matrix(&snapshot);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Queue a read of a matrix file
+ * INPUTS: Filename
+ * RETURN: True if queued, false if the caller has to read synchronously
+ **/
+
+bool async_read_matrix (const char* filename) {
+	if (filename == NULL) return false;
+
+	return queue_job(ASYNC_IO_READ, filename, 0, NULL);
+}
+
+/*
+ * PURPOSE: Check whether a job matches a filename and kind filter
+ * INPUTS: Address of the job, filename (NULL matches any), whether only reads match
+ * RETURN: True on a match
+ **/
+
+static bool job_matches (const Async_io_job_t* job, const char* filename, bool reads_only) {
+	return (!reads_only || job->kind == ASYNC_IO_READ)
+		&& (filename == NULL || strcmp(job->filename, filename) == 0);
+}
+
+/*
+ * PURPOSE: Look for a queued or running job, the caller holds io.lock
+ * INPUTS: Filename (NULL matches any), whether only reads match
+ * RETURN: True if one is found
+ **/
+
+static bool busy_locked (const char* filename, bool reads_only) {
+	if (io.current && job_matches(io.current, filename, reads_only)) {
+		return true;
+	}
+	for (const Async_io_job_t* job = io.queue_head; job; job = job->next) {
+		if (job_matches(job, filename, reads_only)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * PURPOSE: Look for a queued or running read that will store a matrix of
+ *  the given name, the caller holds io.lock
+ * INPUTS: Name, its length (it need not be null terminated)
+ * RETURN: True if one is found
+ **/
+
+static bool reading_locked (const char* name, size_t len) {
+	if (io.current && io.current->kind == ASYNC_IO_READ
+		&& strncmp(io.current->name, name, len) == 0 && io.current->name[len] == '\0') {
+		return true;
+	}
+	for (const Async_io_job_t* job = io.queue_head; job; job = job->next) {
+		if (job->kind == ASYNC_IO_READ && strncmp(job->name, name, len) == 0 && job->name[len] == '\0') {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * PURPOSE: Block until no job on a file is queued or running
+ * INPUTS: Filename (NULL waits for every file), whether only reads count
+ * RETURN: Nothing
+ **/
+
+void async_io_wait (const char* filename, bool reads_only) {
+	pthread_mutex_lock(&io.lock);
+	while (busy_locked(filename, reads_only)) {
+		pthread_cond_wait(&io.job_done, &io.lock);
+	}
+	pthread_mutex_unlock(&io.lock);
+}
+
+/*
+ * PURPOSE: Block until no read that will store a matrix of the given name
+ *  is queued or running
+ * INPUTS: Name, its length (it need not be null terminated)
+ * RETURN: Nothing
+ **/
+
+void async_io_wait_matrix (const char* name, size_t len) {
+	if (name == NULL || len == 0 || len >= MATRIX_NAME_LEN) return;
+
+	pthread_mutex_lock(&io.lock);
+	while (reading_locked(name, len)) {
+		pthread_cond_wait(&io.job_done, &io.lock);
+	}
+	pthread_mutex_unlock(&io.lock);
+}
+
+/*
+ * PURPOSE: Take the oldest finished job
+ * INPUTS: Nothing
+ * RETURN: The job, to be freed with free_async_io_job, or NULL if none has finished
+ **/
+
+Async_io_job_t* async_io_take_done (void) {
+	pthread_mutex_lock(&io.lock);
+	Async_io_job_t* job = io.done_head;
+	if (job) {
+		io.done_head = job->next;
+		if (io.done_head == NULL) {
+			io.done_tail = NULL;
+		}
+		job->next = NULL;
+	}
+	pthread_mutex_unlock(&io.lock);
+	return job;
+}
+
+/*
+ * PURPOSE: Free a finished job and any matrix still attached to it
+ * INPUTS: Address of the job (may be NULL)
+ * RETURN: Nothing
+ **/
+
+void free_async_io_job (Async_io_job_t* job) {
+	if (job == NULL) return;
+
+	destroy_matrix(&job->matrix);
+	free(job->filename);
+	free(job);
+}
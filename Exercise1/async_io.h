@@ -0,0 +1,44 @@
+#ifndef _ASYNC_IO_H_
+#define _ASYNC_IO_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+/*
+ * Background reads and writes of matrix files. One I/O thread runs the
+ * queued jobs in order, so a read queued after a write of the same file
+ * sees the new contents. A write goes out from a copy-on-write duplicate
+ * taken when it is queued, so the matrix itself can be changed or deleted
+ * right away. A finished read hands its matrix back through
+ * async_io_take_done; only the thread owning the registry stores it. A read
+ * learns the name of the matrix it will store when it is queued, so commands
+ * wait only for the reads of the matrices they use.
+ */
+
+typedef enum {
+	ASYNC_IO_READ,
+	ASYNC_IO_WRITE
+}Async_io_kind_t;
+
+typedef struct Async_io_job {
+	Async_io_kind_t kind;
+	char* filename;
+	char name[MATRIX_NAME_LEN]; /* matrix a read will store, empty if the file has no usable header */
+	unsigned int flags; /* write_matrix_ex flags of a write */
+	Matrix_t* matrix; /* snapshot being written, or the matrix read once done */
+	bool ok;
+	struct Async_io_job* next;
+}Async_io_job_t;
+
+bool init_async_io (void);
+void shutdown_async_io (void);
+bool async_write_matrix (Matrix_t* m, unsigned int flags);
+bool async_read_matrix (const char* filename);
+void async_io_wait (const char* filename, bool reads_only);
+void async_io_wait_matrix (const char* name, size_t len);
+Async_io_job_t* async_io_take_done (void);
+void free_async_io_job (Async_io_job_t* job);
+
+#endif
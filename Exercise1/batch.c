@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+#include "batch.h"
+
+#define BATCH_READ_BUFFER (1 << 20)
+
+typedef struct {
+	FILE* input;
+	/* slots keep their line buffers, so steady state parsing doesn't allocate */
+	Commands_t queue[BATCH_QUEUE_LEN];
+	size_t head; /* the slot being run stays owned by the consumer until head moves past it */
+	size_t tail; /* head == tail is empty, the queue holds at most BATCH_QUEUE_LEN - 1 */
+	char* line; /* getline buffer, owned by the parser until it is joined */
+	size_t line_cap;
+	bool eof;
+	bool failed;
+	int error; /* errno of the failed parse */
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+}Batch_queue_t;
+
+/* 
+ * PURPOSE: Cancellation handler for a parser cancelled while waiting for
+ *  room in the queue, releases the lock
+ * INPUTS: Address of the Batch_queue_t
+ * RETURN: Nothing
+ **/
+
+static void abandon_command (void* arg) {
+	Batch_queue_t* q = arg;
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* 
+ * PURPOSE: Parser thread, reads and tokenizes lines and queues the commands
+ * INPUTS: Address of the Batch_queue_t
+ * RETURN: NULL
+ **/
+
+static void* parse_ahead (void* arg) {
+	Batch_queue_t* q = arg;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	for (;;) {
+		/* the consumer may cancel us while we wait for input */
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		ssize_t len = getline(&q->line, &q->line_cap, q->input);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		if (len < 0) {
+			break;
+		}
+
+		pthread_mutex_lock(&q->lock);
+		while ((q->tail + 1) % BATCH_QUEUE_LEN == q->head) {
+			pthread_cleanup_push(abandon_command, q);
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+			pthread_cond_wait(&q->not_full, &q->lock);
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+			pthread_cleanup_pop(0);
+		}
+		Commands_t* cmd = &q->queue[q->tail];
+		pthread_mutex_unlock(&q->lock);
+
+		/* the tail slot is invisible to the consumer until tail moves */
+		if (!parse_user_input(q->line, cmd)) {
+			const int error = errno;
+			pthread_mutex_lock(&q->lock);
+			q->failed = true;
+			q->error = error;
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		if (cmd->num_cmds == 0) {
+			continue;
+		}
+
+		pthread_mutex_lock(&q->lock);
+		q->tail = (q->tail + 1) % BATCH_QUEUE_LEN;
+		pthread_cond_signal(&q->not_empty);
+		pthread_mutex_unlock(&q->lock);
+	}
+	pthread_mutex_lock(&q->lock);
+	q->eof = true;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/* 
+ * PURPOSE: Execute every command of a script, parsing ahead on a second thread
+ * INPUTS: Script stream, handler run for each command, context passed to the handler
+ * RETURN: True if the script ran to its end or the handler stopped it, false
+ *  if reading or parsing failed (errno is the parser's when parsing did)
+ **/
+
+bool run_batch (FILE* input, batch_handler_t handler, void* ctx) {
+	if (input == NULL || handler == NULL) return false;
+
+	setvbuf(input, NULL, _IOFBF, BATCH_READ_BUFFER);
+
+	Batch_queue_t* q = calloc(1, sizeof(Batch_queue_t));
+	if (!q) {
+		return false;
+	}
+	q->input = input;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+
+	pthread_t parser;
+	if (pthread_create(&parser, NULL, parse_ahead, q) != 0) {
+		free(q);
+		return false;
+	}
+
+	bool stopped = false;
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		while (q->head == q->tail && !q->eof) {
+			pthread_cond_wait(&q->not_empty, &q->lock);
+		}
+		if (q->head == q->tail) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		Commands_t* cmd = &q->queue[q->head];
+		pthread_mutex_unlock(&q->lock);
+
+		const bool keep_going = handler(cmd, ctx);
+
+		pthread_mutex_lock(&q->lock);
+		q->head = (q->head + 1) % BATCH_QUEUE_LEN;
+		pthread_cond_signal(&q->not_full);
+		pthread_mutex_unlock(&q->lock);
+		if (!keep_going) {
+			stopped = true;
+			break;
+		}
+	}
+
+	if (stopped) {
+		pthread_cancel(parser);
+	}
+	pthread_join(parser, NULL);
+
+	for (size_t i = 0; i < BATCH_QUEUE_LEN; ++i) {
+		destroy_commands(&q->queue[i]);
+	}
+	free(q->line);
+	const bool ok = !q->failed && (stopped || !ferror(input));
+	const int error = q->error;
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+	free(q);
+	if (error != 0) {
+		errno = error;
+	}
+	return ok;
+}
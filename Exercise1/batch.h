@@ -0,0 +1,22 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "command.h"
+
+/*
+ * Non-interactive driver. A parser thread reads the script through a large
+ * stdio buffer and tokenizes up to BATCH_QUEUE_LEN commands ahead while the
+ * calling thread executes them in order.
+ */
+
+#define BATCH_QUEUE_LEN 256
+
+/* returns false to stop the batch, e.g. on exit */
+typedef bool (*batch_handler_t) (Commands_t* cmd, void* ctx);
+
+bool run_batch (FILE* input, batch_handler_t handler, void* ctx);
+
+#endif
@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "command.h"
+#include "matrix.h"
+#include "matrix_kernels.h"
+#include "threadpool.h"
+#include "prng.h"
+#include "expr.h"
+
+/*
+ * Micro benchmarks for every matrix.c entry point and the command parser.
+ * Each case is warmed up, then timed until it has MIN_REPS samples and has
+ * run for at least MIN_SECONDS (capped at MAX_REPS). Results go to stdout
+ * and optionally to a JSON file that a later run can compare against.
+ */
+
+#define MIN_REPS 5
+#define MAX_REPS 1000
+#define WARMUP_REPS 2
+#define MIN_SECONDS 0.2
+#define DEFAULT_THRESHOLD 10.0
+#define MAX_RESULTS 256
+#define BENCH_FILE "matbench.tmp"
+
+typedef struct {
+	char name[32];
+	unsigned int rows;
+	unsigned int cols;
+	double median_ns;
+	double p99_ns;
+	double bytes; /* memory touched per call, 0 when elements/s is the better unit */
+	double items;
+}Bench_result_t;
+
+typedef struct {
+	Matrix_t* a;
+	Matrix_t* b;
+	Matrix_t* c;
+	const char* line;
+	Commands_t cmd;
+	Expr_t expr;
+}Bench_ctx_t;
+
+typedef void (*bench_fn_t) (Bench_ctx_t* ctx);
+
+static Bench_result_t results[MAX_RESULTS];
+static unsigned int num_results;
+
+/* 
+ * PURPOSE: Monotonic clock in nanoseconds
+ * INPUTS: Nothing
+ * RETURN: Current time in nanoseconds
+ **/
+
+static double now_ns (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* 
+ * PURPOSE: qsort comparator for doubles
+ * INPUTS: Addresses of two doubles
+ * RETURN: Negative, zero or positive like strcmp
+ **/
+
+static int compare_doubles (const void* a, const void* b) {
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void bench_create (Bench_ctx_t* ctx) {
+	Matrix_t* m = NULL;
+	create_matrix(&m, "bench", ctx->a->rows, ctx->a->cols);
+	destroy_matrix(&m);
+}
+
+static void bench_add (Bench_ctx_t* ctx) {
+	add_matrices(ctx->a, ctx->b, ctx->c);
+}
+
+static void bench_shift (Bench_ctx_t* ctx) {
+	/* alternate directions so c never shifts out to zeros and turns sparse */
+	static char direction = 'l';
+	bitwise_shift_matrix(ctx->c, direction, 1);
+	direction = direction == 'l' ? 'r' : 'l';
+}
+
+static void bench_eval (Bench_ctx_t* ctx) {
+	eval_expression(&ctx->expr, ctx->c);
+}
+
+static void bench_sum (Bench_ctx_t* ctx) {
+	unsigned __int128 sum;
+	sum_matrix(ctx->a, &sum);
+}
+
+static void bench_sum_real (Bench_ctx_t* ctx) {
+	double sum;
+	sum_matrix_real(ctx->a, &sum);
+}
+
+static void bench_describe (Bench_ctx_t* ctx) {
+	Matrix_stats_t stats;
+	stats_matrix(ctx->a, 0, NULL, &stats);
+}
+
+static void bench_random (Bench_ctx_t* ctx) {
+	random_matrix(ctx->c, 10, 15);
+}
+
+static void bench_duplicate (Bench_ctx_t* ctx) {
+	Matrix_t* m = NULL;
+	create_matrix_copy(&m, "bench", ctx->a);
+	destroy_matrix(&m);
+}
+
+static void bench_transpose (Bench_ctx_t* ctx) {
+	transpose_matrix(ctx->a, ctx->c);
+}
+
+static void bench_equal (Bench_ctx_t* ctx) {
+	equal_matrices(ctx->a, ctx->b);
+}
+
+static void bench_write (Bench_ctx_t* ctx) {
+	write_matrix(BENCH_FILE, ctx->a);
+}
+
+static void bench_read (Bench_ctx_t* ctx) {
+	Matrix_t* m = NULL;
+	read_matrix(BENCH_FILE, &m);
+	destroy_matrix(&m);
+}
+
+static void bench_write_packed (Bench_ctx_t* ctx) {
+	write_matrix_ex(BENCH_FILE, ctx->a, WRITE_MATRIX_COMPRESS);
+}
+
+static void bench_parse (Bench_ctx_t* ctx) {
+	parse_user_input(ctx->line, &ctx->cmd);
+}
+
+/* 
+ * PURPOSE: Time one case and record its median and p99
+ * INPUTS: Case name, benchmark function, context, bytes and items per call
+ * RETURN: Nothing
+ **/
+
+static void run_case (const char* name, bench_fn_t fn, Bench_ctx_t* ctx,
+			double bytes, double items) {
+	static double samples[MAX_REPS];
+	if (num_results == MAX_RESULTS) return;
+
+	for (int i = 0; i < WARMUP_REPS; ++i) {
+		fn(ctx);
+	}
+	unsigned int reps = 0;
+	const double start = now_ns();
+	while (reps < MAX_REPS && (reps < MIN_REPS || now_ns() - start < MIN_SECONDS * 1e9)) {
+		const double t0 = now_ns();
+		fn(ctx);
+		samples[reps++] = now_ns() - t0;
+	}
+	qsort(samples, reps, sizeof(double), compare_doubles);
+
+	Bench_result_t* r = &results[num_results++];
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->rows = ctx->a ? ctx->a->rows : 0;
+	r->cols = ctx->a ? ctx->a->cols : 0;
+	r->median_ns = samples[reps / 2];
+	r->p99_ns = samples[(reps * 99) / 100 < reps ? (reps * 99) / 100 : reps - 1];
+	r->bytes = bytes;
+	r->items = items;
+
+	if (bytes > 0) {
+		printf("%-10s %5ux%-5u median %12.0f ns  p99 %12.0f ns  %8.2f GB/s\n",
+			r->name, r->rows, r->cols, r->median_ns, r->p99_ns, bytes / r->median_ns);
+	}
+	else {
+		printf("%-10s %5ux%-5u median %12.0f ns  p99 %12.0f ns  %8.2f M items/s\n",
+			r->name, r->rows, r->cols, r->median_ns, r->p99_ns, items / r->median_ns * 1e3);
+	}
+}
+
+/* 
+ * PURPOSE: Run the add and sum cases on u8 and f32 matrices, to compare the
+ *  typed templates against the u32 kernels
+ * INPUTS: Side length
+ * RETURN: True if the matrices could be created, else false
+ **/
+
+static bool bench_types (unsigned int n) {
+	static const Matrix_type_t types[] = {MATRIX_U8, MATRIX_F32};
+	const double elems = (double)n * n;
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+		Bench_ctx_t ctx = {0};
+		if (!create_matrix_typed(&ctx.a, "a", n, n, types[i], true)
+			|| !create_matrix_typed(&ctx.b, "b", n, n, types[i], true)
+			|| !create_matrix_typed(&ctx.c, "c", n, n, types[i], false)) {
+			destroy_matrix(&ctx.a);
+			destroy_matrix(&ctx.b);
+			return false;
+		}
+		random_matrix(ctx.a, 0, 100);
+		/* b gets its own copy, a shared one would make equal a pointer compare */
+		if (!duplicate_matrix(ctx.a, ctx.b) || !unshare_matrix(ctx.b, true)) {
+			destroy_matrix(&ctx.a);
+			destroy_matrix(&ctx.b);
+			destroy_matrix(&ctx.c);
+			return false;
+		}
+
+		const bool real = types[i] == MATRIX_F32;
+		const double bytes = (double)matrix_data_bytes(ctx.a);
+		run_case(real ? "add_f32" : "add_u8", bench_add, &ctx, 3 * bytes, elems);
+		run_case(real ? "sum_f32" : "sum_u8", real ? bench_sum_real : bench_sum, &ctx, bytes, elems);
+
+		destroy_matrix(&ctx.a);
+		destroy_matrix(&ctx.b);
+		destroy_matrix(&ctx.c);
+	}
+	return true;
+}
+
+/* 
+ * PURPOSE: Run every matrix case for one square size
+ * INPUTS: Side length
+ * RETURN: True if the matrices could be created, else false
+ **/
+
+static bool bench_size (unsigned int n) {
+	Bench_ctx_t ctx = {0};
+	if (!create_matrix(&ctx.a, "a", n, n) || !create_matrix(&ctx.b, "b", n, n)
+		|| !create_matrix(&ctx.c, "c", n, n)) {
+		destroy_matrix(&ctx.a);
+		destroy_matrix(&ctx.b);
+		return false;
+	}
+	random_matrix(ctx.a, 0, 1000);
+	/* b gets its own copy, a shared one would make equal a pointer compare */
+	if (!duplicate_matrix(ctx.a, ctx.b) || !unshare_matrix(ctx.b, true)) {
+		destroy_matrix(&ctx.a);
+		destroy_matrix(&ctx.b);
+		destroy_matrix(&ctx.c);
+		return false;
+	}
+
+	const double elems = (double)n * n;
+	const double bytes = elems * sizeof(unsigned int);
+	run_case("create", bench_create, &ctx, 0, elems);
+	run_case("add", bench_add, &ctx, 3 * bytes, elems);
+	run_case("shift", bench_shift, &ctx, 2 * bytes, elems);
+
+	/* (a + b) << 2, fused, against the add + shift pair above */
+	ctx.expr = (Expr_t){.num_nodes = 4, .root = 3, .rows = n, .cols = n};
+	ctx.expr.nodes[0] = (Expr_node_t){.op = EXPR_MATRIX, .matrix = ctx.a};
+	ctx.expr.nodes[1] = (Expr_node_t){.op = EXPR_MATRIX, .matrix = ctx.b};
+	ctx.expr.nodes[2] = (Expr_node_t){.op = EXPR_ADD, .left = 0, .right = 1};
+	ctx.expr.nodes[3] = (Expr_node_t){.op = EXPR_SHIFT_LEFT, .left = 2, .shift = 2};
+	run_case("eval", bench_eval, &ctx, 3 * bytes, elems);
+	run_case("sum", bench_sum, &ctx, bytes, elems);
+	run_case("transpose", bench_transpose, &ctx, 2 * bytes, elems);
+	run_case("describe", bench_describe, &ctx, bytes, elems);
+	run_case("random", bench_random, &ctx, 0, elems);
+	run_case("duplicate", bench_duplicate, &ctx, 0, elems);
+	run_case("equal", bench_equal, &ctx, 2 * bytes, elems);
+	run_case("write", bench_write, &ctx, bytes, elems);
+	run_case("read", bench_read, &ctx, bytes, elems);
+	/* a holds 0..1000, so blocks pack to 10 bits per element */
+	run_case("write_pack", bench_write_packed, &ctx, bytes, elems);
+	run_case("read_pack", bench_read, &ctx, bytes, elems);
+	unlink(BENCH_FILE);
+
+	destroy_matrix(&ctx.a);
+	destroy_matrix(&ctx.b);
+	destroy_matrix(&ctx.c);
+	return bench_types(n);
+}
+
+/* 
+ * PURPOSE: Write every result as a JSON array, one object per line
+ * INPUTS: Output filename
+ * RETURN: True if written, else false
+ **/
+
+static bool write_json (const char* filename) {
+	FILE* out = fopen(filename, "w");
+	if (!out) {
+		perror("Failed to open JSON output");
+		return false;
+	}
+	fprintf(out, "[\n");
+	for (unsigned int i = 0; i < num_results; ++i) {
+		const Bench_result_t* r = &results[i];
+		fprintf(out, "{\"name\": \"%s\", \"rows\": %u, \"cols\": %u, \"median_ns\": %.0f, "
+			"\"p99_ns\": %.0f, \"bytes\": %.0f, \"items\": %.0f}%s\n",
+			r->name, r->rows, r->cols, r->median_ns, r->p99_ns, r->bytes, r->items,
+			i + 1 < num_results ? "," : "");
+	}
+	fprintf(out, "]\n");
+	return fclose(out) == 0;
+}
+
+/* 
+ * PURPOSE: Compare this run's medians against a JSON file written by --out
+ * INPUTS: Baseline filename, allowed slowdown in percent
+ * RETURN: Number of regressions, -1 if the baseline couldn't be read
+ **/
+
+static int compare_json (const char* filename, double threshold) {
+	FILE* in = fopen(filename, "r");
+	if (!in) {
+		perror("Failed to open baseline");
+		return -1;
+	}
+	int regressions = 0;
+	char line[512];
+	printf("\n%-10s %11s %14s %14s %8s\n", "case", "size", "baseline ns", "current ns", "change");
+	while (fgets(line, sizeof(line), in)) {
+		Bench_result_t base;
+		if (sscanf(line, "{\"name\": \"%31[^\"]\", \"rows\": %u, \"cols\": %u, \"median_ns\": %lf",
+				base.name, &base.rows, &base.cols, &base.median_ns) != 4) {
+			continue;
+		}
+		for (unsigned int i = 0; i < num_results; ++i) {
+			const Bench_result_t* r = &results[i];
+			if (strcmp(r->name, base.name) != 0 || r->rows != base.rows || r->cols != base.cols) {
+				continue;
+			}
+			const double change = (r->median_ns - base.median_ns) / base.median_ns * 100.0;
+			const bool regressed = change > threshold;
+			regressions += regressed;
+			printf("%-10s %5ux%-5u %14.0f %14.0f %+7.1f%%%s\n", r->name, r->rows, r->cols,
+				base.median_ns, r->median_ns, change, regressed ? "  REGRESSION" : "");
+		}
+	}
+	fclose(in);
+	return regressions;
+}
+
+/* 
+ * PURPOSE: Benchmark driver
+ * INPUTS: Command line: [--quick] [--out file.json] [--compare baseline.json]
+ *  [--threshold percent]
+ * RETURN: 0 on success, 1 if the comparison found regressions, -1 on error
+ **/
+
+int main (int argc, char** argv) {
+	const char* out = NULL;
+	const char* baseline = NULL;
+	double threshold = DEFAULT_THRESHOLD;
+	unsigned int max_size = 4096;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			out = argv[++i];
+		}
+		else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+			baseline = argv[++i];
+		}
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--quick") == 0) {
+			max_size = 256;
+		}
+		else {
+			fprintf(stderr, "usage: %s [--quick] [--out file.json] [--compare baseline.json] "
+				"[--threshold percent]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	init_matrix_kernels();
+	init_thread_pool(0);
+	seed_prng(1);
+	printf("kernels %s, %u threads\n", matrix_kernels.name, thread_pool_size());
+
+	/* from L1 resident up to far beyond the last level cache */
+	for (unsigned int n = 4; n <= max_size; n *= 4) {
+		if (!bench_size(n)) {
+			fprintf(stderr, "Failed to create %ux%u matrices\n", n, n);
+			return -1;
+		}
+	}
+
+	Bench_ctx_t parse_ctx = {0};
+	parse_ctx.line = "add first_matrix second_matrix result_matrix\n";
+	run_case("parse", bench_parse, &parse_ctx, 0, 1);
+	destroy_commands(&parse_ctx.cmd);
+
+	int status = 0;
+	if (out && !write_json(out)) {
+		status = -1;
+	}
+	if (baseline) {
+		const int regressions = compare_json(baseline, threshold);
+		if (regressions < 0) {
+			status = -1;
+		}
+		else if (regressions > 0 && status == 0) {
+			printf("%d cases slower than the baseline by more than %.1f%%\n", regressions, threshold);
+			status = 1;
+		}
+	}
+	shutdown_thread_pool();
+	return status;
+}
@@ -2,66 +2,86 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
 
 #include "command.h"
+#include "stats.h"
 
-#define MAX_CMD_COUNT 50
-#define MAX_CMD_LEN 25
-
-
-	//TODO FUNCTION COMMENT
+#define MIN_BUFFER_LEN 256
 
 /* 
- * PURPOSE: Allocate memory and copy entered command into command structure
- * INPUTS: Address of command entered, address to address of command to populate
- * RETURN: True if successfully created command, false if invalid or couldn't allocate memory
+ * PURPOSE: Tokenize an entered command into the command structure, tokens are
+ *  slices of the command's own line buffer which is only grown, never shrunk
+ * INPUTS: Address of command entered, address of the command to populate
+ * RETURN: True if successfully parsed, false if invalid, longer than
+ *  MAX_CMD_COUNT tokens (errno E2BIG) or couldn't allocate memory
  **/
 
-bool parse_user_input (const char* input, Commands_t** cmd) {
+bool parse_user_input (const char* input, Commands_t* cmd) {
+	STATS_SCOPE(scope, STAT_PARSE);
 	
-	//TODO ERROR CHECK INCOMING PARAMETERS
     if(input == NULL || cmd == NULL) return false;
 
-	char *string = strdup(input);
-	
-	*cmd = calloc (1,sizeof(Commands_t));
-	(*cmd)->cmds = calloc(MAX_CMD_COUNT,sizeof(char*));
-
-	unsigned int i = 0;
-	char *token;
-	token = strtok(string, " \n");
-	for (; token != NULL && i < MAX_CMD_COUNT; ++i) {
-		(*cmd)->cmds[i] = calloc(MAX_CMD_LEN,sizeof(char));
-		if (!(*cmd)->cmds[i]) {
+	cmd->num_cmds = 0;
+	const size_t len = strlen(input);
+	if (len + 1 > cmd->buffer_cap) {
+		size_t cap = cmd->buffer_cap * 2;
+		if (cap < MIN_BUFFER_LEN) {
+			cap = MIN_BUFFER_LEN;
+		}
+		if (cap < len + 1) {
+			cap = len + 1;
+		}
+		char* buffer = realloc(cmd->buffer, cap);
+		if (!buffer) {
 			perror("Allocation Error\n");
 			return false;
-		}	
-		strncpy((*cmd)->cmds[i],token, strlen(token) + 1);
-		(*cmd)->num_cmds++;
-		token = strtok(NULL, " \n");
+		}
+		cmd->buffer = buffer;
+		cmd->buffer_cap = cap;
+	}
+	memcpy(cmd->buffer, input, len + 1);
+
+	char* p = cmd->buffer;
+	for (;;) {
+		while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+			++p;
+		}
+		if (*p == '\0') {
+			break;
+		}
+		if (cmd->num_cmds == MAX_CMD_COUNT) {
+			/* running the first MAX_CMD_COUNT tokens would run a different command */
+			cmd->num_cmds = 0;
+			errno = E2BIG;
+			return false;
+		}
+		char* token = p;
+		while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+			++p;
+		}
+		cmd->cmds[cmd->num_cmds] = token;
+		cmd->lens[cmd->num_cmds] = p - token;
+		cmd->num_cmds++;
+		if (*p == '\0') {
+			break;
+		}
+		*p++ = '\0';
 	}
-	free(string);
 	return true;
 }
 
-	//TODO FUNCTION COMMENT
-
 /* 
- * PURPOSE: Free memory allocated to command
- * INPUTS: Address to address of command
+ * PURPOSE: Free the line buffer of a command
+ * INPUTS: Address of command
  * RETURN: Nothing
  **/
 
-void destroy_commands(Commands_t** cmd) {
-
-	//TODO ERROR CHECK INCOMING PARAMETERS
-    if(cmd == NULL || *cmd == NULL) return;
+void destroy_commands(Commands_t* cmd) {
+    if(cmd == NULL) return;
 	
-	for (int i = 0; i < (*cmd)->num_cmds; ++i) {
-		free((*cmd)->cmds[i]);
-	}
-	free((*cmd)->cmds);
-	free((*cmd));
-	*cmd = NULL;
+	free(cmd->buffer);
+	cmd->buffer = NULL;
+	cmd->buffer_cap = 0;
+	cmd->num_cmds = 0;
 }
-
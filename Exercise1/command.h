@@ -1,12 +1,26 @@
 #ifndef _COMMAND_H_
 #define _COMMAND_H_
 
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MAX_CMD_COUNT 50
+
+/*
+ * A tokenized command. cmds[i] points into buffer, which holds a copy of the
+ * line with a NUL after every token, and lens[i] is that token's length.
+ * The buffer is kept between lines, so reusing one Commands_t for a whole
+ * session parses without touching the heap once it has grown to the longest line.
+ */
 typedef struct {
 	unsigned int num_cmds;
-	char** cmds;
+	char* cmds[MAX_CMD_COUNT];
+	size_t lens[MAX_CMD_COUNT];
+	char* buffer;
+	size_t buffer_cap;
 }Commands_t;
 
-bool parse_user_input (const char* input, Commands_t** cmd);
-void destroy_commands(Commands_t** cmd);
+bool parse_user_input (const char* input, Commands_t* cmd);
+void destroy_commands(Commands_t* cmd);
 
 #endif
@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "expr.h"
+#include "matrix_types.h"
+#include "matrix_kernels.h"
+#include "matrix_sparse.h"
+#include "threadpool.h"
+#include "stats.h"
+
+/*
+ * Elements evaluated at a time. Every add whose right operand is not a plain
+ * matrix keeps one block of partial results, the others go straight to the
+ * destination, so a task needs at most EXPR_MAX_SCRATCH blocks of stack.
+ */
+#define EXPR_BLOCK 1024
+#define EXPR_MAX_SCRATCH 8
+
+/* shifts of 32 bits or more clear every element, larger amounts fold to this */
+#define EXPR_MAX_SHIFT 32
+
+typedef enum {
+	LEX_END,
+	LEX_WORD,
+	LEX_LPAREN,
+	LEX_RPAREN,
+	LEX_PLUS,
+	LEX_SHIFT_LEFT,
+	LEX_SHIFT_RIGHT,
+	LEX_ERROR
+}Lex_type_t;
+
+typedef struct {
+	Expr_t* expr;
+	Registry_t* mats;
+	char** tokens;
+	unsigned int num_tokens;
+	unsigned int index; /* token being lexed */
+	const char* pos;
+	Lex_type_t type; /* lookahead */
+	const char* text;
+	size_t len;
+}Parser_t;
+
+typedef struct {
+	const Expr_t* expr;
+	unsigned int* dest;
+	size_t cols;
+}Expr_task_t;
+
+static bool parse_expr (Parser_t* p, unsigned int* index);
+
+/*
+ * PURPOSE: Lex the next symbol into the parser's lookahead. Tokens of the
+ *  command line are joined, so "(a+b)" and "( a + b )" lex the same
+ * INPUTS: Address of the parser
+ * RETURN: Nothing
+ **/
+
+static void advance (Parser_t* p) {
+	while (p->index < p->num_tokens && *p->pos == '\0') {
+		if (++p->index < p->num_tokens) {
+			p->pos = p->tokens[p->index];
+		}
+	}
+	if (p->index == p->num_tokens) {
+		p->type = LEX_END;
+		p->len = 0;
+		return;
+	}
+
+	const char* s = p->pos;
+	size_t len = 1;
+	switch (*s) {
+		case '(': p->type = LEX_LPAREN; break;
+		case ')': p->type = LEX_RPAREN; break;
+		case '+': p->type = LEX_PLUS; break;
+		case '<':
+		case '>':
+			p->type = s[1] != s[0] ? LEX_ERROR
+				: (*s == '<' ? LEX_SHIFT_LEFT : LEX_SHIFT_RIGHT);
+			len = 2;
+			break;
+		default:
+			p->type = LEX_WORD;
+			len = strcspn(s, EXPR_PUNCTUATION);
+			break;
+	}
+	p->text = s;
+	p->len = len;
+	p->pos = s + len;
+}
+
+/*
+ * PURPOSE: Append a node to the expression
+ * INPUTS: Address of the parser, node to append, address to store its index
+ * RETURN: True if appended, false if the expression has too many nodes
+ **/
+
+static bool add_node (Parser_t* p, Expr_node_t node, unsigned int* index) {
+	if (p->expr->num_nodes == EXPR_MAX_NODES) {
+		fprintf(matrix_messages(), "Expression has more than %d terms\n", EXPR_MAX_NODES);
+		return false;
+	}
+	*index = p->expr->num_nodes++;
+	p->expr->nodes[*index] = node;
+	return true;
+}
+
+/*
+ * PURPOSE: Parse a matrix name or a parenthesized expression
+ * INPUTS: Address of the parser, address to store the node index
+ * RETURN: True if parsed, false on a syntax error or unknown matrix
+ **/
+
+static bool parse_primary (Parser_t* p, unsigned int* index) {
+	if (p->type == LEX_LPAREN) {
+		advance(p);
+		if (!parse_expr(p, index)) {
+			return false;
+		}
+		if (p->type != LEX_RPAREN) {
+			fprintf(matrix_messages(), "Expected ) in expression\n");
+			return false;
+		}
+		advance(p);
+		return true;
+	}
+	if (p->type != LEX_WORD) {
+		fprintf(matrix_messages(), "Expected a matrix name in expression\n");
+		return false;
+	}
+
+	char name[MATRIX_NAME_LEN];
+	if (p->len >= MATRIX_NAME_LEN) {
+		fprintf(matrix_messages(), "Matrix (%.*s) doesn't exist\n", (int)p->len, p->text);
+		return false;
+	}
+	memcpy(name, p->text, p->len);
+	name[p->len] = '\0';
+	Matrix_t* m = registry_find(p->mats, name);
+	if (!m) {
+		fprintf(matrix_messages(), "Matrix (%s) doesn't exist\n", name);
+		return false;
+	}
+	if (m->type != MATRIX_U32) {
+		fprintf(matrix_messages(), "Matrix (%s) is %s, expressions take u32 matrices\n", name, matrix_types[m->type].name);
+		return false;
+	}
+	if (p->expr->num_nodes == 0) {
+		p->expr->rows = m->rows;
+		p->expr->cols = m->cols;
+	}
+	else if (m->rows != p->expr->rows || m->cols != p->expr->cols) {
+		fprintf(matrix_messages(), "Matrix (%s) is %ux%u, expected %ux%u\n", name, m->rows, m->cols,
+			p->expr->rows, p->expr->cols);
+		return false;
+	}
+	advance(p);
+	return add_node(p, (Expr_node_t){.op = EXPR_MATRIX, .matrix = m}, index);
+}
+
+/*
+ * PURPOSE: Parse a chain of additions
+ * INPUTS: Address of the parser, address to store the node index
+ * RETURN: True if parsed, false on error
+ **/
+
+static bool parse_sum (Parser_t* p, unsigned int* index) {
+	if (!parse_primary(p, index)) {
+		return false;
+	}
+	while (p->type == LEX_PLUS) {
+		advance(p);
+		unsigned int right = 0;
+		if (!parse_primary(p, &right)
+			|| !add_node(p, (Expr_node_t){.op = EXPR_ADD, .left = *index, .right = right}, index)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Parse a sum followed by any number of shifts. Shifts by zero are
+ *  dropped and consecutive shifts in the same direction are merged
+ * INPUTS: Address of the parser, address to store the node index
+ * RETURN: True if parsed, false on error
+ **/
+
+static bool parse_expr (Parser_t* p, unsigned int* index) {
+	if (!parse_sum(p, index)) {
+		return false;
+	}
+	while (p->type == LEX_SHIFT_LEFT || p->type == LEX_SHIFT_RIGHT) {
+		const Expr_op_t op = p->type == LEX_SHIFT_LEFT ? EXPR_SHIFT_LEFT : EXPR_SHIFT_RIGHT;
+		advance(p);
+		char* end = NULL;
+		unsigned long amount = 0;
+		if (p->type == LEX_WORD && p->text[0] >= '0' && p->text[0] <= '9') {
+			amount = strtoul(p->text, &end, 10);
+		}
+		if (end != p->text + p->len) {
+			fprintf(matrix_messages(), "Expected a shift amount in expression\n");
+			return false;
+		}
+		advance(p);
+
+		if (amount > EXPR_MAX_SHIFT) {
+			amount = EXPR_MAX_SHIFT;
+		}
+		if (amount == 0) {
+			continue;
+		}
+		Expr_node_t* child = &p->expr->nodes[*index];
+		if (child->op == op) {
+			child->shift += amount;
+			if (child->shift > EXPR_MAX_SHIFT) {
+				child->shift = EXPR_MAX_SHIFT;
+			}
+			continue;
+		}
+		if (!add_node(p, (Expr_node_t){.op = op, .left = *index, .shift = amount}, index)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Tell whether a node is a matrix whose blocks are read in place. A
+ *  sparse matrix is expanded into the block it is evaluated into instead
+ * INPUTS: Address of the node
+ * RETURN: True for a dense matrix leaf
+ **/
+
+static bool dense_leaf (const Expr_node_t* node) {
+	return node->op == EXPR_MATRIX && !node->matrix->csr;
+}
+
+/*
+ * PURPOSE: Count the scratch blocks a subtree needs, swapping the operands of
+ *  additions so the deeper side is evaluated first into the caller's block
+ * INPUTS: Address of the expression, index of the subtree
+ * RETURN: Number of scratch blocks
+ **/
+
+static unsigned int plan_scratch (Expr_t* expr, unsigned int index) {
+	Expr_node_t* node = &expr->nodes[index];
+	if (node->op == EXPR_MATRIX) {
+		return 0;
+	}
+	if (node->op != EXPR_ADD) {
+		return plan_scratch(expr, node->left);
+	}
+
+	const unsigned int left = plan_scratch(expr, node->left);
+	const unsigned int right = plan_scratch(expr, node->right);
+	/* the right operand is evaluated into a scratch block unless it is a dense matrix */
+	const unsigned int left_first = dense_leaf(&expr->nodes[node->right]) ? left
+		: (left > right + 1 ? left : right + 1);
+	const unsigned int right_first = dense_leaf(&expr->nodes[node->left]) ? right
+		: (right > left + 1 ? right : left + 1);
+	if (right_first < left_first) {
+		const unsigned int tmp = node->left;
+		node->left = node->right;
+		node->right = tmp;
+		return right_first;
+	}
+	return left_first;
+}
+
+/*
+ * PURPOSE: Parse an expression over the named matrices of the registry
+ * INPUTS: Address of the expression to fill, tokens of the expression,
+ *  number of tokens, address of the matrix registry
+ * RETURN: True if parsed, false (with a message) on a syntax error, unknown
+ *  or mismatched matrix, or an expression too large to evaluate
+ **/
+
+bool parse_expression (Expr_t* expr, char** tokens, unsigned int num_tokens, Registry_t* mats) {
+	if (expr == NULL || tokens == NULL || num_tokens == 0 || mats == NULL) return false;
+
+	Parser_t p = {.expr = expr, .mats = mats, .tokens = tokens, .num_tokens = num_tokens,
+		.pos = tokens[0]};
+	expr->num_nodes = 0;
+	advance(&p);
+	if (!parse_expr(&p, &expr->root)) {
+		return false;
+	}
+	if (p.type != LEX_END) {
+		fprintf(matrix_messages(), "Unexpected (%.*s) in expression\n", (int)p.len, p.text);
+		return false;
+	}
+	if (plan_scratch(expr, expr->root) > EXPR_MAX_SCRATCH) {
+		fprintf(matrix_messages(), "Expression is nested too deeply\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Evaluate one block of a subtree
+ * INPUTS: Address of the expression, subtree index, element offset of the
+ *  block, element count, block the result may be written to, scratch blocks
+ * RETURN: Address of the result, out or the data of a matrix leaf
+ **/
+
+static const unsigned int* eval_block (const Expr_t* expr, unsigned int index, size_t offset,
+			size_t n, unsigned int* out, unsigned int (*scratch)[EXPR_BLOCK]) {
+	const Expr_node_t* node = &expr->nodes[index];
+	switch (node->op) {
+		case EXPR_MATRIX:
+			if (node->matrix->csr) {
+				csr_range_to_dense(node->matrix->csr, node->matrix->cols, offset, n, out);
+				return out;
+			}
+			return node->matrix->data + offset;
+		case EXPR_ADD: {
+			const unsigned int* a = eval_block(expr, node->left, offset, n, out, scratch);
+			const unsigned int* b = eval_block(expr, node->right, offset, n, scratch[0], scratch + 1);
+			matrix_kernels.add(out, a, b, n);
+			return out;
+		}
+		case EXPR_SHIFT_LEFT:
+			matrix_kernels.shift_left(out, eval_block(expr, node->left, offset, n, out, scratch),
+				n, node->shift);
+			return out;
+		case EXPR_SHIFT_RIGHT:
+			matrix_kernels.shift_right(out, eval_block(expr, node->left, offset, n, out, scratch),
+				n, node->shift);
+			return out;
+	}
+	return out;
+}
+
+/*
+ * PURPOSE: Row block task for eval_expression, evaluates the tree over the rows
+ *  EXPR_BLOCK elements at a time and stores the result in the destination
+ * INPUTS: Address of the Expr_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void eval_rows (void* ctx, size_t begin, size_t end) {
+	const Expr_task_t* task = ctx;
+	unsigned int scratch[EXPR_MAX_SCRATCH][EXPR_BLOCK] __attribute__((aligned(64)));
+
+	const size_t last = end * task->cols;
+	for (size_t i = begin * task->cols; i < last; i += EXPR_BLOCK) {
+		const size_t n = last - i < EXPR_BLOCK ? last - i : EXPR_BLOCK;
+		unsigned int* out = task->dest + i;
+		const unsigned int* result = eval_block(task->expr, task->expr->root, i, n, out, scratch);
+		if (result != out) {
+			memcpy(out, result, n * sizeof(unsigned int));
+		}
+	}
+}
+
+/*
+ * PURPOSE: Evaluate a parsed expression into a matrix in a single pass
+ * INPUTS: Address of the expression, address of the destination matrix which
+ *  must not be one of the expression's operands
+ * RETURN: True if evaluated, false on bad arguments or mismatched size
+ **/
+
+bool eval_expression (const Expr_t* expr, Matrix_t* dest) {
+	STATS_SCOPE(scope, STAT_EVAL_EXPRESSION);
+
+	if (expr == NULL || dest == NULL || expr->num_nodes == 0) return false;
+	if (dest->rows != expr->rows || dest->cols != expr->cols
+		|| !unshare_matrix(dest, false)) {
+		return false;
+	}
+
+	unsigned int leaves = 0;
+	for (unsigned int i = 0; i < expr->num_nodes; ++i) {
+		if (expr->nodes[i].op == EXPR_MATRIX) {
+			++leaves;
+		}
+	}
+	Expr_task_t task = {.expr = expr, .dest = dest->data, .cols = dest->cols};
+	scope.bytes = (leaves + 1ull) * dest->rows * dest->cols * sizeof(unsigned int);
+	parallel_for(dest->rows, parallel_grain_rows(dest->cols), eval_rows, &task);
+	return true;
+}
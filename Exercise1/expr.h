@@ -0,0 +1,52 @@
+#ifndef _EXPR_H_
+#define _EXPR_H_
+
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "registry.h"
+
+/*
+ * Element-wise expressions over named matrices for the eval command, e.g.
+ * (a + b) << 2. The grammar follows C precedence, + binds tighter than the
+ * shifts, and shift amounts are integer literals:
+ *
+ *	expr    := sum (('<<' | '>>') number)*
+ *	sum     := primary ('+' primary)*
+ *	primary := name | '(' expr ')'
+ *
+ * The tree is evaluated in one pass over cache sized blocks of the result,
+ * so no full size intermediate matrix is ever written.
+ */
+
+#define EXPR_MAX_NODES 32
+/* characters that end a matrix name inside an expression token */
+#define EXPR_PUNCTUATION "()+<>"
+
+typedef enum {
+	EXPR_MATRIX,
+	EXPR_ADD,
+	EXPR_SHIFT_LEFT,
+	EXPR_SHIFT_RIGHT
+}Expr_op_t;
+
+typedef struct {
+	Expr_op_t op;
+	unsigned int left; /* operand of a shift, left operand of an add */
+	unsigned int right;
+	unsigned int shift;
+	const Matrix_t* matrix;
+}Expr_node_t;
+
+typedef struct {
+	Expr_node_t nodes[EXPR_MAX_NODES];
+	unsigned int num_nodes;
+	unsigned int root;
+	unsigned int rows;
+	unsigned int cols;
+}Expr_t;
+
+bool parse_expression (Expr_t* expr, char** tokens, unsigned int num_tokens, Registry_t* mats);
+bool eval_expression (const Expr_t* expr, Matrix_t* dest);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "io_ring.h"
+
+typedef struct {
+	int fd;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_len;
+	void *cq_ring; /* same as sq_ring when the kernel maps both rings at once */
+	size_t cq_ring_len;
+	size_t sqes_len;
+}Io_ring_t;
+
+/* one chunk of an io_ring_read, the cqe's user_data is its index */
+typedef struct {
+	size_t pos;
+	size_t left;
+}Io_chunk_t;
+
+static __thread Io_ring_t ring = {.fd = -1};
+static __thread int ring_state; /* 0 until first use, then 1 usable or -1 unavailable */
+
+/*
+ * PURPOSE: Read exactly len bytes at a file offset with pread, resuming after
+ *  short reads and interrupted calls, at most IO_RING_MAX_PREAD per call
+ * INPUTS: File descriptor, destination, length, file offset
+ * RETURN: True if everything was read, false on error or end of file
+ **/
+
+static bool pread_all (int fd, void* buf, size_t len, uint64_t offset) {
+	unsigned char* p = buf;
+	while (len > 0) {
+		ssize_t got = pread(fd, p, len < IO_RING_MAX_PREAD ? len : IO_RING_MAX_PREAD, (off_t)offset);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		p += got;
+		len -= got;
+		offset += got;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Create the calling thread's ring and map its queues
+ * INPUTS: Address of the ring to set up
+ * RETURN: True if the ring is usable, else false with nothing left open
+ **/
+
+static bool setup_ring (Io_ring_t* r) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, IO_RING_DEPTH, &p);
+	if (r->fd < 0) {
+		return false;
+	}
+
+	r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single) {
+		if (r->cq_ring_len > r->sq_ring_len) {
+			r->sq_ring_len = r->cq_ring_len;
+		}
+		r->cq_ring_len = r->sq_ring_len;
+	}
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		r->fd, IORING_OFF_SQ_RING);
+	r->cq_ring = single ? r->sq_ring : mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		r->fd, IORING_OFF_SQES);
+	if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+		if (r->sqes != MAP_FAILED) {
+			munmap(r->sqes, r->sqes_len);
+		}
+		if (!single && r->cq_ring != MAP_FAILED) {
+			munmap(r->cq_ring, r->cq_ring_len);
+		}
+		if (r->sq_ring != MAP_FAILED) {
+			munmap(r->sq_ring, r->sq_ring_len);
+		}
+		close(r->fd);
+		r->fd = -1;
+		return false;
+	}
+
+	unsigned char* sq = r->sq_ring;
+	unsigned char* cq = r->cq_ring;
+	r->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int*)(sq + p.sq_off.array);
+	r->cq_head = (unsigned int*)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	return true;
+}
+
+/*
+ * PURPOSE: Report whether the calling thread can use io_uring, setting its
+ *  ring up on the first call
+ * INPUTS: Nothing
+ * RETURN: True if reads go through io_uring, false if they fall back to pread
+ **/
+
+bool io_ring_available (void) {
+	if (ring_state == 0) {
+		const char* env = getenv("MATLAB_IO_URING");
+		const bool allowed = env == NULL || strcmp(env, "0") != 0;
+		ring_state = allowed && setup_ring(&ring) ? 1 : -1;
+	}
+	return ring_state > 0;
+}
+
+/*
+ * PURPOSE: Close the calling thread's ring, the next read sets it up again
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+void io_ring_release (void) {
+	if (ring_state > 0) {
+		munmap(ring.sqes, ring.sqes_len);
+		if (ring.cq_ring != ring.sq_ring) {
+			munmap(ring.cq_ring, ring.cq_ring_len);
+		}
+		munmap(ring.sq_ring, ring.sq_ring_len);
+		close(ring.fd);
+		ring.fd = -1;
+	}
+	ring_state = 0;
+}
+
+/*
+ * PURPOSE: Put a read of one chunk on the submission queue
+ * INPUTS: File descriptor, destination buffer, chunk, its index, file offset of buf
+ * RETURN: Nothing
+ **/
+
+static void queue_chunk (int fd, unsigned char* buf, const Io_chunk_t* chunk, unsigned int index,
+			uint64_t offset) {
+	const unsigned int tail = *ring.sq_tail;
+	const unsigned int slot = tail & *ring.sq_mask;
+	struct io_uring_sqe* sqe = &ring.sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)(buf + chunk->pos);
+	sqe->len = (uint32_t)chunk->left;
+	sqe->off = offset + chunk->pos;
+	sqe->user_data = index;
+	ring.sq_array[slot] = slot;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * PURPOSE: Wait for reads the kernel already took off the submission queue,
+ *  discarding their results. Completions land in the mapped ring even when
+ *  io_uring_enter itself keeps failing, so the ring is watched directly then
+ * INPUTS: Number of reads still owned by the kernel
+ * RETURN: Nothing, the kernel no longer touches their buffers
+ **/
+
+static void drain_ring (unsigned int in_kernel) {
+	while (in_kernel > 0) {
+		if (syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+			&& errno != EINTR) {
+			sched_yield();
+		}
+		const unsigned int tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		const unsigned int done = tail - *ring.cq_head;
+		in_kernel -= done < in_kernel ? done : in_kernel;
+		__atomic_store_n(ring.cq_head, tail, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * PURPOSE: Read exactly len bytes at a file offset, as IO_RING_CHUNK sized
+ *  reads with up to IO_RING_DEPTH in flight (or one pread loop for reads
+ *  of a single chunk). Short reads are requeued for the rest of their
+ *  chunk. Returns only once the kernel is done with buf.
+ * INPUTS: File descriptor, destination, length, file offset
+ * RETURN: True if everything was read, false on error or end of file
+ **/
+
+bool io_ring_read (int fd, void* buf, size_t len, uint64_t offset) {
+	/* a single chunk has nothing to overlap with */
+	if (len <= IO_RING_CHUNK || !io_ring_available()) {
+		return pread_all(fd, buf, len, offset);
+	}
+
+	Io_chunk_t chunks[IO_RING_DEPTH];
+	unsigned int free_chunks[IO_RING_DEPTH];
+	unsigned int num_free = IO_RING_DEPTH;
+	for (unsigned int i = 0; i < IO_RING_DEPTH; ++i) {
+		free_chunks[i] = IO_RING_DEPTH - 1 - i;
+	}
+
+	size_t next = 0;
+	unsigned int in_flight = 0;
+	unsigned int unsubmitted = 0;
+	int error = 0;
+	while (in_flight > 0 || (next < len && error == 0)) {
+		while (num_free > 0 && next < len && error == 0) {
+			const unsigned int i = free_chunks[--num_free];
+			chunks[i].pos = next;
+			chunks[i].left = len - next < IO_RING_CHUNK ? len - next : IO_RING_CHUNK;
+			next += chunks[i].left;
+			queue_chunk(fd, buf, &chunks[i], i, offset);
+			++in_flight;
+			++unsubmitted;
+		}
+
+		int submitted = syscall(__NR_io_uring_enter, ring.fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (submitted < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+				continue;
+			}
+			/* the ring is unusable, let the kernel finish with buf before dropping it */
+			const int saved = errno;
+			const bool idle = in_flight == unsubmitted;
+			drain_ring(in_flight - unsubmitted);
+			io_ring_release();
+			ring_state = -1;
+			if (idle) {
+				/* nothing reached the kernel, read it all with pread instead */
+				return pread_all(fd, buf, len, offset);
+			}
+			errno = saved;
+			perror("io_uring_enter");
+			return false;
+		}
+		unsubmitted -= submitted;
+
+		unsigned int head = *ring.cq_head;
+		const unsigned int tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			const struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+			const unsigned int i = (unsigned int)cqe->user_data;
+			if (cqe->res > 0) {
+				chunks[i].pos += cqe->res;
+				chunks[i].left -= cqe->res;
+			}
+			else if (cqe->res != -EAGAIN && cqe->res != -EINTR && error == 0) {
+				error = cqe->res < 0 ? -cqe->res : EIO; /* 0 is end of file */
+			}
+			if (chunks[i].left > 0 && error == 0) {
+				queue_chunk(fd, buf, &chunks[i], i, offset);
+				++unsubmitted;
+			}
+			else {
+				free_chunks[num_free++] = i;
+				--in_flight;
+			}
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	if (error != 0) {
+		errno = error;
+		return false;
+	}
+	return true;
+}
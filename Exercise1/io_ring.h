@@ -0,0 +1,24 @@
+#ifndef _IO_RING_H_
+#define _IO_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Large file reads split into IO_RING_CHUNK sized reads, up to IO_RING_DEPTH
+ * of them queued on an io_uring at once so the device sees the whole request
+ * instead of one read at a time. Each thread sets up its own ring on first
+ * use. Without io_uring (old kernel, seccomp, MATLAB_IO_URING=0) the same
+ * calls fall back to a pread loop.
+ */
+
+#define IO_RING_DEPTH 8
+#define IO_RING_CHUNK (1u << 20)
+#define IO_RING_MAX_PREAD (1ul << 30) /* Linux reads at most about 2 GB per call */
+
+bool io_ring_read (int fd, void* buf, size_t len, uint64_t offset);
+bool io_ring_available (void);
+void io_ring_release (void);
+
+#endif
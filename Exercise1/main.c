@@ -5,300 +5,973 @@
 #include <math.h>
 #include <stdbool.h>
 #include <time.h>
+#include <errno.h>
 
 #include<readline/readline.h>
 
 #include "command.h"
 #include "matrix.h"
+#include "matrix_types.h"
+#include "matrix_kernels.h"
+#include "registry.h"
+#include "threadpool.h"
+#include "matrix_alloc.h"
+#include "prng.h"
+#include "batch.h"
+#include "stats.h"
+#include "expr.h"
+#include "workspace.h"
+#include "async_io.h"
+#include "server.h"
 
-void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats);
-unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, 
-			const char* target);
+void run_commands (Commands_t* cmd, Registry_t* mats);
+bool store_matrix (Registry_t* mats, Matrix_t* new_matrix);
+bool run_batch_command (Commands_t* cmd, void* mats);
+static void collect_io (Registry_t* mats);
+static void serve_command (Commands_t* cmd, FILE* out, void* mats);
+static bool serve_store (Matrix_t* m, void* mats);
+static Matrix_t* serve_find (const char* name, void* mats);
 
-// TODO complete the defintion of this function. 
-void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats);
+/* --quiet drops the per-command status lines, results are still printed */
+static bool quiet_mode = false;
+/* where commands print, stdout or the reply to a server request */
+static FILE* cmd_out;
+#define report(...) do { if (!quiet_mode) fprintf(cmd_out, __VA_ARGS__); } while (0)
+
+/* histogram bins of describe when none are given */
+#define DESCRIBE_BINS 10
 
 	//TODO FUNCTION COMMENT
 
 /*
- * PURPOSE: Main part of program, where program starts and calls other functions
+ * PURPOSE: Main part of program, where program starts and calls other functions.
+ *  Runs interactively, or with -f over a script file (- for stdin), or
+ *  serves the workspace on a socket with --serve, or is a client of such a
+ *  server with --connect.
  * INPUTS: Number of command line arguments, address to array of command line arguments
  * RETURN: Status code, 0 for success
  **/
 
 int main (int argc, char **argv) {
-    srand((int)time(NULL));
+    const char* script = NULL;
+    const char* stats_file = NULL;
+    const char* serve = NULL;
+    const char* server = NULL;
+    int status = 0;
+    cmd_out = stdout;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            script = argv[++i];
+        }
+        else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet_mode = true;
+        }
+        else if (strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc) {
+            stats_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve = argv[++i];
+        }
+        else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            server = argv[++i];
+        }
+        else {
+            fprintf(stderr, "usage: %s [-f script|-] [--quiet] [--stats-file file]"
+                " [--serve socket|--connect socket]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (server != NULL) {
+        /* the workspace lives in the server, nothing to set up here */
+        FILE* input = script == NULL || strcmp(script, "-") == 0 ? stdin : fopen(script, "r");
+        if (input == NULL) {
+            perror("Failed to open script");
+            return -1;
+        }
+        status = run_client(server, input) ? 0 : -1;
+        if (input != stdin) {
+            fclose(input);
+        }
+        return status;
+    }
+
+    seed_prng((uint64_t)time(NULL));
+    init_matrix_kernels();
+    const char* allocator = getenv("MATLAB_ALLOCATOR");
+    if (allocator != NULL && strcmp(allocator, system_matrix_allocator.name) == 0) {
+        set_matrix_allocator(&system_matrix_allocator);
+    }
+    if (!init_thread_pool(0)) {
+        perror("Failed to start worker threads, running serially");
+    }
+    /* a served read or write answers its own client, so it finishes before the reply */
+    const char* async_io = getenv("MATLAB_ASYNC_IO");
+    if (serve == NULL && (async_io == NULL || strcmp(async_io, "0") != 0) && !init_async_io()) {
+        perror("Failed to start the I/O thread, reading and writing synchronously");
+    }
     char *line = NULL;
-    Commands_t* cmd;
+    Commands_t cmd = {0};
 
-	Matrix_t *mats[10];
-	memset(&mats,0, sizeof(Matrix_t*) * 10); // IMPORTANT C FUNCTION TO LEARN
+	Registry_t *mats = NULL;
+	if (!create_registry(&mats, 0)) {
+		perror("PROGRAM FAILED TO INIT\n");
+		return -1;
+	}
     
 	Matrix_t *temp = NULL;
     
     if(create_matrix (&temp,"temp_mat", 5, 5) == false){ // TODO ERROR CHECK
         perror("Failed to create matrix");
+        destroy_registry(&mats);
         return -1;
     }
     
-    if(add_matrix_to_array(mats,temp, 10) > 10){ //TODO ERROR CHECK NEEDED
+    if(!store_matrix(mats,temp)){ //TODO ERROR CHECK NEEDED
         perror("Failed to add temp matrix");
+        destroy_registry(&mats);
         return -1;
     }
-    
-	int mat_idx = find_matrix_given_name(mats,10,"temp_mat");
-	if (mat_idx < 0) {
-		perror("PROGRAM FAILED TO INIT\n");
-		return -1;
-	}
 	
-    random_matrix(mats[mat_idx], 10, 15);
+    random_matrix(temp, 10, 15);
 	
-    if(write_matrix("temp_mat", mats[mat_idx]) == false){ // TODO ERROR CHECK
+    if(write_matrix("temp_mat", temp) == false){ // TODO ERROR CHECK
         perror("Failed to write temp matrix");
+        destroy_registry(&mats);
         return -1;
     }
 
-	line = readline("> ");
-	while (strncmp(line,"exit", strlen("exit")  + 1) != 0) {
+	if (serve != NULL) {
+		const Server_workspace_t ws = {serve_command, serve_store, serve_find, mats};
+		if (!run_server(serve, &ws)) {
+			status = -1;
+		}
+	}
+	else if (script != NULL) {
+		FILE* input = strcmp(script, "-") == 0 ? stdin : fopen(script, "r");
+		if (input == NULL) {
+			perror("Failed to open script");
+			status = -1;
+		}
+		else {
+			if (!run_batch(input, run_batch_command, mats)) {
+				perror("Failed to run script");
+				status = -1;
+			}
+			if (input != stdin) {
+				fclose(input);
+			}
+		}
+	}
+	else {
+		line = readline("> ");
+	}
+	while (line != NULL && strncmp(line,"exit", strlen("exit")  + 1) != 0) {
 		
 		if (!parse_user_input(line,&cmd)) {
-			printf("Failed at parsing command\n\n");
+			fprintf(cmd_out, "Failed at parsing command (%s)\n\n", strerror(errno));
 		}
 		
-		else if (cmd->num_cmds > 1) {
-			run_commands(cmd,mats,10);
+		else if (cmd.num_cmds > 0) {
+			run_commands(&cmd,mats);
 		}
 		if (line) {
 			free(line);
 		}
-		destroy_commands(&cmd);
 		line = readline("> ");
 	}
 	free(line);
-	destroy_remaining_heap_allocations(mats,10);
-    return 0;
+	shutdown_async_io();
+	collect_io(mats);
+	destroy_commands(&cmd);
+	destroy_registry(&mats);
+	release_matrix_allocator();
+	shutdown_thread_pool();
+	if (stats_file != NULL && !stats_dump(stats_file)) {
+		perror("Failed to write stats file");
+	}
+	stats_release();
+    return status;
 }
 
-	//TODO FUNCTION COMMENT
+/*
+ * Command handlers. Each runs one verb whose argument count has already
+ * been checked against the dispatch table below.
+ */
+
+static void cmd_display (Commands_t* cmd, Registry_t* mats) {
+	/*find the requested matrix*/
+	Matrix_t* m = registry_find(mats,cmd->cmds[1]);
+	if (m) {
+		display_matrix (m, cmd_out);
+	}
+	else {
+		fprintf(cmd_out, "Matrix (%s) doesn't exist\n", cmd->cmds[1]);
+	}
+}
+
+static void cmd_add (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* a = registry_find(mats,cmd->cmds[1]);
+	Matrix_t* b = registry_find(mats,cmd->cmds[2]);
+	if (!a || !b) {
+		fprintf(cmd_out, "Add Failed\n");
+		return;
+	}
+	Matrix_t* c = NULL;
+	if( !create_matrix_typed (&c,cmd->cmds[3], a->rows, a->cols, a->type, false)) {
+		fprintf(cmd_out, "Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
+		return;
+	}
+
+	/* add before storing, the result may replace one of the operands */
+	if (! add_matrices(a, b,c) ) {
+		fprintf(cmd_out, "Failure to add %s with %s into %s\n", a->name, b->name,c->name);
+		destroy_matrix(&c);
+		return;
+	}
+	store_matrix(mats,c);
+}
+
+static void cmd_mul (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* a = registry_find(mats,cmd->cmds[1]);
+	Matrix_t* b = registry_find(mats,cmd->cmds[2]);
+	if (!a || !b) {
+		fprintf(cmd_out, "Multiply Failed\n");
+		return;
+	}
+	Matrix_t* c = NULL;
+	if( !create_matrix_uninit (&c,cmd->cmds[3], a->rows, b->cols)) {
+		fprintf(cmd_out, "Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
+		return;
+	}
+
+	if (! multiply_matrices(a, b, c) ) {
+		fprintf(cmd_out, "Failure to multiply %s with %s into %s\n", a->name, b->name, c->name);
+		destroy_matrix(&c);
+		return;
+	}
+	store_matrix(mats,c);
+}
+
+static void cmd_duplicate (Commands_t* cmd, Registry_t* mats) {
+	if (cmd->lens[2] + 1 > MATRIX_NAME_LEN) {
+		fprintf(cmd_out, "Not a command in this application\n");
+		return;
+	}
+	Matrix_t* src = registry_find(mats,cmd->cmds[1]);
+	if (!src) {
+		fprintf(cmd_out, "Duplication Failed\n");
+		return;
+	}
+	/* shares src's data until one of them is written */
+	Matrix_t* dup_mat = NULL;
+	if(create_matrix_copy (&dup_mat, cmd->cmds[2], src) == false){
+		matrix_perror("Duplication of matrices failed");
+		return;
+	}
+
+	report("Duplication of %s into %s finished\n", src->name, cmd->cmds[2]);
+	store_matrix(mats,dup_mat);
+}
+
+static void cmd_transpose (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* a = registry_find(mats,cmd->cmds[1]);
+	if (!a) {
+		fprintf(cmd_out, "Transpose Failed\n");
+		return;
+	}
+	if (strcmp(a->name,cmd->cmds[2]) == 0) {
+		if (!transpose_matrix(a,a)) {
+			fprintf(cmd_out, "Failure to transpose %s\n", a->name);
+			return;
+		}
+		report("Matrix (%s) is transposed to (%u,%u)\n", a->name, a->rows, a->cols);
+		return;
+	}
+	Matrix_t* c = NULL;
+	if( !create_matrix_uninit (&c,cmd->cmds[2], a->cols, a->rows)) {
+		fprintf(cmd_out, "Failure to create the result Matrix (%s)\n", cmd->cmds[2]);
+		return;
+	}
+	if (!transpose_matrix(a,c)) {
+		fprintf(cmd_out, "Failure to transpose %s into %s\n", a->name, c->name);
+		destroy_matrix(&c);
+		return;
+	}
+	report("Matrix (%s) is transposed into (%s)\n", a->name, c->name);
+	store_matrix(mats,c);
+}
 
 /*
- * PURPOSE: Main logic of matlab, executes command on matrices
- * INPUTS: Address of commands, address of matrices, number of matrices
- * RETURN: Nothing
+ * PURPOSE: Parse the rows and cols arguments of a command
+ * INPUTS: rows and cols strings, addresses to store them in
+ * RETURN: True if both are whole numbers that fit in an unsigned int, else
+ *  false with a message printed
  **/
 
-void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats) {
-	//TODO ERROR CHECK INCOMING PARAMETERS
+static bool parse_dims (const char* rows_str, const char* cols_str, unsigned int* rows, unsigned int* cols) {
+	const char* strs[2] = {rows_str, cols_str};
+	unsigned int* dims[2] = {rows, cols};
+	for (int i = 0; i < 2; ++i) {
+		char* end = NULL;
+		errno = 0;
+		const unsigned long long value = strtoull(strs[i], &end, 10);
+		if (strs[i][0] == '-' || end == strs[i] || *end != '\0' || errno == ERANGE || value > UINT_MAX) {
+			fprintf(cmd_out, "Invalid dimension (%s)\n", strs[i]);
+			return false;
+		}
+		*dims[i] = (unsigned int)value;
+	}
+	return true;
+}
 
-    if(cmd == NULL || mats == NULL || *mats == NULL || num_mats == 0){
-        perror("Error running commands\n");
-        return;
-    }
+static void cmd_reshape (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* m = registry_find(mats,cmd->cmds[1]);
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	if (!m) {
+		fprintf(cmd_out, "Matrix (%s) doesn't exist\n", cmd->cmds[1]);
+		return;
+	}
+	if (!parse_dims(cmd->cmds[2], cmd->cmds[3], &rows, &cols)) {
+		return;
+	}
+	if (!reshape_matrix(m,rows,cols)) {
+		fprintf(cmd_out, "Can't reshape (%s,%u,%u) to (%u,%u)\n", m->name, m->rows, m->cols, rows, cols);
+		return;
+	}
+	report("Matrix (%s) is reshaped to (%u,%u)\n", m->name, m->rows, m->cols);
+}
 
-	/*Parsing and calling of commands*/
-	if (strncmp(cmd->cmds[0],"display",strlen("display") + 1) == 0
-		&& cmd->num_cmds == 2) {
-			/*find the requested matrix*/
-			int idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-			if (idx >= 0) {
-				display_matrix (mats[idx]);
-			}
-			else {
-				printf("Matrix (%s) doesn't exist\n", cmd->cmds[1]);
-				return;
-			}
+static void cmd_equal (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* a = registry_find(mats,cmd->cmds[1]);
+	Matrix_t* b = registry_find(mats,cmd->cmds[2]);
+	if (!a || !b) {
+		fprintf(cmd_out, "Equal Failed\n");
+		return;
 	}
-	else if (strncmp(cmd->cmds[0],"add",strlen("add") + 1) == 0
-		&& cmd->num_cmds == 4) {
-			int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-			int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[2]);
-			if (mat1_idx >= 0 && mat2_idx >= 0) {
-				Matrix_t* c = NULL;
-				if( !create_matrix (&c,cmd->cmds[3], mats[mat1_idx]->rows, 
-						mats[mat1_idx]->cols)) {
-					printf("Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
-					return;
-				}
-			
-                if(add_matrix_to_array(mats,c, num_mats) > num_mats){ //TODO ERROR CHECK NEEDED
-                    perror("Failed to add matrix to array\n");
-                    return;
-                }
-
-				if (! add_matrices(mats[mat1_idx], mats[mat2_idx],c) ) {
-					printf("Failure to add %s with %s into %s\n", mats[mat1_idx]->name, mats[mat2_idx]->name,c->name);
-					return;	
-				}
-			}
+	size_t first_diff = SIZE_MAX;
+	if ( equal_matrices_ex(a,b,&first_diff) ) {
+		fprintf(cmd_out, "SAME DATA IN BOTH\n");
+	}
+	else {
+		fprintf(cmd_out, "DIFFERENT DATA IN BOTH\n");
+		if (first_diff != SIZE_MAX) {
+			fprintf(cmd_out, "First difference at (%zu,%zu)\n", first_diff / a->cols, first_diff % a->cols);
+		}
+	}
+}
+
+static void cmd_shift (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* m = registry_find(mats,cmd->cmds[1]);
+	const int shift_value = atoi(cmd->cmds[3]);
+	if (!m) {
+		fprintf(cmd_out, "Matrix shift failed\n");
+		return;
 	}
-	else if (strncmp(cmd->cmds[0],"duplicate",strlen("duplicate") + 1) == 0
-		&& cmd->num_cmds == 3 && strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if (mat1_idx >= 0 ) {
-            Matrix_t* dup_mat = NULL;
-            if( !create_matrix (&dup_mat,cmd->cmds[2], mats[mat1_idx]->rows,
-                    mats[mat1_idx]->cols)) {
-                return;
-            }
-				
-            if(duplicate_matrix (mats[mat1_idx], dup_mat) == false){ //TODO ERROR CHECK NEEDED
-                perror("Duplication of matrices failed");
-                return;
-            }
-				
-            if(add_matrix_to_array(mats,dup_mat,num_mats) > num_mats){ //TODO ERROR CHECK NEEDED
-                perror("Failed to add matrix to array\n");
-                return;
-            }
-            
-            printf ("Duplication of %s into %s finished\n", mats[mat1_idx]->name, cmd->cmds[2]);
+	if(bitwise_shift_matrix(m,cmd->cmds[2][0], shift_value) == false){
+		matrix_perror("Failed to perform shift on matrix\n");
+		return;
+	}
+	report("Matrix (%s) has been shifted by %d\n", m->name, shift_value);
+}
+
+static void cmd_mmap (Commands_t* cmd, Registry_t* mats) {
+	const char* filename = cmd->cmds[cmd->num_cmds - 1];
+	async_io_wait(filename,false);
+	Matrix_t* new_matrix = NULL;
+	if(! read_matrix_mmap(filename,&new_matrix)) {
+		fprintf(cmd_out, "Map Failed\n");
+		return;
+	}
+
+	if(!store_matrix(mats,new_matrix)){
+		return;
+	}
+	report("Matrix (%s) is mapped from the filesystem\n", filename);
+}
+
+static void cmd_read (Commands_t* cmd, Registry_t* mats) {
+	if (cmd->num_cmds == 3) {
+		if (strcmp(cmd->cmds[1],"--map") == 0) {
+			cmd_mmap(cmd,mats);
 		}
 		else {
-			printf("Duplication Failed\n");
-			return;
+			fprintf(cmd_out, "Not a command in this application\n");
 		}
+		return;
 	}
-	else if (strncmp(cmd->cmds[0],"equal",strlen("equal") + 1) == 0
-		&& cmd->num_cmds == 2) {
-			int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-			int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[2]);
-			if (mat1_idx >= 0 && mat2_idx >= 0) {
-				if ( equal_matrices(mats[mat1_idx],mats[mat2_idx]) ) {
-					printf("SAME DATA IN BOTH\n");
-				}
-				else {
-					printf("DIFFERENT DATA IN BOTH\n");
-				}
-			}
-			else {
-				printf("Equal Failed\n");
-				return;
-			}
+	if (async_read_matrix(cmd->cmds[1])) {
+		report("Matrix (%s) is being read from the filesystem\n", cmd->cmds[1]);
+		return;
+	}
+	Matrix_t* new_matrix = NULL;
+	if(! read_matrix(cmd->cmds[1],&new_matrix)) {
+		fprintf(cmd_out, "Read Failed\n");
+		return;
+	}
+
+	if(!store_matrix(mats,new_matrix)){
+		return;
+	}
+	report("Matrix (%s) is read from the filesystem\n", cmd->cmds[1]);
+}
+
+static void cmd_write (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* m = registry_find(mats,cmd->cmds[1]);
+	if (!m) {
+		fprintf(cmd_out, "Matrix (%s) doesn't exist\n", cmd->cmds[1]);
+		return;
 	}
-	else if (strncmp(cmd->cmds[0],"shift",strlen("shift") + 1) == 0
-		&& cmd->num_cmds == 4) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		const int shift_value = atoi(cmd->cmds[3]);
-		if (mat1_idx >= 0 ) {
-            if(bitwise_shift_matrix(mats[mat1_idx],cmd->cmds[2][0], shift_value) == false){ //TODO ERROR CHECK NEEDED
-                perror("Failed to perform shift on matrix\n");
-                return;
-            }
-            printf("Matrix (%s) has been shifted by %d\n", mats[mat1_idx]->name, shift_value);
+	unsigned int flags = WRITE_MATRIX_DEFAULT;
+	for (unsigned int i = 2; i < cmd->num_cmds; ++i) {
+		if (strcmp(cmd->cmds[i],"sync") == 0) {
+			flags |= WRITE_MATRIX_FSYNC;
+		}
+		else if (strcmp(cmd->cmds[i],"direct") == 0) {
+			flags |= WRITE_MATRIX_DIRECT;
+		}
+		else if (strcmp(cmd->cmds[i],"compress") == 0) {
+			flags |= WRITE_MATRIX_COMPRESS;
 		}
 		else {
-			printf("Matrix shift failed\n");
+			fprintf(cmd_out, "Unknown write option (%s)\n", cmd->cmds[i]);
 			return;
 		}
+	}
+	if (async_write_matrix(m,flags)) {
+		report("Matrix (%s) is being written out to the filesystem\n", m->name);
+		return;
+	}
+	if(! write_matrix_ex(m->name,m,flags)) {
+		fprintf(cmd_out, "Write Failed\n");
+		return;
+	}
+	report("Matrix (%s) is wrote out to the filesystem\n", m->name);
+}
 
+static void cmd_save (Commands_t* cmd, Registry_t* mats) {
+	size_t saved = 0;
+	async_io_wait(cmd->cmds[1],false);
+	if (!save_workspace(cmd->cmds[1],mats,&saved)) {
+		fprintf(cmd_out, "Save Failed\n");
+		return;
 	}
-	else if (strncmp(cmd->cmds[0],"read",strlen("read") + 1) == 0
-		&& cmd->num_cmds == 2) {
-		Matrix_t* new_matrix = NULL;
-		if(! read_matrix(cmd->cmds[1],&new_matrix)) {
-			printf("Read Failed\n");
+	report("Saved %zu matrices to (%s)\n", saved, cmd->cmds[1]);
+}
+
+static void cmd_load (Commands_t* cmd, Registry_t* mats) {
+	unsigned int first = 1;
+	const bool verify = strcmp(cmd->cmds[1],"--verify") == 0;
+	if (verify) {
+		if (cmd->num_cmds < 3) {
+			fprintf(cmd_out, "Not a command in this application\n");
 			return;
-		}	
-		
-        if(add_matrix_to_array(mats,new_matrix, num_mats) > num_mats){ //TODO ERROR CHECK NEEDED
-            perror("Failed to add matrix to array\n");
-            return;
-        }
-        
-        printf("Matrix (%s) is read from the filesystem\n", cmd->cmds[1]);
-	}
-	else if (strncmp(cmd->cmds[0],"write",strlen("write") + 1) == 0
-		&& cmd->num_cmds == 2) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if(! write_matrix(mats[mat1_idx]->name,mats[mat1_idx])) {
-			printf("Write Failed\n");
+		}
+		++first;
+	}
+	size_t loaded = 0;
+	async_io_wait(cmd->cmds[first],false);
+	const bool ok = load_workspace(cmd->cmds[first],mats,cmd->cmds + first + 1,
+		cmd->num_cmds - first - 1,verify,&loaded);
+	if (!ok) {
+		fprintf(cmd_out, "Load Failed\n");
+	}
+	if (loaded || ok) {
+		report("Loaded %zu matrices from (%s)\n", loaded, cmd->cmds[first]);
+	}
+}
+
+static void cmd_sync (Commands_t* cmd, Registry_t* mats) {
+	async_io_wait(NULL,false);
+	collect_io(mats);
+	report("Background reads and writes are done\n");
+}
+
+static void cmd_iostat (Commands_t* cmd, Registry_t* mats) {
+	if (strcmp(cmd->cmds[1],"write") != 0) {
+		fprintf(cmd_out, "Not a command in this application\n");
+		return;
+	}
+	async_io_wait(NULL,false);
+	Matrix_io_stats_t stats;
+	get_matrix_write_stats(&stats);
+	fprintf(cmd_out, "Wrote %llu bytes in %llu files at %.1f MB/s\n",
+		(unsigned long long)stats.bytes, (unsigned long long)stats.files,
+		matrix_write_bytes_per_sec() / 1e6);
+}
+
+static void cmd_create (Commands_t* cmd, Registry_t* mats) {
+	if (cmd->lens[1] + 1 > MATRIX_NAME_LEN) {
+		fprintf(cmd_out, "Not a command in this application\n");
+		return;
+	}
+	Matrix_t* new_mat = NULL;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	if (!parse_dims(cmd->cmds[2], cmd->cmds[3], &rows, &cols)) {
+		return;
+	}
+	Matrix_type_t type = MATRIX_U32;
+	if (cmd->num_cmds == 5 && !parse_matrix_type(cmd->cmds[4], &type)) {
+		fprintf(cmd_out, "Unknown element type (%s), use u8, u16, u32, u64, f32 or f64\n", cmd->cmds[4]);
+		return;
+	}
+
+	if(create_matrix_typed(&new_mat,cmd->cmds[1],rows, cols, type, true) == false){
+		matrix_perror("Error creating matrix\n");
+		return;
+	}
+
+	report("Created Matrix (%s,%u,%u)\n", new_mat->name, new_mat->rows, new_mat->cols);
+	store_matrix(mats,new_mat);
+}
+
+static void cmd_delete (Commands_t* cmd, Registry_t* mats) {
+	if (!registry_remove(mats,cmd->cmds[1])) {
+		fprintf(cmd_out, "Matrix (%s) doesn't exist\n", cmd->cmds[1]);
+		return;
+	}
+	report("Matrix (%s) has been deleted\n", cmd->cmds[1]);
+}
+
+static void cmd_random (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* m = registry_find(mats,cmd->cmds[1]);
+	const unsigned int start_range = atoi(cmd->cmds[2]);
+	const unsigned int end_range = atoi(cmd->cmds[3]);
+	if (!m) {
+		fprintf(cmd_out, "Matrix (%s) doesn't exist\n", cmd->cmds[1]);
+		return;
+	}
+
+	if(random_matrix(m,start_range, end_range) == false){
+		matrix_perror("Failed to randomize matrix\n");
+		return;
+	}
+	report("Matrix (%s) is randomized between %u %u\n", m->name, start_range, end_range);
+}
+
+static void cmd_memstat (Commands_t* cmd, Registry_t* mats) {
+	if (strcmp(cmd->cmds[1],"alloc") != 0) {
+		fprintf(cmd_out, "Not a command in this application\n");
+		return;
+	}
+	Matrix_alloc_stats_t stats;
+	get_matrix_alloc_stats(&stats);
+	fprintf(cmd_out, "Allocator (%s)\n", get_matrix_allocator()->name);
+	fprintf(cmd_out, "headers: %llu allocs %llu frees\n",
+		(unsigned long long)stats.header_allocs, (unsigned long long)stats.header_frees);
+	fprintf(cmd_out, "data: %llu allocs (%llu reused) %llu frees\n",
+		(unsigned long long)stats.data_allocs, (unsigned long long)stats.data_reuses,
+		(unsigned long long)stats.data_frees);
+	fprintf(cmd_out, "bytes: %llu in use %llu cached\n",
+		(unsigned long long)stats.bytes_in_use, (unsigned long long)stats.bytes_cached);
+}
+
+static void cmd_seed (Commands_t* cmd, Registry_t* mats) {
+	seed_prng(strtoull(cmd->cmds[1], NULL, 0));
+	report("Random seed set to %llu\n", (unsigned long long)prng_seed());
+}
+
+static void cmd_stats (Commands_t* cmd, Registry_t* mats) {
+	if (cmd->num_cmds == 1) {
+		stats_print(cmd_out);
+	}
+	else if (strcmp(cmd->cmds[1], "reset") == 0) {
+		stats_reset();
+		report("Stats have been reset\n");
+	}
+	else {
+		fprintf(cmd_out, "Not a command in this application\n");
+	}
+}
+
+static void cmd_eval (Commands_t* cmd, Registry_t* mats) {
+	if (strcmp(cmd->cmds[2], "=") != 0 || cmd->lens[1] + 1 > MATRIX_NAME_LEN) {
+		fprintf(cmd_out, "Not a command in this application\n");
+		return;
+	}
+	Expr_t expr;
+	if (!parse_expression(&expr, cmd->cmds + 3, cmd->num_cmds - 3, mats)) {
+		fprintf(cmd_out, "Eval Failed\n");
+		return;
+	}
+	/* a fresh result, the destination may also be an operand */
+	Matrix_t* dest = NULL;
+	if (!create_matrix_uninit(&dest, cmd->cmds[1], expr.rows, expr.cols)) {
+		fprintf(cmd_out, "Failure to create the result Matrix (%s)\n", cmd->cmds[1]);
+		return;
+	}
+	if (!eval_expression(&expr, dest)) {
+		fprintf(cmd_out, "Eval Failed\n");
+		destroy_matrix(&dest);
+		return;
+	}
+	if (!store_matrix(mats,dest)) {
+		return;
+	}
+	report("Matrix (%s) has been evaluated\n", cmd->cmds[1]);
+}
+
+/*
+ * PURPOSE: Format an unsigned 128-bit integer in decimal
+ * INPUTS: Value, buffer of at least 40 bytes
+ * RETURN: Address of the first digit inside buf
+ **/
+
+static const char* format_u128 (unsigned __int128 value, char* buf) {
+	char* p = buf + 39;
+	*p = '\0';
+	do {
+		*--p = '0' + (int)(value % 10);
+		value /= 10;
+	} while (value != 0);
+	return p;
+}
+
+static void cmd_sum (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* m = registry_find(mats,cmd->cmds[1]);
+	if (!m) {
+		fprintf(cmd_out, "Matrix (%s) doesn't exist\n", cmd->cmds[1]);
+		return;
+	}
+	if (cmd->num_cmds == 2 && matrix_types[m->type].is_float) {
+		double sum = 0.0;
+		if (!sum_matrix_real(m, &sum)) {
+			fprintf(cmd_out, "Sum Failed\n");
 			return;
 		}
-		else {
-			printf("Matrix (%s) is wrote out to the filesystem\n", mats[mat1_idx]->name);
+		fprintf(cmd_out, "Sum of Matrix (%s) is %.17g\n", m->name, sum);
+		return;
+	}
+	if (cmd->num_cmds == 2) {
+		unsigned __int128 sum = 0;
+		char buf[40];
+		if (!sum_matrix(m, &sum)) {
+			fprintf(cmd_out, "Sum Failed\n");
+			return;
 		}
+		fprintf(cmd_out, "Sum of Matrix (%s) is %s\n", m->name, format_u128(sum, buf));
+		return;
 	}
-	else if (strncmp(cmd->cmds[0], "create", strlen("create") + 1) == 0
-		&& strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN && cmd->num_cmds == 4) {
-		Matrix_t* new_mat = NULL;
-		const unsigned int rows = atoi(cmd->cmds[2]);
-		const unsigned int cols = atoi(cmd->cmds[3]);
 
-        if(create_matrix(&new_mat,cmd->cmds[1],rows, cols) == false){ //TODO ERROR CHECK NEEDED
-            perror("Error creating matrix\n");
-            return;
-        }
-        
-        if(add_matrix_to_array(mats,new_mat,num_mats) > num_mats){ // TODO ERROR CHECK NEEDED
-            perror("Failed to add matrix to array\n");
-            return;
-        }
-            
-        printf("Created Matrix (%s,%u,%u)\n", new_mat->name, new_mat->rows, new_mat->cols);
-	}
-	else if (strncmp(cmd->cmds[0], "random", strlen("random") + 1) == 0
-		&& cmd->num_cmds == 4) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		const unsigned int start_range = atoi(cmd->cmds[2]);
-		const unsigned int end_range = atoi(cmd->cmds[3]);
-		
-        if(random_matrix(mats[mat1_idx],start_range, end_range) == false){ //TODO ERROR CHECK NEEDED
-            perror("Failed to randomize matrix\n");
-            return;
-        }
+	const bool rows = strcmp(cmd->cmds[2], "rows") == 0;
+	if (!rows && strcmp(cmd->cmds[2], "cols") != 0) {
+		fprintf(cmd_out, "Not a command in this application\n");
+		return;
+	}
+	if (m->type != MATRIX_U32) {
+		fprintf(cmd_out, "Row and column sums take u32 matrices, (%s) is %s\n", m->name, matrix_types[m->type].name);
+		return;
+	}
+	const size_t count = rows ? m->rows : m->cols;
+	uint64_t* sums = malloc(count * sizeof(uint64_t));
+	if (!sums || !(rows ? sum_matrix_rows(m, sums) : sum_matrix_cols(m, sums))) {
+		fprintf(cmd_out, "Sum Failed\n");
+		free(sums);
+		return;
+	}
+	fprintf(cmd_out, "%s sums of Matrix (%s):\n", rows ? "Row" : "Column", m->name);
+	for (size_t i = 0; i < count; ++i) {
+		fprintf(cmd_out, "%llu ", (unsigned long long)sums[i]);
+	}
+	fprintf(cmd_out, "\n");
+	free(sums);
+}
+
+/*
+ * PURPOSE: Format a statistic of a matrix like its elements, integers whole
+ * INPUTS: Value, whether the matrix is floating point, buffer of at least 32 bytes
+ * RETURN: buf
+ **/
+
+static const char* format_stat (double value, bool real, char* buf) {
+	snprintf(buf, 32, real ? "%g" : "%.0f", value);
+	return buf;
+}
+
+static void cmd_describe (Commands_t* cmd, Registry_t* mats) {
+	Matrix_t* m = registry_find(mats,cmd->cmds[1]);
+	if (!m) {
+		fprintf(cmd_out, "Matrix (%s) doesn't exist\n", cmd->cmds[1]);
+		return;
+	}
+	const bool real = matrix_types[m->type].is_float;
+	char lo[32];
+	char hi[32];
+
+	if (cmd->num_cmds == 3 && (strcmp(cmd->cmds[2], "rows") == 0 || strcmp(cmd->cmds[2], "cols") == 0)) {
+		const bool rows = cmd->cmds[2][0] == 'r';
+		const size_t count = rows ? m->rows : m->cols;
+		Matrix_stats_t* stats = malloc(count * sizeof(Matrix_stats_t));
+		if (!stats || !(rows ? stats_matrix_rows(m, stats) : stats_matrix_cols(m, stats))) {
+			fprintf(cmd_out, "Describe Failed\n");
+			free(stats);
+			return;
+		}
+		fprintf(cmd_out, "%s statistics of Matrix (%s):\n", rows ? "Row" : "Column", m->name);
+		for (size_t i = 0; i < count; ++i) {
+			fprintf(cmd_out, "%zu: min %s max %s mean %g variance %g nonzero %llu\n", i,
+				format_stat(stats[i].min, real, lo), format_stat(stats[i].max, real, hi),
+				stats[i].mean, stats[i].variance, (unsigned long long)stats[i].nonzero);
+		}
+		free(stats);
+		return;
+	}
 
-		printf("Matrix (%s) is randomized between %u %u\n", mats[mat1_idx]->name, start_range, end_range);
+	unsigned int bins = DESCRIBE_BINS;
+	if (cmd->num_cmds == 3) {
+		char* end = NULL;
+		const long n = strtol(cmd->cmds[2], &end, 10);
+		if (*end != '\0' || n < 0 || n > MATRIX_STATS_MAX_BINS) {
+			fprintf(cmd_out, "Bins must be a number from 0 to %d, or rows or cols\n", MATRIX_STATS_MAX_BINS);
+			return;
+		}
+		bins = (unsigned int)n;
+	}
+	uint64_t histogram[MATRIX_STATS_MAX_BINS];
+	Matrix_stats_t st;
+	if (!stats_matrix(m, bins, histogram, &st)) {
+		fprintf(cmd_out, "Describe Failed\n");
+		return;
+	}
+	char buf[40];
+	fprintf(cmd_out, "Matrix (%s) is %ux%u %s\n", m->name, m->rows, m->cols, matrix_types[m->type].name);
+	fprintf(cmd_out, "count %llu nonzero %llu\n", (unsigned long long)st.count, (unsigned long long)st.nonzero);
+	fprintf(cmd_out, "min %s max %s\n", format_stat(st.min, real, lo), format_stat(st.max, real, hi));
+	if (real) {
+		fprintf(cmd_out, "sum %.17g mean %.17g variance %.17g\n", st.mean * st.count, st.mean, st.variance);
 	}
 	else {
-		printf("Not a command in this application\n");
+		fprintf(cmd_out, "sum %s mean %.17g variance %.17g\n", format_u128(st.sum, buf), st.mean, st.variance);
 	}
+	/* every element is in the first bin when they are all equal */
+	const unsigned int shown = st.max > st.min ? bins : (bins ? 1 : 0);
+	const double width = (st.max - st.min) / (bins ? bins : 1);
+	for (unsigned int b = 0; b < shown; ++b) {
+		/* the last bin also holds max */
+		fprintf(cmd_out, "[%g, %g%c %llu\n", st.min + b * width, b + 1 == shown ? st.max : st.min + (b + 1) * width,
+			b + 1 == shown ? ']' : ')', (unsigned long long)histogram[b]);
+	}
+}
 
+static void cmd_threads (Commands_t* cmd, Registry_t* mats) {
+	const int threads = atoi(cmd->cmds[1]);
+	/* the I/O thread may be inside a parallel_for of the old pool */
+	async_io_wait(NULL,false);
+	if (threads <= 0 || !init_thread_pool(threads)) {
+		fprintf(cmd_out, "Failed to resize the thread pool to %s\n", cmd->cmds[1]);
+		return;
+	}
+	report("Using %u threads\n", thread_pool_size());
 }
 
-	//TODO FUNCTION COMMENT
+typedef void (*command_handler_t) (Commands_t* cmd, Registry_t* mats);
+
+typedef struct {
+	const char* verb;
+	size_t len;
+	unsigned int min_args; /* token counts, including the verb */
+	unsigned int max_args;
+	Stat_id_t stat;
+	command_handler_t handler;
+}Command_entry_t;
+
+/* the table is ordered by verb length, find_command relies on it */
+enum {
+	VERB_ADD, VERB_MUL, VERB_SUM,
+	VERB_READ, VERB_MMAP, VERB_SEED, VERB_EVAL, VERB_SAVE, VERB_LOAD, VERB_SYNC,
+	VERB_EQUAL, VERB_SHIFT, VERB_WRITE, VERB_STATS,
+	VERB_IOSTAT, VERB_CREATE, VERB_DELETE, VERB_RANDOM,
+	VERB_DISPLAY, VERB_MEMSTAT, VERB_THREADS, VERB_RESHAPE,
+	VERB_DESCRIBE,
+	VERB_DUPLICATE, VERB_TRANSPOSE,
+	VERB_COUNT
+};
+
+#define VERB(name) #name, sizeof(#name) - 1
+
+static const Command_entry_t commands[VERB_COUNT] = {
+	[VERB_ADD] = {VERB(add), 4, 4, STAT_CMD_ADD, cmd_add},
+	[VERB_MUL] = {VERB(mul), 4, 4, STAT_CMD_MUL, cmd_mul},
+	[VERB_SUM] = {VERB(sum), 2, 3, STAT_CMD_SUM, cmd_sum},
+	[VERB_READ] = {VERB(read), 2, 3, STAT_CMD_READ, cmd_read},
+	[VERB_MMAP] = {VERB(mmap), 2, 2, STAT_CMD_MMAP, cmd_mmap},
+	[VERB_SEED] = {VERB(seed), 2, 2, STAT_CMD_OTHER, cmd_seed},
+	[VERB_EVAL] = {VERB(eval), 4, MAX_CMD_COUNT, STAT_CMD_EVAL, cmd_eval},
+	[VERB_SAVE] = {VERB(save), 2, 2, STAT_CMD_SAVE, cmd_save},
+	[VERB_LOAD] = {VERB(load), 2, MAX_CMD_COUNT, STAT_CMD_LOAD, cmd_load},
+	[VERB_SYNC] = {VERB(sync), 1, 1, STAT_CMD_OTHER, cmd_sync},
+	[VERB_EQUAL] = {VERB(equal), 3, 3, STAT_CMD_EQUAL, cmd_equal},
+	[VERB_SHIFT] = {VERB(shift), 4, 4, STAT_CMD_SHIFT, cmd_shift},
+	[VERB_WRITE] = {VERB(write), 2, 5, STAT_CMD_WRITE, cmd_write},
+	[VERB_STATS] = {VERB(stats), 1, 2, STAT_CMD_OTHER, cmd_stats},
+	[VERB_IOSTAT] = {VERB(iostat), 2, 2, STAT_CMD_OTHER, cmd_iostat},
+	[VERB_CREATE] = {VERB(create), 4, 5, STAT_CMD_CREATE, cmd_create},
+	[VERB_DELETE] = {VERB(delete), 2, 2, STAT_CMD_DELETE, cmd_delete},
+	[VERB_RANDOM] = {VERB(random), 4, 4, STAT_CMD_RANDOM, cmd_random},
+	[VERB_DISPLAY] = {VERB(display), 2, 2, STAT_CMD_DISPLAY, cmd_display},
+	[VERB_MEMSTAT] = {VERB(memstat), 2, 2, STAT_CMD_OTHER, cmd_memstat},
+	[VERB_THREADS] = {VERB(threads), 2, 2, STAT_CMD_OTHER, cmd_threads},
+	[VERB_RESHAPE] = {VERB(reshape), 4, 4, STAT_CMD_RESHAPE, cmd_reshape},
+	[VERB_DESCRIBE] = {VERB(describe), 2, 3, STAT_CMD_DESCRIBE, cmd_describe},
+	[VERB_DUPLICATE] = {VERB(duplicate), 3, 3, STAT_CMD_DUPLICATE, cmd_duplicate},
+	[VERB_TRANSPOSE] = {VERB(transpose), 3, 3, STAT_CMD_TRANSPOSE, cmd_transpose},
+};
+
+/*
+ * PURPOSE: Look up the table entry of a verb, switching on its length so at
+ *  most a handful of memcmp calls run per command
+ * INPUTS: The verb, its length
+ * RETURN: Address of the entry, NULL if no command has that verb
+ **/
+
+static const Command_entry_t* find_command (const char* verb, size_t len) {
+	unsigned int first = 0;
+	unsigned int end = 0;
+	switch (len) {
+		case 3: first = VERB_ADD; end = VERB_READ; break;
+		case 4: first = VERB_READ; end = VERB_EQUAL; break;
+		case 5: first = VERB_EQUAL; end = VERB_IOSTAT; break;
+		case 6: first = VERB_IOSTAT; end = VERB_DISPLAY; break;
+		case 7: first = VERB_DISPLAY; end = VERB_DESCRIBE; break;
+		case 8: first = VERB_DESCRIBE; end = VERB_DUPLICATE; break;
+		case 9: first = VERB_DUPLICATE; end = VERB_COUNT; break;
+		default: return NULL;
+	}
+	for (unsigned int i = first; i < end; ++i) {
+		if (memcmp(verb, commands[i].verb, len) == 0) {
+			return &commands[i];
+		}
+	}
+	return NULL;
+}
 
 /*
- * PURPOSE: Iterate over matrices and find index of matrix with given name
- * INPUTS: Address of the matrices, number of matrices, name of matrix to search for
- * RETURN: -1 if matrix not found, else the index of the matrix
+ * PURPOSE: Main logic of matlab, executes command on matrices
+ * INPUTS: Address of commands, address of the matrix registry
+ * RETURN: Nothing
  **/
 
-unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, const char* target) {
-	//TODO ERROR CHECK INCOMING PARAMETERS
-    if(num_mats == 0 || target == NULL || mats == NULL || *mats == NULL) return -1;
+void run_commands (Commands_t* cmd, Registry_t* mats) {
+    if(cmd == NULL || mats == NULL || cmd->num_cmds == 0){
+        matrix_perror("Error running commands\n");
+        return;
+    }
+
+	const Command_entry_t* entry = find_command(cmd->cmds[0], cmd->lens[0]);
+	STATS_SCOPE(scope, entry ? entry->stat : STAT_CMD_OTHER);
 
-	for (int i = 0; i < num_mats; ++i) {
-		if (strncmp(mats[i]->name,target,strlen(mats[i]->name)) == 0) {
-			return i;
+	if (entry == NULL || cmd->num_cmds < entry->min_args || cmd->num_cmds > entry->max_args) {
+		fprintf(cmd_out, "Not a command in this application\n");
+		return;
+	}
+	/*
+	 * A background read may be about to store a matrix this command uses:
+	 * wait for the reads that store a matrix named by an argument, or by a
+	 * word of one, since eval takes "(a+b)" as well as "( a + b )"
+	 */
+	collect_io(mats);
+	for (unsigned int i = 1; i < cmd->num_cmds; ++i) {
+		const char* arg = cmd->cmds[i];
+		async_io_wait_matrix(arg, cmd->lens[i]);
+		if (strpbrk(arg, EXPR_PUNCTUATION) == NULL) {
+			continue;
+		}
+		while (*arg) {
+			arg += strspn(arg, EXPR_PUNCTUATION);
+			const size_t len = strcspn(arg, EXPR_PUNCTUATION);
+			async_io_wait_matrix(arg, len);
+			arg += len;
 		}
 	}
-	return -1;
+	collect_io(mats);
+	entry->handler(cmd, mats);
 }
 
-	//TODO FUNCTION COMMENT
+/*
+ * PURPOSE: Store the matrices of finished background reads and report
+ *  background reads and writes that failed
+ * INPUTS: Address of the matrix registry
+ * RETURN: Nothing
+ **/
+
+static void collect_io (Registry_t* mats) {
+	Async_io_job_t* job = NULL;
+	while ((job = async_io_take_done()) != NULL) {
+		if (!job->ok) {
+			fprintf(cmd_out, "%s Failed (%s)\n", job->kind == ASYNC_IO_READ ? "Read" : "Write", job->filename);
+		}
+		else if (job->kind == ASYNC_IO_READ) {
+			/* the registry owns the matrix now, or store_matrix destroyed it */
+			store_matrix(mats,job->matrix);
+			job->matrix = NULL;
+		}
+		free_async_io_job(job);
+	}
+}
+
+/*
+ * PURPOSE: Batch handler, runs one scripted command
+ * INPUTS: Address of the command, address of the matrix registry
+ * RETURN: False once the script says exit, else true
+ **/
+
+bool run_batch_command (Commands_t* cmd, void* mats) {
+	if (strcmp(cmd->cmds[0],"exit") == 0) {
+		return false;
+	}
+	run_commands(cmd,mats);
+	return true;
+}
 
 /*
- * PURPOSE: Free all memory allocated to the matrices
- * INPUTS: Address of the matrices, number of matrices
+ * PURPOSE: Hand a matrix over to the registry, replacing any matrix of the same name
+ * INPUTS: Address of the matrix registry, address of the new matrix
+ * RETURN: True if stored, false if the registry couldn't grow (the matrix is destroyed)
+ **/
+
+bool store_matrix (Registry_t* mats, Matrix_t* new_matrix) {
+	if (mats == NULL || new_matrix == NULL) return false;
+
+	if (!registry_insert(mats,new_matrix)) {
+		matrix_perror("Failed to add matrix to registry\n");
+		destroy_matrix(&new_matrix);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Server callback, runs a client's command with everything it
+ *  prints going to the reply
+ * INPUTS: Address of the command, stream of the reply, address of the matrix registry
  * RETURN: Nothing
  **/
 
-void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats) {
-    
-	//TODO ERROR CHECK INCOMING PARAMETERS
-    if(num_mats == 0 || mats == NULL || *mats == NULL) return;
+static void serve_command (Commands_t* cmd, FILE* out, void* mats) {
+	cmd_out = out;
+	set_matrix_messages(out);
+	run_commands(cmd, mats);
+	set_matrix_messages(NULL);
+	cmd_out = stdout;
+}
 
-	// COMPLETE MISSING MEMORY CLEARING HERE
-    
-    //clear all data from mats
-    Matrix_t **temp = mats;
-    for(int i = 0; i < num_mats && temp[i] != NULL; i++){
-        free(temp[i]->data);
-    }
-    
-    //clear all mats
-    for(int i = 0; i < num_mats; i++){
-        free(mats[i]);
-    }
+/*
+ * PURPOSE: Server callback, stores an uploaded matrix
+ * INPUTS: Address of the matrix, address of the matrix registry
+ * RETURN: True if stored, false if it was destroyed instead
+ **/
+
+static bool serve_store (Matrix_t* m, void* mats) {
+	return store_matrix(mats, m);
+}
+
+/*
+ * PURPOSE: Server callback, looks up a matrix to download
+ * INPUTS: Matrix name, address of the matrix registry
+ * RETURN: Address of the matrix, NULL if there is none of that name
+ **/
+
+static Matrix_t* serve_find (const char* name, void* mats) {
+	return registry_find(mats, name);
 }
@@ -1,25 +1,165 @@
+#define _GNU_SOURCE /* O_DIRECT */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
 
 #include "matrix.h"
+#include "matrix_kernels.h"
+#include "matrix_codec.h"
+#include "matrix_sparse.h"
+#include "matrix_types.h"
+#include "threadpool.h"
+#include "io_ring.h"
+#include "matrix_alloc.h"
+#include "prng.h"
+#include "stats.h"
 
 
 #define MAX_CMD_COUNT 50
 
 /*protected functions*/
 void load_matrix (Matrix_t* m, unsigned int* data);
+static bool allocate_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+						const unsigned int cols, Matrix_type_t type, bool zero);
+static bool share_data (Matrix_t* m);
+static void release_data (Matrix_t* m);
+static bool make_sparse (Matrix_t* m);
+static bool make_dense (Matrix_t* m, bool keep_data);
+
+/* elements per sum kernel call, the kernel is exact below 2^32 */
+#define SUM_CHUNK (1u << 31)
+
+/* elements shifted and then counted at a time by bitwise_shift_matrix */
+#define SHIFT_CHUNK 4096
+
+/* bytes compared between checks of the early-out flag in equal_matrices */
+#define EQUAL_CHUNK_BYTES (64 * 1024)
+
+/* words per hash kernel call for rows of types other than u32 */
+#define HASH_ROW_WORDS 1024
+
+/*
+ * stats_matrix converts STATS_CHUNK elements at a time to doubles that stay
+ * in L1 while every statistic is taken from them, so the matrix is streamed
+ * from memory once. Whole matrix results are merged from units of about
+ * STATS_UNIT elements in a fixed order, so they don't depend on the thread
+ * count. stats_matrix_cols hands out STATS_COL_STRIPE columns per task.
+ */
+#define STATS_CHUNK 1024
+#define STATS_UNIT (1u << 16)
+#define STATS_COL_STRIPE 256
+
+/*
+ * Elements per side of the blocks transpose_matrix moves at a time. A block
+ * of the source and one of the destination fit L1 together and span few
+ * enough pages for the TLB; inside a block the kernel moves
+ * TRANSPOSE_TILE x TRANSPOSE_TILE tiles through registers.
+ */
+#define TRANSPOSE_BLOCK 64
+
+/* arguments shared by the row block tasks handed to parallel_for */
+typedef struct {
+	Matrix_t* a;
+	Matrix_t* b;
+	Matrix_t* c;
+	char direction;
+	unsigned int shift;
+	unsigned int start_range;
+	unsigned int range;
+	uint64_t seed;
+	uint32_t stream;
+	size_t first_diff; /* element index, SIZE_MAX while no difference is known */
+	bool hash_rows;
+	uint64_t hash; /* sum of the row hashes */
+	uint64_t* sums; /* per row or per column results of the sum tasks */
+	double* real_sums; /* per row results of sum_matrix_real */
+	uint64_t sum_lo; /* 128-bit total of sum_matrix */
+	uint64_t sum_hi;
+	size_t nnz; /* non-zero elements left by bitwise_shift_matrix */
+}Row_task_t;
+
+/* two independent accumulators of two lanes, so the baseline SSE2 target keeps them in registers */
+typedef double Stats_vec_t __attribute__((vector_size(16)));
+typedef int64_t Stats_mask_t __attribute__((vector_size(16)));
+#define STATS_LANES (2 * sizeof(Stats_vec_t) / sizeof(double))
+
+/* running statistics of a run of elements, merged pairwise */
+typedef struct {
+	uint64_t count;
+	uint64_t nonzero;
+	double min;
+	double max;
+	double mean;
+	double m2; /* sum of squared differences from the mean */
+	unsigned __int128 sum; /* exact sum of integer elements */
+	bool exact; /* sum is exact, so merges take the means from it */
+}Moments_t;
+
+/* arguments of the stats_matrix tasks */
+typedef struct {
+	Matrix_t* m;
+	size_t unit_rows;
+	Moments_t* units; /* one per unit, or per column for stats_matrix_cols */
+	unsigned int bins;
+	double lo; /* histogram bin i starts at lo + i / scale */
+	double scale;
+	uint64_t* histogram;
+}Stats_task_t;
+
+/*
+ * Cache blocking for multiply_matrices: a GEMM_KC x GEMM_NC panel of b is
+ * packed once and shared by all threads (sized for L3), each thread packs a
+ * GEMM_MC x GEMM_KC block of a (sized for L2) and the micro-kernel streams a
+ * GEMM_KC x GEMM_NR sliver of b through L1.
+ */
+#define GEMM_KC 256
+#define GEMM_MC (GEMM_MR * 16)
+#define GEMM_NC 4096
+
+typedef struct {
+	Matrix_t* a;
+	Matrix_t* c;
+	const unsigned int* b_packed;
+	size_t pc;
+	size_t kc;
+	size_t jc;
+	size_t nc;
+	const unsigned int* a_data; /* a's elements, a temporary dense copy if a is sparse */
+}Gemm_task_t;
+
+static void gemm_row_blocks (void* ctx, size_t begin, size_t end);
+static void add_rows (void* ctx, size_t begin, size_t end);
+static void shift_rows (void* ctx, size_t begin, size_t end);
+static void copy_rows (void* ctx, size_t begin, size_t end);
+static void compare_rows (void* ctx, size_t begin, size_t end);
+static void random_rows (void* ctx, size_t begin, size_t end);
+static void sum_rows (void* ctx, size_t begin, size_t end);
+static void sum_cols (void* ctx, size_t begin, size_t end);
+static void hash_rows (void* ctx, size_t begin, size_t end);
+static void stats_units (void* ctx, size_t begin, size_t end);
+static void stats_histogram (void* ctx, size_t begin, size_t end);
+static void stats_col_stripes (void* ctx, size_t begin, size_t end);
+static void transpose_blocks (void* ctx, size_t begin, size_t end);
+static void transpose_square_blocks (void* ctx, size_t begin, size_t end);
+static uint64_t finish_matrix_hash (const Matrix_t* m, uint64_t row_sum);
 
 /* 
- * PURPOSE: instantiates a new matrix with the passed name, rows, cols 
+ * PURPOSE: instantiates a new matrix with the passed name, rows, cols. It is
+ *  all zeros, so it starts out sparse and costs memory per row only
  * INPUTS: 
  *	name the name of the matrix limited to 50 characters 
  *  rows the number of rows the matrix
@@ -31,25 +171,80 @@ void load_matrix (Matrix_t* m, unsigned int* data);
 
 bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows,
 						const unsigned int cols) {
+	return allocate_matrix(new_matrix, name, rows, cols, MATRIX_U32, true);
+}
+
+/* 
+ * PURPOSE: instantiates a new matrix whose data is left uninitialized, for
+ *  callers that overwrite every element (add, duplicate, read)
+ * INPUTS: same as create_matrix
+ * RETURN: same as create_matrix
+ **/
+
+bool create_matrix_uninit (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+						const unsigned int cols) {
+	return allocate_matrix(new_matrix, name, rows, cols, MATRIX_U32, false);
+}
+
+/* 
+ * PURPOSE: instantiates a new matrix of the given element type
+ * INPUTS: same as create_matrix, element type, true for all zeros (sparse
+ *  for u32, zeroed dense data for the other types), false for uninitialized data
+ * RETURN: same as create_matrix
+ **/
+
+bool create_matrix_typed (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+			const unsigned int cols, Matrix_type_t type, bool zero) {
+	return allocate_matrix(new_matrix, name, rows, cols, type, zero);
+}
+
+/* 
+ * PURPOSE: Shared body of create_matrix and create_matrix_uninit, takes the
+ *  header and the data buffer from the matrix allocator
+ * INPUTS: Address to address of matrix to populate, name, rows, cols,
+ *  element type, true for all zeros (an empty sparse matrix if u32), false
+ *  for uninitialized dense data
+ * RETURN: True if the matrix was created, else false with *new_matrix untouched
+ **/
+
+static bool allocate_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+						const unsigned int cols, Matrix_type_t type, bool zero) {
+	STATS_SCOPE(scope, STAT_CREATE_MATRIX);
 
 	//TODO ERROR CHECK INCOMING PARAMETERS
-    if(new_matrix == NULL || name == NULL || rows == 0 || cols == 0) return false;
+    if(new_matrix == NULL || name == NULL || rows == 0 || cols == 0
+		|| (unsigned int)type >= MATRIX_TYPE_COUNT) return false;
+	size_t bytes = 0;
+	if (!matrix_size_bytes(rows, cols, matrix_types[type].size, &bytes)) {
+		return false;
+	}
+	scope.bytes = bytes;
 
-	*new_matrix = calloc(1,sizeof(Matrix_t));
-	if (!(*new_matrix)) {
+	const size_t len = strlen(name) + 1;
+	if (len > MATRIX_NAME_LEN) {
 		return false;
 	}
-	(*new_matrix)->data = calloc(rows * cols,sizeof(unsigned int));
-	if (!(*new_matrix)->data) {
+
+	Matrix_t* m = matrix_alloc_header();
+	if (!m) {
 		return false;
 	}
-	(*new_matrix)->rows = rows;
-	(*new_matrix)->cols = cols;
-	unsigned int len = (int) strlen(name) + 1;
-	if (len > MATRIX_NAME_LEN) {
+	if (zero && type == MATRIX_U32) {
+		m->csr = create_csr(rows, 0);
+		scope.bytes = ((uint64_t)rows + 1) * sizeof(size_t);
+	}
+	else {
+		m->elems = matrix_alloc_data(bytes, zero);
+	}
+	if (!m->elems && !m->csr) {
+		matrix_free_header(m);
 		return false;
 	}
-	strncpy((*new_matrix)->name,name,len);
+	m->rows = rows;
+	m->cols = cols;
+	m->type = type;
+	memcpy(m->name,name,len);
+	*new_matrix = m;
 	return true;
 }
 
@@ -62,388 +257,2042 @@ bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int
  **/
 
 void destroy_matrix (Matrix_t** m) {
+	STATS_SCOPE(scope, STAT_DESTROY_MATRIX);
 
 	//TODO ERROR CHECK INCOMING PARAMETERS
     
     if(m == NULL || *m == NULL) return;
 	
-	free((*m)->data);
-	free(*m);
+	release_data(*m);
+	matrix_free_header(*m);
 	*m = NULL;
 }
 
+/* 
+ * PURPOSE: Size of the dense data of a matrix
+ * INPUTS: Address of the matrix
+ * RETURN: rows * cols * the size of its element type, in bytes
+ **/
 
-	
-	//TODO FUNCTION COMMENT
+size_t matrix_data_bytes (const Matrix_t* m) {
+	return (size_t)m->rows * m->cols * matrix_types[m->type].size;
+}
 
 /* 
- * PURPOSE: Compares bits of each matrix to see if they are equal
- * INPUTS: Address of matrix to compare, address of second matrix to compare
- * RETURN: True if they are equal, else false
+ * PURPOSE: Size of rows * cols elements, checked for overflow. Every matrix
+ *  is sized through here before its data exists, so matrix_data_bytes of a
+ *  created matrix can't wrap
+ * INPUTS: rows, cols, size of one element, address to store the size in bytes
+ * RETURN: True if the size fits in a size_t, else false with errno set to
+ *  EOVERFLOW and *bytes untouched
  **/
 
-bool equal_matrices (Matrix_t* a, Matrix_t* b) {
-
-	//TODO ERROR CHECK INCOMING PARAMETERS
-	if (!a || !b || !a->data || !b->data) {
-		return false;	
+bool matrix_size_bytes (unsigned int rows, unsigned int cols, size_t elem_size, size_t* bytes) {
+	size_t n = 0;
+	if (__builtin_mul_overflow((size_t)rows, (size_t)cols, &n)
+		|| __builtin_mul_overflow(n, elem_size, &n)) {
+		errno = EOVERFLOW;
+		return false;
 	}
+	*bytes = n;
+	return true;
+}
 
-	int result = memcmp(a->data,b->data, sizeof(unsigned int) * a->rows * a->cols);
-	if (result == 0) {
+/* 
+ * PURPOSE: Move the data of a matrix into a shared block, if it isn't already
+ * INPUTS: Address of the matrix
+ * RETURN: True if the data is now shared, false if the block couldn't be allocated
+ **/
+
+static bool share_data (Matrix_t* m) {
+	if (m->shared) {
 		return true;
 	}
-	return false;
+	_Static_assert(sizeof(Matrix_storage_t) <= sizeof(Matrix_t),
+		"storage blocks are carved from the header slabs");
+	Matrix_storage_t* s = matrix_alloc_header();
+	if (!s) {
+		return false;
+	}
+	s->refs = 1;
+	s->data = m->data;
+	s->bytes = matrix_data_bytes(m);
+	s->map_base = m->map_base;
+	s->map_len = m->map_len;
+	m->map_base = NULL;
+	m->map_len = 0;
+	m->shared = s;
+	return true;
 }
 
-	//TODO FUNCTION COMMENT
-
 /* 
- * PURPOSE: Copy matrix and compare to confirm they are the same
- * INPUTS: Address to source matrix, address to destination matrix
- * RETURN: True if matrices equal, else false
+ * PURPOSE: Drop a matrix's reference to its data, freeing the data once no
+ *  matrix uses it
+ * INPUTS: Address of the matrix
+ * RETURN: Nothing
  **/
 
-bool duplicate_matrix (Matrix_t* src, Matrix_t* dest) {
-
-
-	//TODO ERROR CHECK INCOMING PARAMETERS
+static void release_data (Matrix_t* m) {
+	void* map_base = m->map_base;
+	size_t map_len = m->map_len;
+	unsigned int* data = m->data;
+	size_t bytes = matrix_data_bytes(m);
+
+	Matrix_storage_t* s = m->shared;
+	m->data = NULL;
+	m->map_base = NULL;
+	m->map_len = 0;
+	m->shared = NULL;
+	if (m->csr) {
+		destroy_csr(m->csr, m->rows);
+		m->csr = NULL;
+	}
+	if (s) {
+		if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+			return;
+		}
+		map_base = s->map_base;
+		map_len = s->map_len;
+		data = s->data;
+		bytes = s->bytes;
+		matrix_free_header(s);
+	}
 
-    if (src == NULL || dest == NULL) return false;
-    
-	/*
-	 * copy over data
-	 */
-	unsigned int bytesToCopy = sizeof(unsigned int) * src->rows * src->cols;
-	memcpy(dest->data,src->data, bytesToCopy);	
-	return equal_matrices (src,dest);
+	if (map_base) {
+		munmap(map_base, map_len);
+	}
+	else if (data) {
+		matrix_free_data(data, bytes);
+	}
 }
 
-	//TODO FUNCTION COMMENT
-
 /* 
- * PURPOSE: Perform bit shift on matrix data
- * INPUTS: Address of matrix to shift, indicator for direction to shift, number of bits to shift
- * RETURN: True if shift successful, else false
+ * PURPOSE: instantiates a new matrix holding the elements of src. The two
+ *  share one data block until either is written, so this costs no copy
+ * INPUTS: Address to address of matrix to populate, name, address of the source matrix
+ * RETURN: True if the matrix was created, else false with *new_matrix untouched
  **/
 
-bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
-	
-	//TODO ERROR CHECK INCOMING PARAMETERS
-    if (!a || (strcmp(&direction, "l") == 0 || strcmp(&direction, "r") == 0) == false || shift == 0) return false;
-
-	if (direction == 'l') {
-		unsigned int i = 0;
-		for (; i < a->rows; ++i) {
-			unsigned int j = 0;
-			for (; j < a->cols; ++j) {
-				a->data[i * a->cols + j] = a->data[i * a->cols + j] << shift;
-			}
-		}
+bool create_matrix_copy (Matrix_t** new_matrix, const char* name, Matrix_t* src) {
+	STATS_SCOPE(scope, STAT_DUPLICATE_MATRIX);
+
+	if (new_matrix == NULL || name == NULL || src == NULL || (src->data == NULL && src->csr == NULL)) return false;
 
+	const size_t len = strlen(name) + 1;
+	if (len > MATRIX_NAME_LEN) {
+		return false;
 	}
-	else {
-		unsigned int i = 0;
-		for (; i < a->rows; ++i) {
-			unsigned int j = 0;
-			for (; j < a->cols; ++j) {
-				a->data[i * a->cols + j] = a->data[i * a->cols + j] >> shift;
-			}
+	Matrix_t* m = matrix_alloc_header();
+	if (!m) {
+		return false;
+	}
+	if (src->csr) {
+		/* sparse matrices are small, copy instead of sharing */
+		m->csr = copy_csr(src->csr, src->rows);
+		if (!m->csr) {
+			matrix_free_header(m);
+			return false;
 		}
 	}
-	
+	else if (!share_data(src)) {
+		matrix_free_header(m);
+		return false;
+	}
+	else {
+		__atomic_add_fetch(&src->shared->refs, 1, __ATOMIC_RELAXED);
+		m->data = src->data;
+		m->shared = src->shared;
+	}
+	m->rows = src->rows;
+	m->cols = src->cols;
+	m->type = src->type;
+	m->hash = src->hash;
+	m->hash_valid = src->hash_valid;
+	memcpy(m->name,name,len);
+	*new_matrix = m;
 	return true;
 }
 
-	//TODO FUNCTION COMMENT
-
 /* 
- * PURPOSE: Add given matrices and store results
- * INPUTS: Address of matrix a and b to add, address of matrix c to store results
- * RETURN: True if matrices were added, else false
+ * PURPOSE: Give a matrix its own dense data before it is written and drop
+ *  its cached hash. Every function that modifies a matrix's dense data in
+ *  place calls this first
+ * INPUTS: Address of the matrix, false if the caller overwrites every element
+ *  so the current contents needn't be copied
+ * RETURN: True if the matrix may be written, false if the copy couldn't be allocated
  **/
 
-bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+bool unshare_matrix (Matrix_t* m, bool keep_data) {
+	if (m == NULL) return false;
 
-	//TODO ERROR CHECK INCOMING PARAMETERS
-    if(a == NULL || b == NULL || c == NULL) return false;
+	m->hash_valid = false;
+	if (m->csr) {
+		return make_dense(m, keep_data);
+	}
+	Matrix_storage_t* s = m->shared;
+	if (s == NULL) {
+		return true;
+	}
+	if (__atomic_load_n(&s->refs, __ATOMIC_ACQUIRE) == 1) {
+		/* every duplicate is gone, take the block back */
+		m->map_base = s->map_base;
+		m->map_len = s->map_len;
+		m->shared = NULL;
+		matrix_free_header(s);
+		return true;
+	}
 
-	if (a->rows != b->rows && a->cols != b->cols) {
+	Matrix_t copy = *m;
+	copy.data = matrix_alloc_data(s->bytes, false);
+	if (!copy.data) {
 		return false;
 	}
-
-	for (int i = 0; i < a->rows; ++i) {
-		for (int j = 0; j < b->cols; ++j) {
-			c->data[i * a->cols +j] = a->data[i * a->cols + j] + b->data[i * a->cols + j];
-		}
+	if (keep_data) {
+		Row_task_t task = {.a = m, .c = &copy};
+		parallel_for(m->rows, parallel_grain_rows(m->cols), copy_rows, &task);
 	}
+	release_data(m);
+	m->data = copy.data;
 	return true;
 }
 
-	//TODO FUNCTION COMMENT
-
 /* 
- * PURPOSE: Prints out the contents of the given matrix
- * INPUTS: Address of matrix to print
- * RETURN: Nothing
+ * PURPOSE: Store a dense matrix sparse, dropping its reference to the dense data
+ * INPUTS: Address of the matrix
+ * RETURN: True if the matrix is now sparse, false (and still dense) if the
+ *  CSR arrays couldn't be allocated
  **/
 
-void display_matrix (Matrix_t* m) {
-	
-	//TODO ERROR CHECK INCOMING PARAMETERS
-    if(m == NULL){
-        perror("Matrix to display is NULL");
-        return;
-    }
+static bool make_sparse (Matrix_t* m) {
+	if (m->csr) {
+		return true;
+	}
+	Matrix_csr_t* csr = dense_to_csr(m->data, m->rows, m->cols);
+	if (!csr) {
+		return false;
+	}
+	release_data(m);
+	m->csr = csr;
+	return true;
+}
 
-	printf("\nMatrix Contents (%s):\n", m->name);
-	printf("DIM = (%u,%u)\n", m->rows, m->cols);
-	for (int i = 0; i < m->rows; ++i) {
-		for (int j = 0; j < m->cols; ++j) {
-			printf("%u ", m->data[i * m->cols + j]);
-		}
-		printf("\n");
+/* 
+ * PURPOSE: Store a sparse matrix dense
+ * INPUTS: Address of the matrix, false if the caller overwrites every element
+ *  so the zeros needn't be written
+ * RETURN: True if the matrix is now dense, false (and still sparse) if the
+ *  data couldn't be allocated
+ **/
+
+static bool make_dense (Matrix_t* m, bool keep_data) {
+	if (!m->csr) {
+		return true;
 	}
-	printf("\n");
+	unsigned int* data = matrix_alloc_data((size_t)m->rows * m->cols * sizeof(unsigned int), false);
+	if (!data) {
+		return false;
+	}
+	if (keep_data) {
+		csr_to_dense(m->csr, data, m->rows, m->cols);
+	}
+	destroy_csr(m->csr, m->rows);
+	m->csr = NULL;
+	m->data = data;
+	return true;
+}
+
+/* 
+ * PURPOSE: Dense elements of a u32 matrix for an operation that only reads
+ *  them. A sparse matrix is expanded into a temporary buffer and keeps its
+ *  own form
+ * INPUTS: Address of the matrix, address to store the temporary buffer (NULL
+ *  for a dense matrix) to give to matrix_free_data when done
+ * RETURN: Address of the elements, NULL if the buffer couldn't be allocated
+ **/
 
+static const unsigned int* read_dense (const Matrix_t* m, unsigned int** temp) {
+	*temp = NULL;
+	if (!m->csr) {
+		return m->data;
+	}
+	*temp = matrix_alloc_data(matrix_data_bytes(m), false);
+	if (*temp) {
+		csr_to_dense(m->csr, *temp, m->rows, m->cols);
+	}
+	return *temp;
 }
 
+
+	
 	//TODO FUNCTION COMMENT
 
 /* 
- * PURPOSE: Read matrix from a file
- * INPUTS: Address of input filename, address of matrices
- * RETURN: True of read was successful, else false
+ * PURPOSE: Compares bits of each matrix to see if they are equal
+ * INPUTS: Address of matrix to compare, address of second matrix to compare
+ * RETURN: True if they are equal, else false
  **/
 
-bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
-	
-	//TODO ERROR CHECK INCOMING PARAMETERS
+bool equal_matrices (Matrix_t* a, Matrix_t* b) {
+	return equal_matrices_ex(a, b, NULL);
+}
 
-    if(matrix_input_filename == NULL || m == NULL || *m == NULL) return false;
+/* 
+ * PURPOSE: Compare two matrices, answering from their shapes, shared data or
+ *  cached hashes when possible and otherwise comparing every element (and
+ *  caching the hash of matrices found equal)
+ * INPUTS: Address of matrix to compare, address of second matrix to compare,
+ *  address to store the index of the first differing element (may be NULL),
+ *  SIZE_MAX when the matrices were told apart without comparing elements
+ * RETURN: True if they have the same shape and elements, else false
+ **/
 
-	int fd = open(matrix_input_filename,O_RDONLY);
-	if (fd < 0) {
-		printf("FAILED TO OPEN FOR READING\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+bool equal_matrices_ex (Matrix_t* a, Matrix_t* b, size_t* first_diff) {
+	STATS_SCOPE(scope, STAT_EQUAL_MATRICES);
+
+	if (first_diff) {
+		*first_diff = SIZE_MAX;
+	}
+	if (!a || !b || (!a->data && !a->csr) || (!b->data && !b->csr)) {
+		return false;	
+	}
+	if (a->rows != b->rows || a->cols != b->cols || a->type != b->type) {
 		return false;
 	}
-
-	/*read the wrote dimensions and name length*/
-	unsigned int name_len = 0;
-	unsigned int rows = 0;
-	unsigned int cols = 0;
-	
-	if (read(fd,&name_len,sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READING FILE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+	if (a == b || (a->data && a->data == b->data)) {
+		return true;
+	}
+	if (a->hash_valid && b->hash_valid && a->hash != b->hash) {
 		return false;
 	}
-	char name_buffer[50];
-	if (read (fd,name_buffer,sizeof(char) * name_len) != sizeof(char) * name_len) {
-		printf("FAILED TO READ MATRIX NAME\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
+
+	if (a->csr || b->csr) {
+		/* walk the stored elements, no hash is built for sparse matrices */
+		size_t diff = SIZE_MAX;
+		if (a->csr && b->csr) {
+			diff = compare_csr(a->csr, b->csr, a->rows, a->cols);
+			scope.bytes = (a->csr->nnz + b->csr->nnz) * 2 * sizeof(unsigned int);
 		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
+		else {
+			diff = a->csr ? compare_csr_dense(a->csr, b->data, a->rows, a->cols)
+				: compare_csr_dense(b->csr, a->data, a->rows, a->cols);
+			scope.bytes = (uint64_t)a->rows * a->cols * sizeof(unsigned int);
 		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
+		if (first_diff) {
+			*first_diff = diff;
 		}
-
-		return false;	
+		return diff == SIZE_MAX;
 	}
 
-	if (read (fd,&rows, sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READ MATRIX ROW SIZE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
+	/* only hash while comparing if neither side's hash is known yet */
+	Row_task_t task = {.a = a, .b = b, .first_diff = SIZE_MAX,
+		.hash_rows = !a->hash_valid && !b->hash_valid};
+	scope.bytes = 2ull * matrix_data_bytes(a);
+	parallel_for(a->rows, parallel_grain_rows(a->cols), compare_rows, &task);
+	if (task.first_diff != SIZE_MAX) {
+		if (first_diff) {
+			*first_diff = task.first_diff;
 		}
-
 		return false;
 	}
 
-	if (read(fd,&cols,sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READ MATRIX COLUMN SIZE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
-
-		return false;
+	if (task.hash_rows) {
+		a->hash = finish_matrix_hash(a, task.hash);
+		a->hash_valid = true;
+	}
+	if (!a->hash_valid) {
+		a->hash = b->hash;
+		a->hash_valid = true;
 	}
+	b->hash = a->hash;
+	b->hash_valid = true;
+	return true;
+}
 
-	unsigned int numberOfDataBytes = rows * cols * sizeof(unsigned int);
-	unsigned int *data = calloc(rows * cols, sizeof(unsigned int));
-	if (read(fd,data,numberOfDataBytes) != numberOfDataBytes) {
-		printf("FAILED TO READ MATRIX DATA\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+/* 
+ * PURPOSE: Combine the row hashes of a matrix with its shape
+ * INPUTS: Address of the matrix, sum of its row hashes
+ * RETURN: The matrix hash
+ **/
 
-		return false;	
-	}
+static uint64_t finish_matrix_hash (const Matrix_t* m, uint64_t row_sum) {
+	/* u32 hashes leave the type out, as they did before there were types */
+	const unsigned int shape[3] = {m->rows, m->cols, m->type};
+	return matrix_kernels.hash(shape, m->type == MATRIX_U32 ? 2 : 3, row_sum);
+}
 
-	if (!create_matrix(m,name_buffer,rows,cols)) {
-		return false;
+/* 
+ * PURPOSE: Hash one row of a dense matrix. Rows of the narrow types needn't
+ *  start or end on an unsigned int, so they are hashed through an aligned
+ *  buffer, zero padded to whole words
+ * INPUTS: Address of the matrix, row
+ * RETURN: The row hash
+ **/
+
+static uint64_t hash_row (const Matrix_t* m, size_t r) {
+	if (m->type == MATRIX_U32) {
+		return matrix_kernels.hash(m->data + r * m->cols, m->cols, r);
+	}
+	unsigned int words[HASH_ROW_WORDS];
+	const size_t row_bytes = (size_t)m->cols * matrix_types[m->type].size;
+	const unsigned char* row = (const unsigned char*)m->elems + r * row_bytes;
+	uint64_t hash = r;
+	for (size_t i = 0; i < row_bytes; i += sizeof(words)) {
+		const size_t len = row_bytes - i < sizeof(words) ? row_bytes - i : sizeof(words);
+		const size_t n = (len + sizeof(unsigned int) - 1) / sizeof(unsigned int);
+		words[n - 1] = 0;
+		memcpy(words, row + i, len);
+		hash = matrix_kernels.hash(words, n, hash);
 	}
+	return hash;
+}
 
-	load_matrix(*m,data);
-	free(data);
-	if (close(fd)) {
-		return false;
+/* 
+ * PURPOSE: Content hash of a dense matrix, the one equal_matrices caches,
+ *  computed in parallel and cached if it isn't known yet
+ * INPUTS: Address of the matrix, address to store the hash
+ * RETURN: True if hashed, false on bad arguments or a sparse matrix
+ **/
+
+bool hash_matrix (Matrix_t* m, uint64_t* hash) {
+	if (m == NULL || hash == NULL || m->data == NULL) return false;
 
+	if (!m->hash_valid) {
+		Row_task_t task = {.a = m};
+		parallel_for(m->rows, parallel_grain_rows(m->cols), hash_rows, &task);
+		m->hash = finish_matrix_hash(m, task.hash);
+		m->hash_valid = true;
 	}
+	*hash = m->hash;
 	return true;
 }
 
 	//TODO FUNCTION COMMENT
 
 /* 
- * PURPOSE: Write given matrix to a file
- * INPUTS: Address of output filename, address of matrix
- * RETURN: True if write was successful, else false
+ * PURPOSE: Make dest hold the elements of src. dest drops its own data and
+ *  shares src's block copy-on-write, so no element is copied here
+ * INPUTS: Address to source matrix, address to destination matrix
+ * RETURN: True if duplicated, false on bad arguments, mismatched size or if
+ *  the shared block couldn't be allocated
  **/
 
-bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
-	
+bool duplicate_matrix (Matrix_t* src, Matrix_t* dest) {
+	STATS_SCOPE(scope, STAT_DUPLICATE_MATRIX);
+
+
 	//TODO ERROR CHECK INCOMING PARAMETERS
-    
-    if(matrix_output_filename == NULL || m == NULL) return false;
 
-	int fd = open (matrix_output_filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
-	/* ERROR HANDLING USING errorno*/
-	if (fd < 0) {
-		printf("FAILED TO CREATE/OPEN FILE FOR WRITING\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXISTS\n");
+    if (src == NULL || dest == NULL) return false;
+
+	if (src->rows != dest->rows || src->cols != dest->cols) {
+		return false;
+	}
+	if (src == dest || (src->shared && src->shared == dest->shared)) {
+		return true;
+	}
+	if (src->csr) {
+		Matrix_csr_t* csr = copy_csr(src->csr, src->rows);
+		if (!csr) {
+			return false;
 		}
+		release_data(dest);
+		dest->csr = csr;
+		dest->type = src->type;
+		dest->hash = src->hash;
+		dest->hash_valid = src->hash_valid;
+		return true;
+	}
+	if (!share_data(src)) {
 		return false;
 	}
-	/* Calculate the needed buffer for our matrix */
-	unsigned int name_len = (int)strlen(m->name) + 1;
-	unsigned int numberOfBytes = sizeof(unsigned int) + (sizeof(unsigned int)  * 2) + name_len + sizeof(unsigned int) * m->rows * m->cols + 1;
-	/* Allocate the output_buffer in bytes
-	 * IMPORTANT TO UNDERSTAND THIS WAY OF MOVING MEMORY
-	 */
-	unsigned char* output_buffer = calloc(numberOfBytes,sizeof(unsigned char));
-	unsigned int offset = 0;
-	memcpy(&output_buffer[offset], &name_len, sizeof(unsigned int)); // IMPORTANT C FUNCTION TO KNOW
-	offset += sizeof(unsigned int);	
-	memcpy(&output_buffer[offset], m->name,name_len);
-	offset += name_len;
-	memcpy(&output_buffer[offset],&m->rows,sizeof(unsigned int));
+	release_data(dest);
+	__atomic_add_fetch(&src->shared->refs, 1, __ATOMIC_RELAXED);
+	dest->data = src->data;
+	dest->shared = src->shared;
+	dest->type = src->type;
+	dest->hash = src->hash;
+	dest->hash_valid = src->hash_valid;
+	return true;
+}
+
+	//TODO FUNCTION COMMENT
+
+/* 
+ * PURPOSE: Perform bit shift on matrix data
+ * INPUTS: Address of matrix to shift, indicator for direction to shift, number of bits to shift
+ * RETURN: True if shift successful, else false
+ **/
+
+bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
+	STATS_SCOPE(scope, STAT_SHIFT_MATRIX);
+	
+	//TODO ERROR CHECK INCOMING PARAMETERS
+    if (!a || (direction != 'l' && direction != 'r') || shift == 0) return false;
+	if (matrix_types[a->type].shift == NULL) {
+		return false;
+	}
+	if (a->csr) {
+		a->hash_valid = false;
+		scope.bytes = 4ull * a->csr->nnz * sizeof(unsigned int);
+		shift_csr(a->csr, a->rows, direction, shift);
+		return true;
+	}
+	if (!unshare_matrix(a, true)) {
+		return false;
+	}
+
+	Row_task_t task = {.a = a, .direction = direction, .shift = shift};
+	scope.bytes = 2ull * matrix_data_bytes(a);
+	parallel_for(a->rows, parallel_grain_rows(a->cols), shift_rows, &task);
+	/* shifting only ever clears elements, switch once few are left */
+	if (a->type == MATRIX_U32 && sparse_fits(a->rows, a->cols, task.nnz)) {
+		make_sparse(a);
+	}
+	
+	return true;
+}
+
+/* 
+ * PURPOSE: add_matrices when either operand is sparse. Two sparse operands
+ *  are merged into a sparse sum (dense if it fills up past the threshold),
+ *  otherwise the sparse operand is added into a copy of the dense one
+ * INPUTS: Address of matrix a and b to add, address of matrix c to store
+ *  results, address to store the bytes touched
+ * RETURN: True if matrices were added, else false
+ **/
+
+static bool add_sparse (Matrix_t* a, Matrix_t* b, Matrix_t* c, uint64_t* bytes) {
+	if (a->csr && b->csr) {
+		Matrix_csr_t* sum = add_csr(a->csr, b->csr, a->rows);
+		if (!sum) {
+			return false;
+		}
+		*bytes = (a->csr->nnz + b->csr->nnz + sum->nnz) * 2 * sizeof(unsigned int);
+		if (sparse_fits(c->rows, c->cols, sum->nnz)) {
+			release_data(c);
+			c->csr = sum;
+		}
+		else {
+			if (!unshare_matrix(c, false)) {
+				destroy_csr(sum, c->rows);
+				return false;
+			}
+			csr_to_dense(sum, c->data, c->rows, c->cols);
+			destroy_csr(sum, c->rows);
+		}
+		c->hash_valid = false;
+		return true;
+	}
+
+	Matrix_t* s = a->csr ? a : b;
+	Matrix_t* d = a->csr ? b : a;
+	/* c's own elements go when it is made dense, keep a copy if it is the sparse side */
+	Matrix_csr_t* csr = c == s ? copy_csr(s->csr, s->rows) : s->csr;
+	if (!csr || !unshare_matrix(c, c == d)) {
+		if (csr && csr != s->csr) {
+			destroy_csr(csr, s->rows);
+		}
+		return false;
+	}
+	if (c != d) {
+		Row_task_t task = {.a = d, .c = c};
+		parallel_for(c->rows, parallel_grain_rows(c->cols), copy_rows, &task);
+	}
+	add_csr_dense(c->data, csr, c->rows, c->cols);
+	*bytes = 2ull * c->rows * c->cols * sizeof(unsigned int) + csr->nnz * 2 * sizeof(unsigned int);
+	if (csr != s->csr) {
+		destroy_csr(csr, c->rows);
+	}
+	return true;
+}
+
+	//TODO FUNCTION COMMENT
+
+/* 
+ * PURPOSE: Add given matrices and store results, all three of one element type
+ * INPUTS: Address of matrix a and b to add, address of matrix c to store results
+ * RETURN: True if matrices were added, else false
+ **/
+
+bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+	STATS_SCOPE(scope, STAT_ADD_MATRICES);
+
+	//TODO ERROR CHECK INCOMING PARAMETERS
+    if(a == NULL || b == NULL || c == NULL) return false;
+
+	if (a->rows != b->rows || a->cols != b->cols
+		|| c->rows != a->rows || c->cols != a->cols
+		|| b->type != a->type || c->type != a->type) {
+		return false;
+	}
+	if (a->csr || b->csr) {
+		return add_sparse(a, b, c, &scope.bytes);
+	}
+	if (!unshare_matrix(c, c == a || c == b)) {
+		return false;
+	}
+
+	Row_task_t task = {.a = a, .b = b, .c = c};
+	scope.bytes = 3ull * matrix_data_bytes(a);
+	parallel_for(a->rows, parallel_grain_rows(a->cols), add_rows, &task);
+	return true;
+}
+
+/* 
+ * PURPOSE: Multiply two matrices, c = a * b, with arithmetic wrapping modulo
+ *  2^32 like add_matrices. Uses a blocked, packed GEMM so the working set of
+ *  every loop level fits its cache and the inner tile stays in registers.
+ * INPUTS: Address of matrix a (m x k), matrix b (k x n), result matrix c (m x n), all u32
+ * RETURN: True if the matrices were multiplied, false on bad arguments or
+ *  if the packing buffer couldn't be allocated
+ **/
+
+bool multiply_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+	STATS_SCOPE(scope, STAT_MULTIPLY_MATRICES);
+	if (a == NULL || b == NULL || c == NULL || c == a || c == b) return false;
+
+	if (a->cols != b->rows || c->rows != a->rows || c->cols != b->cols
+		|| a->type != MATRIX_U32 || b->type != MATRIX_U32 || c->type != MATRIX_U32) {
+		return false;
+	}
+
+	const size_t k = a->cols;
+	const size_t n = b->cols;
+	scope.bytes = ((uint64_t)a->rows * k + (uint64_t)k * n + (uint64_t)a->rows * n) * sizeof(unsigned int);
+	unsigned int* a_temp = NULL;
+	unsigned int* b_temp = NULL;
+	const unsigned int* a_data = read_dense(a, &a_temp);
+	const unsigned int* b_data = read_dense(b, &b_temp);
+	unsigned int* b_packed = aligned_alloc(64, sizeof(unsigned int) * GEMM_KC
+		* ((GEMM_NC + GEMM_NR - 1) / GEMM_NR * GEMM_NR));
+	/* c is only unshared once nothing else can fail, so a failed multiply leaves it intact */
+	if (!a_data || !b_data || !b_packed || !unshare_matrix(c, false)) {
+		free(b_packed);
+		matrix_free_data(a_temp, matrix_data_bytes(a));
+		matrix_free_data(b_temp, matrix_data_bytes(b));
+		return false;
+	}
+	memset(c->data, 0, sizeof(unsigned int) * c->rows * c->cols);
+
+	for (size_t jc = 0; jc < n; jc += GEMM_NC) {
+		const size_t nc = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+		for (size_t pc = 0; pc < k; pc += GEMM_KC) {
+			const size_t kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+
+			/* pack b[pc:pc+kc, jc:jc+nc] into GEMM_NR wide slivers, zero padded */
+			unsigned int* dst = b_packed;
+			for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+				const size_t nr = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+				for (size_t p = 0; p < kc; ++p) {
+					const unsigned int* src = b_data + (pc + p) * n + jc + jr;
+					memcpy(dst, src, nr * sizeof(unsigned int));
+					memset(dst + nr, 0, (GEMM_NR - nr) * sizeof(unsigned int));
+					dst += GEMM_NR;
+				}
+			}
+
+			Gemm_task_t task = {a, c, b_packed, pc, kc, jc, nc, a_data};
+			const size_t row_blocks = (a->rows + GEMM_MC - 1) / GEMM_MC;
+			parallel_for(row_blocks, 1, gemm_row_blocks, &task);
+		}
+	}
+	free(b_packed);
+	matrix_free_data(a_temp, matrix_data_bytes(a));
+	matrix_free_data(b_temp, matrix_data_bytes(b));
+	return true;
+}
+
+/* 
+ * PURPOSE: Transpose a non-square dense matrix in place by following the
+ *  cycles of the permutation: the element at row-major index k (other than
+ *  the first and last) moves to k * rows mod (n - 1). A bitmap marks the
+ *  elements already moved, so every cycle is walked once
+ * INPUTS: Matrix data, rows, cols
+ * RETURN: True if transposed, false if the bitmap couldn't be allocated
+ **/
+
+static bool transpose_cycles (unsigned int* data, size_t rows, size_t cols) {
+	const size_t n = rows * cols;
+	if (rows == 1 || cols == 1) {
+		return true;
+	}
+	uint64_t* moved = calloc((n + 63) / 64, sizeof(uint64_t));
+	if (!moved) {
+		return false;
+	}
+	/* k * rows only overflows for matrices beyond 2^32 elements with many rows */
+	const bool wide = rows > UINT64_MAX / n;
+	for (size_t start = 1; start < n - 1; ++start) {
+		if (moved[start / 64] >> (start % 64) & 1) {
+			continue;
+		}
+		unsigned int carry = data[start];
+		size_t k = start;
+		do {
+			k = wide ? (size_t)((unsigned __int128)k * rows % (n - 1)) : k * rows % (n - 1);
+			const unsigned int next = data[k];
+			data[k] = carry;
+			carry = next;
+			moved[k / 64] |= 1ull << (k % 64);
+		} while (k != start);
+	}
+	free(moved);
+	return true;
+}
+
+/* 
+ * PURPOSE: Transpose a matrix, c = a^T. Dense matrices are moved in
+ *  TRANSPOSE_BLOCK blocks, in parallel, with the kernel transposing each
+ *  tile in registers. In place (c == a), square matrices swap mirrored
+ *  blocks and other shapes follow the permutation's cycles. Sparse matrices
+ *  stay sparse
+ * INPUTS: Address of matrix a, address of result matrix c (a->cols x a->rows,
+ *  or a itself), both u32
+ * RETURN: True if transposed, false on bad arguments, mismatched size or if
+ *  memory couldn't be allocated
+ **/
+
+bool transpose_matrix (Matrix_t* a, Matrix_t* c) {
+	STATS_SCOPE(scope, STAT_TRANSPOSE_MATRIX);
+	if (a == NULL || c == NULL || (a->data == NULL && a->csr == NULL)) return false;
+
+	const unsigned int rows = a->rows;
+	const unsigned int cols = a->cols;
+	if ((c != a && (c->rows != cols || c->cols != rows)) || a->type != MATRIX_U32 || c->type != MATRIX_U32) {
+		return false;
+	}
+	if (a->csr) {
+		Matrix_csr_t* t = transpose_csr(a->csr, rows, cols);
+		if (!t) {
+			return false;
+		}
+		scope.bytes = 4ull * a->csr->nnz * sizeof(unsigned int);
+		release_data(c);
+		c->csr = t;
+		c->rows = cols;
+		c->cols = rows;
+		c->hash_valid = false;
+		return true;
+	}
+
+	scope.bytes = 2ull * rows * cols * sizeof(unsigned int);
+	if (c == a) {
+		if (!unshare_matrix(a, true)) {
+			return false;
+		}
+		if (rows == cols) {
+			Row_task_t task = {.a = a};
+			parallel_for((rows + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK, 1, transpose_square_blocks, &task);
+		}
+		else if (!transpose_cycles(a->data, rows, cols)) {
+			return false;
+		}
+		a->rows = cols;
+		a->cols = rows;
+		return true;
+	}
+
+	if (!unshare_matrix(c, false)) {
+		return false;
+	}
+	Row_task_t task = {.a = a, .c = c};
+	const size_t grain = parallel_grain_rows((size_t)rows * TRANSPOSE_BLOCK);
+	parallel_for((cols + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK, grain, transpose_blocks, &task);
+	return true;
+}
+
+/* 
+ * PURPOSE: Give a matrix a new shape with the same number of elements, each
+ *  keeping its row-major index. Dense data is not touched; sparse rows are
+ *  re-split
+ * INPUTS: Address of the matrix, new rows, new cols
+ * RETURN: True if reshaped, false if the element count differs or the new
+ *  sparse arrays couldn't be allocated
+ **/
+
+bool reshape_matrix (Matrix_t* m, unsigned int rows, unsigned int cols) {
+	if (m == NULL || (uint64_t)rows * cols != (uint64_t)m->rows * m->cols || rows == 0) return false;
+
+	if (m->csr) {
+		Matrix_csr_t* csr = reshape_csr(m->csr, m->rows, m->cols, rows, cols);
+		if (!csr) {
+			return false;
+		}
+		destroy_csr(m->csr, m->rows);
+		m->csr = csr;
+	}
+	m->rows = rows;
+	m->cols = cols;
+	/* the hash covers the shape */
+	m->hash_valid = false;
+	return true;
+}
+
+/* stream this thread's messages go to, NULL for stdout and stderr */
+static __thread FILE* messages;
+
+/* 
+ * PURPOSE: Send the messages the matrix, expression and workspace functions
+ *  print on this thread to a stream, so a server can hand them to the client
+ *  whose request caused them
+ * INPUTS: Stream, NULL to print to stdout and stderr again
+ * RETURN: Nothing
+ **/
+
+void set_matrix_messages (FILE* out) {
+	messages = out;
+}
+
+/* 
+ * PURPOSE: Stream for this thread's messages
+ * INPUTS: Nothing
+ * RETURN: The stream set_matrix_messages gave, else stdout
+ **/
+
+FILE* matrix_messages (void) {
+	return messages ? messages : stdout;
+}
+
+/* 
+ * PURPOSE: perror for this thread's messages
+ * INPUTS: Message to print before the description of errno
+ * RETURN: Nothing
+ **/
+
+void matrix_perror (const char* msg) {
+	const int err = errno;
+	if (messages == NULL) {
+		errno = err;
+		perror(msg);
+		return;
+	}
+	fprintf(messages, "%s: %s\n", msg, strerror(err));
+}
+
+	//TODO FUNCTION COMMENT
+
+/* 
+ * PURPOSE: Prints out the contents of the given matrix
+ * INPUTS: Address of matrix to print, stream to print to
+ * RETURN: Nothing
+ **/
+
+void display_matrix (Matrix_t* m, FILE* out) {
+	STATS_SCOPE(scope, STAT_DISPLAY_MATRIX);
+	
+	//TODO ERROR CHECK INCOMING PARAMETERS
+    if(m == NULL || out == NULL){
+        matrix_perror("Matrix to display is NULL");
+        return;
+    }
+
+	fprintf(out, "\nMatrix Contents (%s):\n", m->name);
+	fprintf(out, "DIM = (%u,%u)\n", m->rows, m->cols);
+	scope.bytes = m->csr ? (uint64_t)m->rows * m->cols * sizeof(unsigned int) : matrix_data_bytes(m);
+	if (m->type != MATRIX_U32) {
+		const Matrix_type_ops_t* ops = &matrix_types[m->type];
+		char value[32];
+		fprintf(out, "TYPE = %s\n", ops->name);
+		for (size_t i = 0; i < (size_t)m->rows * m->cols; ++i) {
+			ops->format(value, sizeof(value), m->elems, i);
+			fprintf(out, "%s%s", value, (i + 1) % m->cols == 0 ? " \n" : " ");
+		}
+		fprintf(out, "\n");
+		return;
+	}
+	for (size_t i = 0; i < m->rows; ++i) {
+		size_t k = m->csr ? m->csr->row_ptr[i] : 0;
+		for (size_t j = 0; j < m->cols; ++j) {
+			unsigned int value = 0;
+			if (!m->csr) {
+				value = m->data[i * m->cols + j];
+			}
+			else if (k < m->csr->row_ptr[i + 1] && m->csr->col_idx[k] == j) {
+				value = m->csr->vals[k++];
+			}
+			fprintf(out, "%u ", value);
+		}
+		fprintf(out, "\n");
+	}
+	fprintf(out, "\n");
+
+}
+
+/* 
+ * PURPOSE: Map a whole matrix file read-only for decoding
+ * INPUTS: Address of input filename, address to store the mapping, address
+ *  to store its length
+ * RETURN: True if mapped, else false
+ **/
+
+static bool map_matrix_file (const char* matrix_input_filename, unsigned char** base, size_t* file_len) {
+	int fd = open(matrix_input_filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(matrix_messages(), "FAILED TO OPEN FOR READING\n");
+		matrix_perror("open");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		matrix_perror("fstat");
+		close(fd);
+		return false;
+	}
+	*file_len = (size_t)st.st_size;
+	*base = *file_len ? mmap(NULL, *file_len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (*base == MAP_FAILED) {
+		matrix_perror("mmap");
+		return false;
+	}
+	madvise(*base, *file_len, MADV_SEQUENTIAL);
+	return true;
+}
+
+/* 
+ * PURPOSE: Parse the header of a packed or sparse matrix file: magic,
+ *  version, name_len, name[name_len], rows, cols
+ * INPUTS: Mapped file, its length, expected version, addresses to store the
+ *  name, rows, cols and the offset of what follows the header
+ * RETURN: True if the header is valid, else false
+ **/
+
+static bool parse_tagged_header (const unsigned char* base, size_t file_len, unsigned int version,
+			const char** name, unsigned int* rows, unsigned int* cols, size_t* offset) {
+	unsigned int header[3] = {0};
+	unsigned int dims[2] = {0};
+	*offset = sizeof(header);
+	if (file_len < *offset) {
+		return false;
+	}
+	memcpy(header, base, sizeof(header));
+	if (header[1] != version || header[2] == 0 || header[2] % MATRIX_NAME_ALIGN != 0
+		|| header[2] > MATRIX_NAME_LEN + MATRIX_NAME_ALIGN
+		|| file_len - *offset < header[2] + sizeof(dims)) {
+		return false;
+	}
+	*name = (const char*)base + *offset;
+	*offset += header[2];
+	memcpy(dims, base + *offset, sizeof(dims));
+	*offset += sizeof(dims);
+	*rows = dims[0];
+	*cols = dims[1];
+	return memchr(*name, '\0', header[2]) != NULL && strlen(*name) + 1 <= MATRIX_NAME_LEN
+		&& *rows != 0 && *cols != 0;
+}
+
+/* 
+ * PURPOSE: Decode a packed matrix file. The file is mapped read-only and the
+ *  blocks are unpacked in parallel straight into the new matrix.
+ * INPUTS: Address of input filename, address to address of matrix to
+ *  populate, address to store the decoded byte count
+ * RETURN: True if the matrix was decoded, else false
+ **/
+
+static bool read_packed_matrix (const char* matrix_input_filename, Matrix_t** m, size_t* bytes) {
+	unsigned char* base = NULL;
+	size_t file_len = 0;
+	if (!map_matrix_file(matrix_input_filename, &base, &file_len)) {
+		return false;
+	}
+
+	/* header, block length, references, widths padded to an unsigned int,
+	 * then the packed words */
+	const char* name = NULL;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	unsigned int block_len = 0;
+	size_t offset = 0;
+	bool ok = parse_tagged_header(base, file_len, MATRIX_PACKED_VERSION, &name, &rows, &cols, &offset)
+		&& file_len - offset >= sizeof(block_len);
+	if (ok) {
+		memcpy(&block_len, base + offset, sizeof(block_len));
+		offset += sizeof(block_len);
+		ok = block_len == PACK_BLOCK;
+	}
+
+	Matrix_packed_t packed = {0};
+	const size_t n = (size_t)rows * cols;
+	if (ok) {
+		packed.num_blocks = (n + PACK_BLOCK - 1) / PACK_BLOCK;
+		const size_t tables = packed.num_blocks * sizeof(unsigned int)
+			+ (packed.num_blocks + sizeof(unsigned int) - 1) / sizeof(unsigned int) * sizeof(unsigned int);
+		ok = file_len - offset >= tables;
+		if (ok) {
+			packed.refs = (unsigned int*)(base + offset);
+			packed.widths = base + offset + packed.num_blocks * sizeof(unsigned int);
+			offset += tables;
+			packed.words = (uint32_t*)(base + offset);
+			/* whatever is left after the trailer byte */
+			packed.num_words = (file_len - offset - (file_len > offset)) / sizeof(uint32_t);
+		}
+	}
+	if (!ok) {
+		fprintf(matrix_messages(), "INVALID MATRIX HEADER\n");
+		munmap(base, file_len);
+		return false;
+	}
+
+	if (!create_matrix_uninit(m, name, rows, cols)) {
+		munmap(base, file_len);
+		return false;
+	}
+	if (!unpack_matrix_data((*m)->data, n, &packed)) {
+		fprintf(matrix_messages(), "FAILED TO READ MATRIX DATA\n");
+		destroy_matrix(m);
+		munmap(base, file_len);
+		return false;
+	}
+	munmap(base, file_len);
+	*bytes = n * sizeof(unsigned int);
+	return true;
+}
+
+/* 
+ * PURPOSE: Load a sparse matrix file into a new sparse matrix
+ * INPUTS: Address of input filename, address to address of matrix to
+ *  populate, address to store the byte count read
+ * RETURN: True if the matrix was read, else false
+ **/
+
+static bool read_sparse_matrix (const char* matrix_input_filename, Matrix_t** m, size_t* bytes) {
+	_Static_assert(sizeof(size_t) == sizeof(uint64_t), "row offsets are stored as 64 bits");
+	unsigned char* base = NULL;
+	size_t file_len = 0;
+	if (!map_matrix_file(matrix_input_filename, &base, &file_len)) {
+		return false;
+	}
+
+	/* header, nnz, row offsets, columns, values */
+	const char* name = NULL;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	uint64_t nnz = 0;
+	size_t offset = 0;
+	bool ok = parse_tagged_header(base, file_len, MATRIX_SPARSE_VERSION, &name, &rows, &cols, &offset)
+		&& file_len - offset >= sizeof(nnz);
+	if (ok) {
+		memcpy(&nnz, base + offset, sizeof(nnz));
+		offset += sizeof(nnz);
+		const size_t ptr_len = ((size_t)rows + 1) * sizeof(size_t);
+		ok = nnz <= (uint64_t)rows * cols && file_len - offset >= ptr_len
+			&& (file_len - offset - ptr_len) / (2 * sizeof(unsigned int)) >= nnz;
+	}
+	if (!ok) {
+		fprintf(matrix_messages(), "INVALID MATRIX HEADER\n");
+		munmap(base, file_len);
+		return false;
+	}
+
+	Matrix_t* sparse = NULL;
+	if (!create_matrix(&sparse, name, rows, cols)) {
+		munmap(base, file_len);
+		return false;
+	}
+	Matrix_csr_t* csr = create_csr(rows, nnz);
+	if (!csr) {
+		destroy_matrix(&sparse);
+		munmap(base, file_len);
+		return false;
+	}
+	destroy_csr(sparse->csr, rows);
+	sparse->csr = csr;
+	csr->nnz = nnz;
+	memcpy(csr->row_ptr, base + offset, ((size_t)rows + 1) * sizeof(size_t));
+	offset += ((size_t)rows + 1) * sizeof(size_t);
+	if (nnz) {
+		memcpy(csr->col_idx, base + offset, nnz * sizeof(unsigned int));
+		memcpy(csr->vals, base + offset + nnz * sizeof(unsigned int), nnz * sizeof(unsigned int));
+	}
+	munmap(base, file_len);
+	if (!valid_csr(csr, rows, cols)) {
+		fprintf(matrix_messages(), "FAILED TO READ MATRIX DATA\n");
+		destroy_matrix(&sparse);
+		return false;
+	}
+	*m = sparse;
+	*bytes = ((size_t)rows + 1) * sizeof(size_t) + nnz * 2 * sizeof(unsigned int);
+	return true;
+}
+
+/* 
+ * PURPOSE: Parse the header of a typed matrix file: the tagged header, the
+ *  element type, then zero padding up to an 8 byte boundary so the elements
+ *  of any type can be used in place
+ * INPUTS: Mapped file, its length, addresses to store the name, rows, cols,
+ *  type and the offset of the elements
+ * RETURN: True if the header is valid and the file holds every element, else false
+ **/
+
+static bool parse_typed_header (const unsigned char* base, size_t file_len, const char** name,
+			unsigned int* rows, unsigned int* cols, Matrix_type_t* type, size_t* offset) {
+	unsigned int type_word = 0;
+	if (!parse_tagged_header(base, file_len, MATRIX_TYPED_VERSION, name, rows, cols, offset)
+		|| file_len - *offset < sizeof(type_word)) {
+		return false;
+	}
+	memcpy(&type_word, base + *offset, sizeof(type_word));
+	*offset = (*offset + sizeof(type_word) + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+	if (type_word >= MATRIX_TYPE_COUNT || *offset > file_len) {
+		return false;
+	}
+	*type = (Matrix_type_t)type_word;
+	return (file_len - *offset) / matrix_types[*type].size / *rows >= *cols;
+}
+
+/* 
+ * PURPOSE: Load a typed matrix file into a new matrix of its element type
+ * INPUTS: Address of input filename, address to address of matrix to
+ *  populate, address to store the byte count read
+ * RETURN: True if the matrix was read, else false
+ **/
+
+static bool read_typed_matrix (const char* matrix_input_filename, Matrix_t** m, size_t* bytes) {
+	unsigned char* base = NULL;
+	size_t file_len = 0;
+	if (!map_matrix_file(matrix_input_filename, &base, &file_len)) {
+		return false;
+	}
+
+	const char* name = NULL;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	Matrix_type_t type = MATRIX_U32;
+	size_t offset = 0;
+	if (!parse_typed_header(base, file_len, &name, &rows, &cols, &type, &offset)) {
+		fprintf(matrix_messages(), "INVALID MATRIX HEADER\n");
+		munmap(base, file_len);
+		return false;
+	}
+	if (!create_matrix_typed(m, name, rows, cols, type, false)) {
+		munmap(base, file_len);
+		return false;
+	}
+	*bytes = matrix_data_bytes(*m);
+	memcpy((*m)->elems, base + offset, *bytes);
+	munmap(base, file_len);
+	return true;
+}
+
+	//TODO FUNCTION COMMENT
+
+/* 
+ * PURPOSE: Read matrix from a file, plain, packed, sparse or typed
+ * INPUTS: Address of input filename, address of matrices
+ * RETURN: True of read was successful, else false
+ **/
+
+bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
+	STATS_SCOPE(scope, STAT_READ_MATRIX);
+	
+	//TODO ERROR CHECK INCOMING PARAMETERS
+
+    if(matrix_input_filename == NULL || m == NULL) return false;
+
+	int fd = open(matrix_input_filename,O_RDONLY);
+	if (fd < 0) {
+		fprintf(matrix_messages(), "FAILED TO OPEN FOR READING\n");
+		if (errno == EACCES ) {
+			matrix_perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		else if (errno == EADDRINUSE ){
+			matrix_perror("FILE ALREADY IN USE\n");
+		}
+		else if (errno == EBADF) {
+			matrix_perror("BAD FILE DESCRIPTOR\n");	
+		}
+		else if (errno == EEXIST) {
+			matrix_perror("FILE EXIST\n");
+		}
+		return false;
+	}
+
+	/*read the wrote dimensions and name length*/
+	unsigned int name_len = 0;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	
+	if (read(fd,&name_len,sizeof(unsigned int)) != sizeof(unsigned int)) {
+		fprintf(matrix_messages(), "FAILED TO READING FILE\n");
+		if (errno == EACCES ) {
+			matrix_perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		else if (errno == EADDRINUSE ){
+			matrix_perror("FILE ALREADY IN USE\n");
+		}
+		else if (errno == EBADF) {
+			matrix_perror("BAD FILE DESCRIPTOR\n");	
+		}
+		else if (errno == EEXIST) {
+			matrix_perror("FILE EXIST\n");
+		}
+		return false;
+	}
+	if (name_len == MATRIX_PACKED_MAGIC || name_len == MATRIX_SPARSE_MAGIC || name_len == MATRIX_TYPED_MAGIC) {
+		size_t bytes = 0;
+		close(fd);
+		bool ok = false;
+		if (name_len == MATRIX_PACKED_MAGIC) {
+			ok = read_packed_matrix(matrix_input_filename, m, &bytes);
+		}
+		else if (name_len == MATRIX_SPARSE_MAGIC) {
+			ok = read_sparse_matrix(matrix_input_filename, m, &bytes);
+		}
+		else {
+			ok = read_typed_matrix(matrix_input_filename, m, &bytes);
+		}
+		if (!ok) {
+			return false;
+		}
+		scope.bytes = bytes;
+		return true;
+	}
+	char name_buffer[50];
+	if (name_len == 0 || name_len > sizeof(name_buffer)) {
+		fprintf(matrix_messages(), "INVALID MATRIX NAME LENGTH\n");
+		close(fd);
+		return false;
+	}
+	if (read (fd,name_buffer,sizeof(char) * name_len) != sizeof(char) * name_len) {
+		fprintf(matrix_messages(), "FAILED TO READ MATRIX NAME\n");
+		if (errno == EACCES ) {
+			matrix_perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		else if (errno == EADDRINUSE ){
+			matrix_perror("FILE ALREADY IN USE\n");
+		}
+		else if (errno == EBADF) {
+			matrix_perror("BAD FILE DESCRIPTOR\n");	
+		}
+		else if (errno == EEXIST) {
+			matrix_perror("FILE EXIST\n");
+		}
+
+		return false;	
+	}
+
+	if (read (fd,&rows, sizeof(unsigned int)) != sizeof(unsigned int)) {
+		fprintf(matrix_messages(), "FAILED TO READ MATRIX ROW SIZE\n");
+		if (errno == EACCES ) {
+			matrix_perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		else if (errno == EADDRINUSE ){
+			matrix_perror("FILE ALREADY IN USE\n");
+		}
+		else if (errno == EBADF) {
+			matrix_perror("BAD FILE DESCRIPTOR\n");	
+		}
+		else if (errno == EEXIST) {
+			matrix_perror("FILE EXIST\n");
+		}
+
+		return false;
+	}
+
+	if (read(fd,&cols,sizeof(unsigned int)) != sizeof(unsigned int)) {
+		fprintf(matrix_messages(), "FAILED TO READ MATRIX COLUMN SIZE\n");
+		if (errno == EACCES ) {
+			matrix_perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		else if (errno == EADDRINUSE ){
+			matrix_perror("FILE ALREADY IN USE\n");
+		}
+		else if (errno == EBADF) {
+			matrix_perror("BAD FILE DESCRIPTOR\n");	
+		}
+		else if (errno == EEXIST) {
+			matrix_perror("FILE EXIST\n");
+		}
+
+		return false;
+	}
+
+	/* read straight into the new matrix, no staging buffer */
+	name_buffer[name_len - 1] = '\0';
+	if (!create_matrix_uninit(m,name_buffer,rows,cols)) {
+		close(fd);
+		return false;
+	}
+
+	const size_t numberOfDataBytes = matrix_data_bytes(*m);
+	scope.bytes = numberOfDataBytes;
+	if (!io_ring_read(fd,(*m)->data,numberOfDataBytes,3 * sizeof(unsigned int) + name_len)) {
+		fprintf(matrix_messages(), "FAILED TO READ MATRIX DATA\n");
+		if (errno == EACCES ) {
+			matrix_perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		else if (errno == EADDRINUSE ){
+			matrix_perror("FILE ALREADY IN USE\n");
+		}
+		else if (errno == EBADF) {
+			matrix_perror("BAD FILE DESCRIPTOR\n");	
+		}
+		else if (errno == EEXIST) {
+			matrix_perror("FILE EXIST\n");
+		}
+
+		destroy_matrix(m);
+		close(fd);
+		return false;	
+	}
+
+	if (close(fd)) {
+		return false;
+
+	}
+	return true;
+}
+
+/* 
+ * PURPOSE: Name of the matrix read_matrix would make from a file, taken from
+ *  the header alone, so a background read can tell which matrix it is for
+ * INPUTS: Address of input filename, buffer of MATRIX_NAME_LEN bytes for the name
+ * RETURN: True if the header holds a usable name, else false
+ **/
+
+bool read_matrix_name (const char* matrix_input_filename, char* name) {
+	if (matrix_input_filename == NULL || name == NULL) return false;
+
+	/* plain files hold names of up to 50 bytes, read_matrix refuses longer */
+	unsigned char header[3 * sizeof(unsigned int) + 50];
+	int fd = open(matrix_input_filename,O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	const ssize_t got = pread(fd, header, sizeof(header), 0);
+	close(fd);
+	if (got < (ssize_t)sizeof(unsigned int)) {
+		return false;
+	}
+
+	unsigned int words[3] = {0};
+	memcpy(words, header, got < (ssize_t)sizeof(words) ? (size_t)got : sizeof(words));
+	size_t offset = sizeof(unsigned int);
+	size_t name_len = words[0];
+	if (words[0] == MATRIX_PACKED_MAGIC || words[0] == MATRIX_SPARSE_MAGIC || words[0] == MATRIX_TYPED_MAGIC) {
+		offset = sizeof(words);
+		name_len = words[2];
+	}
+	if (name_len == 0 || name_len > sizeof(header) - offset || offset + name_len > (size_t)got) {
+		return false;
+	}
+	/* read_matrix ends the name at its last byte, the tagged formats pad it with zeros */
+	const char* text = (const char*)header + offset;
+	const size_t len = strnlen(text, name_len - 1);
+	if (len + 1 > MATRIX_NAME_LEN) {
+		return false;
+	}
+	memcpy(name, text, len);
+	name[len] = '\0';
+	return true;
+}
+
+/* 
+ * PURPOSE: Map a matrix file and use its payload as the matrix data without
+ *  copying. The mapping is private, so later writes to the matrix fault in
+ *  copy-on-write pages and never reach the file.
+ * INPUTS: Address of input filename, address to address of matrix to populate
+ * RETURN: True if the matrix was mapped (or, for packed and sparse files and
+ *  files whose payload is not unsigned int aligned, read through
+ *  read_matrix), else false. Typed files are mapped in place too.
+ **/
+
+bool read_matrix_mmap (const char* matrix_input_filename, Matrix_t** m) {
+	STATS_SCOPE(scope, STAT_READ_MATRIX_MMAP);
+
+    if(matrix_input_filename == NULL || m == NULL) return false;
+
+	int fd = open(matrix_input_filename,O_RDONLY);
+	if (fd < 0) {
+		fprintf(matrix_messages(), "FAILED TO OPEN FOR READING\n");
+		matrix_perror("open");
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		matrix_perror("fstat");
+		close(fd);
+		return false;
+	}
+
+	const size_t file_len = (size_t)st.st_size;
+	if (file_len < sizeof(unsigned int)) {
+		fprintf(matrix_messages(), "FILE TOO SMALL TO HOLD A MATRIX\n");
+		close(fd);
+		return false;
+	}
+
+	unsigned char* base = mmap(NULL, file_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		matrix_perror("mmap");
+		return false;
+	}
+
+	/* header: name_len, name[name_len], rows, cols, then rows * cols elements */
+	unsigned int name_len = 0;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	memcpy(&name_len, base, sizeof(unsigned int));
+	size_t offset = sizeof(unsigned int);
+	if (name_len == MATRIX_PACKED_MAGIC || name_len == MATRIX_SPARSE_MAGIC) {
+		munmap(base, file_len);
+		return read_matrix(matrix_input_filename, m);
+	}
+	const char* name = NULL;
+	Matrix_type_t type = MATRIX_U32;
+	if (name_len == MATRIX_TYPED_MAGIC) {
+		/* the elements are 8 byte aligned, always usable in place */
+		if (!parse_typed_header(base, file_len, &name, &rows, &cols, &type, &offset)) {
+			fprintf(matrix_messages(), "INVALID MATRIX HEADER\n");
+			munmap(base, file_len);
+			return false;
+		}
+	}
+	else {
+		if (name_len == 0 || name_len > MATRIX_NAME_LEN + MATRIX_NAME_ALIGN
+			|| file_len < offset + name_len + 2 * sizeof(unsigned int)) {
+			fprintf(matrix_messages(), "INVALID MATRIX HEADER\n");
+			munmap(base, file_len);
+			return false;
+		}
+		name = (const char*)base + offset;
+		offset += name_len;
+		memcpy(&rows, base + offset, sizeof(unsigned int));
+		offset += sizeof(unsigned int);
+		memcpy(&cols, base + offset, sizeof(unsigned int));
+		offset += sizeof(unsigned int);
+
+		size_t data_len = 0;
+		if (rows == 0 || cols == 0 || !matrix_size_bytes(rows, cols, sizeof(unsigned int), &data_len)
+			|| file_len - offset < data_len
+			|| memchr(name, '\0', name_len) == NULL || strlen(name) + 1 > MATRIX_NAME_LEN) {
+			fprintf(matrix_messages(), "INVALID MATRIX HEADER\n");
+			munmap(base, file_len);
+			return false;
+		}
+
+		/* files written before the name was padded cannot be used in place */
+		if (offset % sizeof(unsigned int) != 0) {
+			munmap(base, file_len);
+			return read_matrix(matrix_input_filename, m);
+		}
+	}
+
+	*m = matrix_alloc_header();
+	if (!(*m)) {
+		munmap(base, file_len);
+		return false;
+	}
+	strncpy((*m)->name, name, MATRIX_NAME_LEN - 1);
+	(*m)->rows = rows;
+	(*m)->cols = cols;
+	(*m)->type = type;
+	(*m)->elems = base + offset;
+	(*m)->map_base = base;
+	(*m)->map_len = file_len;
+	scope.bytes = matrix_data_bytes(*m);
+	return true;
+}
+
+/* 
+ * PURPOSE: Write every byte described by an iovec array, resuming after
+ *  short writes and interrupted calls. Each call writes at most
+ *  MATRIX_IO_CHUNK bytes, so matrices past the per-call limit go out in
+ *  pieces. If the file was opened with O_DIRECT and the kernel rejects the
+ *  unaligned buffers, O_DIRECT is dropped and the write continues through
+ *  the page cache.
+ * INPUTS: File descriptor, iovec array (modified in place), number of iovecs
+ * RETURN: True if everything was written, else false with errno set
+ **/
+
+bool write_all (int fd, struct iovec* iov, int iovcnt) {
+	while (iovcnt > 0) {
+		/* the iovecs that fit in one chunk, the last one cut short for the call */
+		int count = 0;
+		size_t total = 0;
+		while (count < iovcnt && iov[count].iov_len <= MATRIX_IO_CHUNK - total) {
+			total += iov[count++].iov_len;
+		}
+		const size_t cut_len = count < iovcnt ? iov[count].iov_len : 0;
+		if (count < iovcnt) {
+			iov[count++].iov_len = MATRIX_IO_CHUNK - total;
+		}
+		ssize_t written = writev(fd, iov, count);
+		if (cut_len) {
+			iov[count - 1].iov_len = cut_len;
+		}
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			int flags = fcntl(fd, F_GETFL);
+			if (errno == EINVAL && flags >= 0 && (flags & O_DIRECT)) {
+				if (fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0) {
+					continue;
+				}
+			}
+			return false;
+		}
+		/* skip the fully written iovecs and trim the partially written one */
+		while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (unsigned char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+static Matrix_io_stats_t write_stats;
+
+/* 
+ * PURPOSE: Report the cumulative cost of every write_matrix call
+ * INPUTS: Address of the stats structure to fill
+ * RETURN: Nothing
+ **/
+
+void get_matrix_write_stats (Matrix_io_stats_t* stats) {
+	if (stats == NULL) return;
+
+	*stats = write_stats;
+}
+
+/* 
+ * PURPOSE: Average write_matrix throughput since the program started
+ * INPUTS: Nothing
+ * RETURN: Bytes per second, 0 if nothing has been written yet
+ **/
+
+double matrix_write_bytes_per_sec (void) {
+	if (write_stats.nanoseconds == 0) return 0.0;
+
+	return (double)write_stats.bytes * 1e9 / (double)write_stats.nanoseconds;
+}
+
+	//TODO FUNCTION COMMENT
+
+/* 
+ * PURPOSE: Write given matrix to a file
+ * INPUTS: Address of output filename, address of matrix
+ * RETURN: True if write was successful, else false
+ **/
+
+bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
+	return write_matrix_ex(matrix_output_filename, m, WRITE_MATRIX_DEFAULT);
+}
+
+/* 
+ * PURPOSE: Stream a matrix to a file straight from its data buffer. The
+ *  header and payload go out through writev, so no copy of the matrix is
+ *  ever built in memory.
+ * INPUTS: Address of output filename, address of matrix, WRITE_MATRIX_* flags
+ *  (WRITE_MATRIX_FSYNC flushes to stable storage before returning,
+ *  WRITE_MATRIX_DIRECT bypasses the page cache where the filesystem allows,
+ *  WRITE_MATRIX_COMPRESS writes the packed format when it comes out smaller,
+ *  for u32 matrices, WRITE_MATRIX_IN_PLACE writes straight into the file
+ *  instead of renaming a finished copy over it). Matrices of any other type
+ *  are written in the typed format.
+ * RETURN: True if write was successful, else false
+ **/
+
+bool write_matrix_ex (const char* matrix_output_filename, Matrix_t* m, unsigned int flags) {
+	STATS_SCOPE(scope, STAT_WRITE_MATRIX);
+	
+	//TODO ERROR CHECK INCOMING PARAMETERS
+    
+    if(matrix_output_filename == NULL || m == NULL || (m->data == NULL && m->csr == NULL)) return false;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	const size_t data_len = matrix_data_bytes(m);
+	const bool typed = m->type != MATRIX_U32;
+	Matrix_packed_t packed = {0};
+	if ((flags & WRITE_MATRIX_COMPRESS) && !m->csr && !typed
+		&& pack_matrix_data(m->data, (size_t)m->rows * m->cols, &packed)
+		&& packed.num_blocks * (sizeof(unsigned int) + 1) + packed.num_words * sizeof(uint32_t)
+			>= data_len) {
+		/* incompressible, the plain format is smaller */
+		free_packed_data(&packed);
+	}
+
+	/* truncating the file in place would pull it out from under a read --map of it */
+	char tmp_name[PATH_MAX];
+	const char* open_name = matrix_output_filename;
+	if (!(flags & WRITE_MATRIX_IN_PLACE)) {
+		if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", matrix_output_filename) >= (int)sizeof(tmp_name)) {
+			fprintf(matrix_messages(), "FILENAME TOO LONG\n");
+			free_packed_data(&packed);
+			return false;
+		}
+		open_name = tmp_name;
+	}
+	int open_flags = O_CREAT | O_WRONLY | O_TRUNC;
+	if (flags & WRITE_MATRIX_DIRECT) {
+		open_flags |= O_DIRECT;
+	}
+	int fd = open (open_name, open_flags, 0644);
+	if (fd < 0 && (flags & WRITE_MATRIX_DIRECT) && errno == EINVAL) {
+		/* filesystem without O_DIRECT support, e.g. tmpfs */
+		fd = open (open_name, open_flags & ~O_DIRECT, 0644);
+	}
+	/* ERROR HANDLING USING errorno*/
+	if (fd < 0) {
+		fprintf(matrix_messages(), "FAILED TO CREATE/OPEN FILE FOR WRITING\n");
+		if (errno == EACCES ) {
+			matrix_perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		else if (errno == EADDRINUSE ){
+			matrix_perror("FILE ALREADY IN USE\n");
+		}
+		else if (errno == EBADF) {
+			matrix_perror("BAD FILE DESCRIPTOR\n");	
+		}
+		else if (errno == EEXIST) {
+			matrix_perror("FILE EXISTS\n");
+		}
+		free_packed_data(&packed);
+		return false;
+	}
+
+	/* header: name_len, zero padded name, rows, cols, packed, sparse and
+	 * typed files prefix it with their magic and version and follow it with
+	 * the block length, the number of non-zero elements or the type */
+	const unsigned int name_chars = (int)strlen(m->name) + 1;
+	unsigned int name_len = (name_chars + MATRIX_NAME_ALIGN - 1) / MATRIX_NAME_ALIGN * MATRIX_NAME_ALIGN;
+	unsigned char header[sizeof(unsigned int) * 6 + sizeof(uint64_t) + MATRIX_NAME_LEN + MATRIX_NAME_ALIGN] = {0};
+	const unsigned int packed_header[2] = {MATRIX_PACKED_MAGIC, MATRIX_PACKED_VERSION};
+	const unsigned int sparse_header[2] = {MATRIX_SPARSE_MAGIC, MATRIX_SPARSE_VERSION};
+	const unsigned int typed_header[2] = {MATRIX_TYPED_MAGIC, MATRIX_TYPED_VERSION};
+	const unsigned int block_len = PACK_BLOCK;
+	size_t offset = 0;
+	if (packed.words || m->csr || typed) {
+		memcpy(&header[offset], m->csr ? sparse_header : typed ? typed_header : packed_header,
+			sizeof(packed_header));
+		offset += sizeof(packed_header);
+	}
+	memcpy(&header[offset], &name_len, sizeof(unsigned int)); // IMPORTANT C FUNCTION TO KNOW
+	offset += sizeof(unsigned int);
+	memcpy(&header[offset], m->name, name_chars);
+	offset += name_len;
+	memcpy(&header[offset], &m->rows, sizeof(unsigned int));
 	offset += sizeof(unsigned int);
-	memcpy(&output_buffer[offset],&m->cols,sizeof(unsigned int));
+	memcpy(&header[offset], &m->cols, sizeof(unsigned int));
 	offset += sizeof(unsigned int);
-	memcpy (&output_buffer[offset],m->data,m->rows * m->cols * sizeof(unsigned int));
-	offset += (m->rows * m->cols * sizeof(unsigned int));
-	output_buffer[numberOfBytes - 1] = EOF;
 
-	if (write(fd,output_buffer,numberOfBytes) != numberOfBytes) {
-		printf("FAILED TO WRITE MATRIX TO FILE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
+	unsigned char trailer = EOF;
+	struct iovec iov[6] = {
+		{header, offset},
+		{m->data, data_len},
+		{&trailer, sizeof(trailer)},
+	};
+	int iovcnt = 3;
+	if (typed) {
+		/* type, then zeros up to the 8 byte aligned elements */
+		const unsigned int type_word = m->type;
+		memcpy(&header[offset], &type_word, sizeof(unsigned int));
+		offset = (offset + sizeof(unsigned int) + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+		iov[0].iov_len = offset;
+	}
+	else if (packed.words) {
+		/* block length, references, widths padded to an unsigned int, words */
+		static const unsigned char zeros[sizeof(unsigned int)];
+		const size_t widths_pad = (sizeof(unsigned int) - packed.num_blocks % sizeof(unsigned int))
+			% sizeof(unsigned int);
+		memcpy(&header[offset], &block_len, sizeof(unsigned int));
+		offset += sizeof(unsigned int);
+		iov[0].iov_len = offset;
+		iov[1] = (struct iovec){packed.refs, packed.num_blocks * sizeof(unsigned int)};
+		iov[2] = (struct iovec){packed.widths, packed.num_blocks};
+		iov[3] = (struct iovec){(void*)zeros, widths_pad};
+		iov[4] = (struct iovec){packed.words, packed.num_words * sizeof(uint32_t)};
+		iov[5] = (struct iovec){&trailer, sizeof(trailer)};
+		iovcnt = 6;
+	}
+	else if (m->csr) {
+		/* nnz, row offsets, then the columns and values of the non-zeros */
+		const uint64_t nnz = m->csr->nnz;
+		memcpy(&header[offset], &nnz, sizeof(uint64_t));
+		offset += sizeof(uint64_t);
+		iov[0].iov_len = offset;
+		iov[1] = (struct iovec){m->csr->row_ptr, ((size_t)m->rows + 1) * sizeof(size_t)};
+		iov[2] = (struct iovec){m->csr->col_idx, m->csr->nnz * sizeof(unsigned int)};
+		iov[3] = (struct iovec){m->csr->vals, m->csr->nnz * sizeof(unsigned int)};
+		iov[4] = (struct iovec){&trailer, sizeof(trailer)};
+		iovcnt = 5;
+	}
+	size_t file_len = 0;
+	for (int i = 0; i < iovcnt; ++i) {
+		file_len += iov[i].iov_len;
+	}
+
+	if (!write_all(fd, iov, iovcnt) || ((flags & WRITE_MATRIX_FSYNC) && fsync(fd) != 0)) {
+		fprintf(matrix_messages(), "FAILED TO WRITE MATRIX TO FILE\n");
+		matrix_perror("write");
+		free_packed_data(&packed);
+		close(fd);
+		if (open_name == tmp_name) {
+			unlink(tmp_name);
+		}
+		return false;
+	}
+	free_packed_data(&packed);
+
+	if (close(fd)) {
+		if (open_name == tmp_name) {
+			unlink(tmp_name);
+		}
+		return false;
+	}
+	if (open_name == tmp_name && rename(tmp_name, matrix_output_filename) != 0) {
+		matrix_perror("rename");
+		unlink(tmp_name);
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	/* the I/O thread and server downloads write alongside the command thread */
+	__atomic_add_fetch(&write_stats.bytes, file_len, __ATOMIC_RELAXED);
+	scope.bytes = file_len;
+	__atomic_add_fetch(&write_stats.nanoseconds, (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ull
+		+ (uint64_t)(end.tv_nsec - start.tv_nsec), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&write_stats.files, 1, __ATOMIC_RELAXED);
+
+	return true;
+}
+
+/* 
+ * PURPOSE: Sum every element of a matrix of an integer type. Row blocks are
+ *  reduced in parallel with 64-bit SIMD lanes and combined in 128 bits,
+ *  which holds the sum of any matrix exactly
+ * INPUTS: Address of the matrix, address to store the sum
+ * RETURN: True if summed, false on bad arguments or a floating point matrix
+ **/
+
+bool sum_matrix (Matrix_t* m, unsigned __int128* sum) {
+	STATS_SCOPE(scope, STAT_SUM_MATRIX);
+
+	if (m == NULL || (m->data == NULL && m->csr == NULL) || sum == NULL) return false;
+	if (matrix_types[m->type].is_float) {
+		return false;
+	}
+
+	if (m->csr) {
+		unsigned __int128 total = 0;
+		for (size_t i = 0; i < m->csr->nnz; i += SUM_CHUNK) {
+			const size_t n = m->csr->nnz - i < SUM_CHUNK ? m->csr->nnz - i : SUM_CHUNK;
+			total += matrix_kernels.sum(m->csr->vals + i, n);
+		}
+		scope.bytes = m->csr->nnz * sizeof(unsigned int);
+		*sum = total;
+		return true;
+	}
+	Row_task_t task = {.a = m};
+	scope.bytes = matrix_data_bytes(m);
+	parallel_for(m->rows, parallel_grain_rows(m->cols), sum_rows, &task);
+	*sum = ((unsigned __int128)task.sum_hi << 64) | task.sum_lo;
+	return true;
+}
+
+/* 
+ * PURPOSE: Sum every element of a floating point matrix in double
+ *  precision. Rows are summed in parallel and then added in row order, so
+ *  the result doesn't depend on how the rows were split between threads
+ * INPUTS: Address of the matrix, address to store the sum
+ * RETURN: True if summed, false on bad arguments, an integer matrix or if
+ *  the row sums couldn't be allocated
+ **/
+
+bool sum_matrix_real (Matrix_t* m, double* sum) {
+	STATS_SCOPE(scope, STAT_SUM_MATRIX);
+
+	if (m == NULL || m->elems == NULL || sum == NULL || !matrix_types[m->type].is_float) return false;
+
+	double* real_sums = malloc((size_t)m->rows * sizeof(double));
+	if (!real_sums) {
+		return false;
+	}
+	Row_task_t task = {.a = m, .real_sums = real_sums};
+	scope.bytes = matrix_data_bytes(m);
+	parallel_for(m->rows, parallel_grain_rows(m->cols), sum_rows, &task);
+	double total = 0.0;
+	for (size_t r = 0; r < m->rows; ++r) {
+		total += real_sums[r];
+	}
+	free(real_sums);
+	*sum = total;
+	return true;
+}
+
+/* 
+ * PURPOSE: Sum each row of a u32 matrix
+ * INPUTS: Address of the matrix, array of m->rows sums to fill
+ * RETURN: True if summed, else false
+ **/
+
+bool sum_matrix_rows (Matrix_t* m, uint64_t* sums) {
+	STATS_SCOPE(scope, STAT_SUM_MATRIX);
+
+	if (m == NULL || (m->data == NULL && m->csr == NULL) || sums == NULL || m->type != MATRIX_U32) return false;
+
+	if (m->csr) {
+		/* a row holds at most cols < 2^32 elements, exact for the kernel */
+		for (size_t r = 0; r < m->rows; ++r) {
+			const size_t begin = m->csr->row_ptr[r];
+			sums[r] = matrix_kernels.sum(m->csr->vals + begin, m->csr->row_ptr[r + 1] - begin);
 		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
+		scope.bytes = m->csr->nnz * sizeof(unsigned int);
+		return true;
+	}
+	Row_task_t task = {.a = m, .sums = sums};
+	scope.bytes = (uint64_t)m->rows * m->cols * sizeof(unsigned int);
+	parallel_for(m->rows, parallel_grain_rows(m->cols), sum_rows, &task);
+	return true;
+}
+
+/* 
+ * PURPOSE: Sum each column of a u32 matrix in one pass over its rows
+ * INPUTS: Address of the matrix, array of m->cols sums to fill
+ * RETURN: True if summed, else false
+ **/
+
+bool sum_matrix_cols (Matrix_t* m, uint64_t* sums) {
+	STATS_SCOPE(scope, STAT_SUM_MATRIX);
+
+	if (m == NULL || (m->data == NULL && m->csr == NULL) || sums == NULL || m->type != MATRIX_U32) return false;
+
+	memset(sums, 0, (size_t)m->cols * sizeof(uint64_t));
+	if (m->csr) {
+		for (size_t k = 0; k < m->csr->nnz; ++k) {
+			sums[m->csr->col_idx[k]] += m->csr->vals[k];
 		}
+		scope.bytes = m->csr->nnz * 2 * sizeof(unsigned int);
+		return true;
+	}
+	Row_task_t task = {.a = m, .sums = sums};
+	scope.bytes = (uint64_t)m->rows * m->cols * sizeof(unsigned int);
+	parallel_for(m->rows, parallel_grain_rows(m->cols), sum_cols, &task);
+	return true;
+}
+
+/* 
+ * PURPOSE: Merge the statistics of a second run of elements into a first,
+ *  with the pairwise update of Chan et al. for the mean and variance. When
+ *  both sums are exact, the difference of the means is taken from them
+ *  around the integer pivot of the first mean, so the rounding of large
+ *  means doesn't reach the variance
+ * INPUTS: Address of the running statistics, address of those to add
+ * RETURN: Nothing
+ **/
+
+static void merge_moments (Moments_t* a, const Moments_t* b) {
+	if (b->count == 0) {
+		return;
+	}
+	if (a->count == 0) {
+		*a = *b;
+		return;
+	}
+	const double n = (double)a->count + (double)b->count;
+	double delta = b->mean - a->mean;
+	if (a->exact && b->exact) {
+		const unsigned __int128 pivot = a->sum / a->count;
+		const double a_dev = (double)(a->sum - pivot * a->count) / (double)a->count;
+		const double b_dev = (double)((__int128)b->sum - (__int128)(pivot * b->count)) / (double)b->count;
+		delta = b_dev - a_dev;
+	}
+	a->mean += delta * ((double)b->count / n);
+	a->m2 += b->m2 + delta * delta * ((double)a->count * (double)b->count / n);
+	a->min = b->min < a->min ? b->min : a->min;
+	a->max = b->max > a->max ? b->max : a->max;
+	a->count += b->count;
+	a->nonzero += b->nonzero;
+	a->sum += b->sum;
+	a->exact = a->exact && b->exact;
+	if (a->exact) {
+		a->mean = (double)a->sum / (double)a->count;
+	}
+}
+
+/* 
+ * PURPOSE: Statistics of count zeros, the elements a sparse matrix leaves out
+ * INPUTS: Number of zeros
+ * RETURN: Their statistics
+ **/
+
+static Moments_t zero_moments (uint64_t count) {
+	return (Moments_t){.count = count, .exact = true};
+}
+
+/* 
+ * PURPOSE: Fill the public statistics from running ones
+ * INPUTS: Address of the running statistics, address of the result
+ * RETURN: Nothing
+ **/
+
+static void finish_moments (const Moments_t* mo, Matrix_stats_t* st) {
+	*st = (Matrix_stats_t){.count = mo->count, .nonzero = mo->nonzero, .min = mo->min,
+		.max = mo->max, .mean = mo->mean, .sum = mo->sum};
+	st->variance = mo->count ? mo->m2 / (double)mo->count : 0.0;
+}
+
+/* 
+ * PURPOSE: Describe a matrix in one pass over its elements: count, non-zero
+ *  count, min, max, exact sum (integer types), mean and variance, plus a
+ *  histogram of equal width bins over [min, max]. Chunks of the matrix are
+ *  widened to double and reduced in SIMD lanes while they sit in L1, row
+ *  units in parallel. The histogram needs min and max first, so it takes a
+ *  second pass, only when bins is non-zero.
+ * INPUTS: Address of the matrix, number of bins (0 for no histogram, at
+ *  most MATRIX_STATS_MAX_BINS), array of bins counts to fill, address to
+ *  store the statistics
+ * RETURN: True if described, false on bad arguments or out of memory
+ **/
+
+bool stats_matrix (Matrix_t* m, unsigned int bins, uint64_t* histogram, Matrix_stats_t* stats) {
+	STATS_SCOPE(scope, STAT_STATS_MATRIX);
+
+	if (m == NULL || (m->elems == NULL && m->csr == NULL) || stats == NULL
+		|| bins > MATRIX_STATS_MAX_BINS || (bins && histogram == NULL)) return false;
+
+	Stats_task_t task = {.m = m};
+	task.unit_rows = m->cols >= STATS_UNIT ? 1 : STATS_UNIT / m->cols;
+	const size_t num_units = (m->rows + task.unit_rows - 1) / task.unit_rows;
+	task.units = calloc(num_units, sizeof(Moments_t));
+	if (!task.units) {
 		return false;
 	}
-	
-	if (close(fd)) {
+	parallel_for(num_units, 1, stats_units, &task);
+	Moments_t total = {0};
+	for (size_t u = 0; u < num_units; ++u) {
+		merge_moments(&total, &task.units[u]);
+	}
+	free(task.units);
+	finish_moments(&total, stats);
+	scope.bytes = m->csr ? m->csr->nnz * sizeof(unsigned int) : matrix_data_bytes(m);
+
+	if (bins) {
+		memset(histogram, 0, bins * sizeof(uint64_t));
+		task.bins = bins;
+		task.lo = total.min;
+		task.scale = total.max > total.min ? bins / (total.max - total.min) : 0.0;
+		task.histogram = histogram;
+		parallel_for(num_units, 1, stats_histogram, &task);
+		if (m->csr && total.count > total.nonzero) {
+			/* the zeros left out of the sparse form */
+			const double b = (0.0 - task.lo) * task.scale;
+			histogram[b < bins ? (unsigned int)b : bins - 1] += total.count - m->csr->nnz;
+		}
+		scope.bytes *= 2;
+	}
+	return true;
+}
+
+/* 
+ * PURPOSE: Describe each row of a matrix, see stats_matrix
+ * INPUTS: Address of the matrix, array of m->rows statistics to fill
+ * RETURN: True if described, false on bad arguments or out of memory
+ **/
+
+bool stats_matrix_rows (Matrix_t* m, Matrix_stats_t* stats) {
+	STATS_SCOPE(scope, STAT_STATS_MATRIX);
+
+	if (m == NULL || (m->elems == NULL && m->csr == NULL) || stats == NULL) return false;
+
+	Stats_task_t task = {.m = m, .unit_rows = 1};
+	task.units = calloc(m->rows, sizeof(Moments_t));
+	if (!task.units) {
 		return false;
 	}
-	free(output_buffer);
+	parallel_for(m->rows, parallel_grain_rows(m->cols), stats_units, &task);
+	for (size_t r = 0; r < m->rows; ++r) {
+		finish_moments(&task.units[r], &stats[r]);
+	}
+	free(task.units);
+	scope.bytes = m->csr ? m->csr->nnz * sizeof(unsigned int) : matrix_data_bytes(m);
+	return true;
+}
+
+/* 
+ * PURPOSE: Describe each column of a matrix, see stats_matrix. Stripes of
+ *  columns are walked down the rows in parallel, updating the mean and
+ *  variance of every column of the stripe per row (Welford), so the matrix
+ *  is still read once and in row order. The exact sums are left out.
+ * INPUTS: Address of the matrix, array of m->cols statistics to fill
+ * RETURN: True if described, false on bad arguments or out of memory
+ **/
+
+bool stats_matrix_cols (Matrix_t* m, Matrix_stats_t* stats) {
+	STATS_SCOPE(scope, STAT_STATS_MATRIX);
+
+	if (m == NULL || (m->elems == NULL && m->csr == NULL) || stats == NULL) return false;
 
+	Stats_task_t task = {.m = m};
+	task.units = calloc(m->cols, sizeof(Moments_t));
+	if (!task.units) {
+		return false;
+	}
+	if (m->csr) {
+		/* each column's non-zeros one at a time, then its zeros at once */
+		const Matrix_csr_t* csr = m->csr;
+		for (size_t i = 0; i < csr->nnz; ++i) {
+			const double x = csr->vals[i];
+			const Moments_t one = {.count = 1, .nonzero = x != 0, .min = x, .max = x, .mean = x};
+			merge_moments(&task.units[csr->col_idx[i]], &one);
+		}
+		for (size_t c = 0; c < m->cols; ++c) {
+			const Moments_t zeros = zero_moments(m->rows - task.units[c].count);
+			merge_moments(&task.units[c], &zeros);
+		}
+		scope.bytes = csr->nnz * 2 * sizeof(unsigned int);
+	}
+	else {
+		const size_t stripes = (m->cols + STATS_COL_STRIPE - 1) / STATS_COL_STRIPE;
+		parallel_for(stripes, 1, stats_col_stripes, &task);
+		scope.bytes = matrix_data_bytes(m);
+	}
+	for (size_t c = 0; c < m->cols; ++c) {
+		finish_moments(&task.units[c], &stats[c]);
+		stats[c].sum = 0;
+	}
+	free(task.units);
 	return true;
 }
 
 	//TODO FUNCTION COMMENT
 
 /* 
- * PURPOSE: Randomizes data in given matrix
+ * PURPOSE: Randomizes data in given matrix, integers for the integer types
+ *  and reals spread over the range for the floating point types
  * INPUTS: Address of matrix, range of numbers in which randomize data
  * RETURN: True if function was successfull, false if there is an error
  **/
 
 bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range) {
+	STATS_SCOPE(scope, STAT_RANDOM_MATRIX);
 	
 	//TODO ERROR CHECK INCOMING PARAMETERS
     if(m == NULL || end_range < start_range) return false;
-
-	for (unsigned int i = 0; i < m->rows; ++i) {
-		for (unsigned int j = 0; j < m->cols; ++j) {
-			m->data[i * m->cols + j] = rand() % (end_range + 1 - start_range) + start_range;
-		}
+	/* integer types take the values as drawn, they have to fit */
+	if (!matrix_types[m->type].is_float && end_range > matrix_types[m->type].max) {
+		return false;
+	}
+	if (!unshare_matrix(m, false)) {
+		return false;
 	}
+	scope.bytes = matrix_data_bytes(m);
+
+	/* range wraps to 0 for the full unsigned int range */
+	Row_task_t task = {.a = m, .start_range = start_range,
+		.range = end_range - start_range + 1,
+		.seed = prng_seed(), .stream = prng_next_stream()};
+	parallel_for(m->rows, parallel_grain_rows(m->cols), random_rows, &task);
 	return true;
 }
 
@@ -461,33 +2310,575 @@ void load_matrix (Matrix_t* m, unsigned int* data) {
 	
 	//TODO ERROR CHECK INCOMING PARAMETERS
     if(m == NULL || data == NULL){
-        perror("Invalid parameters in load_matrix");
+        matrix_perror("Invalid parameters in load_matrix");
         exit(-1);
     }
     
-	memcpy(m->data,data,m->rows * m->cols * sizeof(unsigned int));
+	if (!unshare_matrix(m, false)) {
+		matrix_perror("Failed to unshare matrix in load_matrix");
+		exit(-1);
+	}
+	memcpy(m->data,data,matrix_data_bytes(m));
 }
 
-	//TODO FUNCTION COMMENT
+/* 
+ * PURPOSE: Row block task for add_matrices, c = a + b
+ * INPUTS: Address of the Row_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void add_rows (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	const Matrix_type_ops_t* ops = &matrix_types[t->a->type];
+	const size_t offset = begin * t->a->cols * ops->size;
+	ops->add((unsigned char*)t->c->elems + offset, (const unsigned char*)t->a->elems + offset,
+		(const unsigned char*)t->b->elems + offset, (end - begin) * t->a->cols);
+}
 
 /* 
- * PURPOSE: Add a new matrix to array destroying old one if it exits
- * INPUTS: Address of matrices, address of new matrix, number of matrices
- * RETURN: Position of new matrix
+ * PURPOSE: Row block task for bitwise_shift_matrix, shifts a in place and
+ *  counts the elements still non-zero (for u32, the only type stored sparse)
+ * INPUTS: Address of the Row_task_t, first row, one past the last row
+ * RETURN: Nothing
  **/
 
-unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigned int num_mats) {
-	//TODO ERROR CHECK INCOMING PARAMETERS
-    
-    if(mats == NULL || new_matrix == NULL || num_mats == 0) return num_mats + 1;
-    
-	static long int current_position = 0;
-	const long int pos = current_position % num_mats;
-	if ( mats[pos] ) {
-		destroy_matrix(&mats[pos]);
-	} 
-	mats[pos] = new_matrix;
-	current_position++;
-    
-    return (int)pos;
+static void shift_rows (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	if (t->a->type != MATRIX_U32) {
+		/* only u32 matrices go sparse, nothing to count */
+		const Matrix_type_ops_t* ops = &matrix_types[t->a->type];
+		ops->shift((unsigned char*)t->a->elems + begin * t->a->cols * ops->size,
+			(end - begin) * t->a->cols, t->direction, t->shift);
+		return;
+	}
+	unsigned int* data = t->a->data + begin * t->a->cols;
+	const size_t n = (end - begin) * t->a->cols;
+	size_t nnz = 0;
+	/* count each chunk while it is still in L1 */
+	for (size_t i = 0; i < n; i += SHIFT_CHUNK) {
+		const size_t len = n - i < SHIFT_CHUNK ? n - i : SHIFT_CHUNK;
+		if (t->direction == 'l') {
+			matrix_kernels.shift_left(data + i, data + i, len, t->shift);
+		}
+		else {
+			matrix_kernels.shift_right(data + i, data + i, len, t->shift);
+		}
+		nnz += matrix_kernels.nonzero(data + i, len);
+	}
+	__atomic_add_fetch(&t->nnz, nnz, __ATOMIC_RELAXED);
+}
+
+/* 
+ * PURPOSE: Row block task for duplicate_matrix, copies a into c
+ * INPUTS: Address of the Row_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void copy_rows (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	const size_t row_bytes = (size_t)t->a->cols * matrix_types[t->a->type].size;
+	memcpy((unsigned char*)t->c->elems + begin * row_bytes, (const unsigned char*)t->a->elems + begin * row_bytes,
+		(end - begin) * row_bytes);
+}
+
+/* 
+ * PURPOSE: Row block task for equal_matrices. Compares a chunk of rows at a
+ *  time, records the lowest differing index and stops once a difference
+ *  before its next chunk is known; hashes the rows of a if asked to
+ * INPUTS: Address of the Row_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void compare_rows (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	const size_t cols = t->a->cols;
+	const size_t size = matrix_types[t->a->type].size;
+	const size_t row_bytes = cols * size;
+	const size_t step = row_bytes >= EQUAL_CHUNK_BYTES ? 1 : EQUAL_CHUNK_BYTES / row_bytes;
+
+	uint64_t hash = 0;
+	for (size_t r = begin; r < end; r += step) {
+		if (__atomic_load_n(&t->first_diff, __ATOMIC_RELAXED) < r * cols) {
+			return;
+		}
+		const size_t n = end - r < step ? end - r : step;
+		const unsigned char* a = (const unsigned char*)t->a->elems + r * row_bytes;
+		const unsigned char* b = (const unsigned char*)t->b->elems + r * row_bytes;
+		if (memcmp(a, b, n * row_bytes) != 0) {
+			size_t i = 0;
+			while (a[i] == b[i]) {
+				++i;
+			}
+			i /= size;
+			size_t found = __atomic_load_n(&t->first_diff, __ATOMIC_RELAXED);
+			while (r * cols + i < found && !__atomic_compare_exchange_n(&t->first_diff,
+				&found, r * cols + i, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			}
+			return;
+		}
+		if (t->hash_rows) {
+			for (size_t k = 0; k < n; ++k) {
+				hash += hash_row(t->a, r + k);
+			}
+		}
+	}
+	if (t->hash_rows) {
+		__atomic_add_fetch(&t->hash, hash, __ATOMIC_RELAXED);
+	}
+}
+
+/* 
+ * PURPOSE: Row block task for hash_matrix, adds the row hashes of a to the
+ *  task's hash the same way compare_rows does
+ * INPUTS: Address of the Row_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void hash_rows (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	uint64_t hash = 0;
+	for (size_t r = begin; r < end; ++r) {
+		hash += hash_row(t->a, r);
+	}
+	__atomic_add_fetch(&t->hash, hash, __ATOMIC_RELAXED);
+}
+
+/* 
+ * PURPOSE: Transpose a rows x cols block, the full tiles with the kernel and
+ *  the ragged right and bottom edges element by element
+ * INPUTS: Destination, its row stride, source, its row stride, rows and cols of the source block
+ * RETURN: Nothing
+ **/
+
+static void transpose_block (unsigned int* dst, size_t ld_dst, const unsigned int* src, size_t ld_src,
+			size_t rows, size_t cols) {
+	const size_t tile_rows = rows - rows % TRANSPOSE_TILE;
+	const size_t tile_cols = cols - cols % TRANSPOSE_TILE;
+	for (size_t i = 0; i < tile_rows; i += TRANSPOSE_TILE) {
+		for (size_t j = 0; j < tile_cols; j += TRANSPOSE_TILE) {
+			matrix_kernels.transpose(dst + j * ld_dst + i, ld_dst, src + i * ld_src + j, ld_src);
+		}
+	}
+	for (size_t i = 0; i < rows; ++i) {
+		for (size_t j = i < tile_rows ? tile_cols : 0; j < cols; ++j) {
+			dst[j * ld_dst + i] = src[i * ld_src + j];
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Task for transpose_matrix, writes a range of TRANSPOSE_BLOCK row
+ *  blocks of c (column blocks of a) one block at a time
+ * INPUTS: Address of the Row_task_t, first block, one past the last block
+ * RETURN: Nothing
+ **/
+
+static void transpose_blocks (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	const size_t rows = t->a->rows;
+	const size_t cols = t->a->cols;
+	for (size_t block = begin; block < end; ++block) {
+		const size_t jb = block * TRANSPOSE_BLOCK;
+		const size_t nc = cols - jb < TRANSPOSE_BLOCK ? cols - jb : TRANSPOSE_BLOCK;
+		for (size_t ib = 0; ib < rows; ib += TRANSPOSE_BLOCK) {
+			const size_t nr = rows - ib < TRANSPOSE_BLOCK ? rows - ib : TRANSPOSE_BLOCK;
+			transpose_block(t->c->data + jb * rows + ib, rows, t->a->data + ib * cols + jb, cols, nr, nc);
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Task for an in place transpose of a square matrix. Block row I
+ *  owns the blocks (I, J) and (J, I) for every J >= I and swaps each pair
+ *  through a transposed copy of (I, J) on the stack
+ * INPUTS: Address of the Row_task_t, first block row, one past the last block row
+ * RETURN: Nothing
+ **/
+
+static void transpose_square_blocks (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	const size_t n = t->a->rows;
+	unsigned int* data = t->a->data;
+	unsigned int tile[TRANSPOSE_BLOCK * TRANSPOSE_BLOCK] __attribute__((aligned(64)));
+
+	for (size_t block = begin; block < end; ++block) {
+		const size_t ib = block * TRANSPOSE_BLOCK;
+		const size_t nr = n - ib < TRANSPOSE_BLOCK ? n - ib : TRANSPOSE_BLOCK;
+		for (size_t jb = ib; jb < n; jb += TRANSPOSE_BLOCK) {
+			const size_t nc = n - jb < TRANSPOSE_BLOCK ? n - jb : TRANSPOSE_BLOCK;
+			unsigned int* upper = data + ib * n + jb;
+			unsigned int* lower = data + jb * n + ib;
+			transpose_block(tile, TRANSPOSE_BLOCK, upper, n, nr, nc);
+			if (jb != ib) {
+				transpose_block(upper, n, lower, n, nc, nr);
+			}
+			for (size_t r = 0; r < nc; ++r) {
+				memcpy(lower + r * n, tile + r * TRANSPOSE_BLOCK, nr * sizeof(unsigned int));
+			}
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Row block task for sum_matrix, sum_matrix_rows and
+ *  sum_matrix_real, either stores each row's sum or adds the block's total
+ *  to the task's 128-bit total
+ * INPUTS: Address of the Row_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void sum_rows (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	const size_t cols = t->a->cols;
+	unsigned __int128 total = 0;
+	if (t->a->type != MATRIX_U32) {
+		const Matrix_type_ops_t* ops = &matrix_types[t->a->type];
+		const unsigned char* row = (const unsigned char*)t->a->elems + begin * cols * ops->size;
+		Matrix_sum_t part = {0};
+		if (t->real_sums) {
+			for (size_t r = begin; r < end; ++r, row += cols * ops->size) {
+				part.real = 0.0;
+				ops->sum(row, cols, &part);
+				t->real_sums[r] = part.real;
+			}
+			return;
+		}
+		ops->sum(row, (end - begin) * cols, &part);
+		total = part.integer;
+	}
+	else {
+		const unsigned int* data = t->a->data + begin * cols;
+		if (t->sums) {
+			for (size_t r = begin; r < end; ++r, data += cols) {
+				t->sums[r] = matrix_kernels.sum(data, cols);
+			}
+			return;
+		}
+		for (size_t n = (end - begin) * cols; n > 0; ) {
+			const size_t chunk = n < SUM_CHUNK ? n : SUM_CHUNK;
+			total += matrix_kernels.sum(data, chunk);
+			data += chunk;
+			n -= chunk;
+		}
+	}
+	const uint64_t lo = (uint64_t)total;
+	const uint64_t old = __atomic_fetch_add(&t->sum_lo, lo, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&t->sum_hi, (uint64_t)(total >> 64) + (old + lo < old), __ATOMIC_RELAXED);
+}
+
+/* 
+ * PURPOSE: Row block task for sum_matrix_cols, accumulates the block's rows
+ *  privately and then adds them to the shared column sums
+ * INPUTS: Address of the Row_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void sum_cols (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	const size_t cols = t->a->cols;
+	const unsigned int* data = t->a->data + begin * cols;
+	if (begin == 0 && end == t->a->rows) {
+		/* the only block, no other task touches the sums */
+		for (size_t r = begin; r < end; ++r, data += cols) {
+			matrix_kernels.sum_cols(t->sums, data, cols);
+		}
+		return;
+	}
+
+	uint64_t* acc = calloc(cols, sizeof(uint64_t));
+	if (!acc) {
+		for (size_t r = begin; r < end; ++r, data += cols) {
+			for (size_t j = 0; j < cols; ++j) {
+				__atomic_add_fetch(&t->sums[j], data[j], __ATOMIC_RELAXED);
+			}
+		}
+		return;
+	}
+	for (size_t r = begin; r < end; ++r, data += cols) {
+		matrix_kernels.sum_cols(acc, data, cols);
+	}
+	for (size_t j = 0; j < cols; ++j) {
+		__atomic_add_fetch(&t->sums[j], acc[j], __ATOMIC_RELAXED);
+	}
+	free(acc);
+}
+
+/* 
+ * PURPOSE: Row block task for random_matrix, fills the rows from the
+ *  counter-based generator so the split between threads doesn't matter
+ * INPUTS: Address of the Row_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void random_rows (void* ctx, size_t begin, size_t end) {
+	Row_task_t* t = ctx;
+	const Matrix_type_ops_t* ops = &matrix_types[t->a->type];
+	const size_t first = begin * t->a->cols;
+	ops->random((unsigned char*)t->a->elems + first * ops->size, first, (end - begin) * t->a->cols,
+		t->seed, t->stream, t->start_range, t->range);
+}
+
+/* 
+ * PURPOSE: Task for multiply_matrices, runs the micro-kernel over every tile
+ *  of a range of GEMM_MC row blocks against the shared packed panel of b
+ * INPUTS: Address of the Gemm_task_t, first row block, one past the last row block
+ * RETURN: Nothing
+ **/
+
+static void gemm_row_blocks (void* ctx, size_t begin, size_t end) {
+	Gemm_task_t* t = ctx;
+	const size_t lda = t->a->cols;
+	const size_t ldc = t->c->cols;
+	unsigned int a_packed[GEMM_MC * GEMM_KC] __attribute__((aligned(64)));
+
+	for (size_t block = begin; block < end; ++block) {
+		const size_t ic = block * GEMM_MC;
+		const size_t mc = t->a->rows - ic < GEMM_MC ? t->a->rows - ic : GEMM_MC;
+
+		/* pack a[ic:ic+mc, pc:pc+kc] into GEMM_MR tall slivers, zero padded */
+		unsigned int* dst = a_packed;
+		for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+			const size_t mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+			const unsigned int* src = t->a_data + (ic + ir) * lda + t->pc;
+			for (size_t p = 0; p < t->kc; ++p) {
+				size_t r = 0;
+				for (; r < mr; ++r) {
+					dst[r] = src[r * lda + p];
+				}
+				for (; r < GEMM_MR; ++r) {
+					dst[r] = 0;
+				}
+				dst += GEMM_MR;
+			}
+		}
+
+		for (size_t jr = 0; jr < t->nc; jr += GEMM_NR) {
+			const size_t nr = t->nc - jr < GEMM_NR ? t->nc - jr : GEMM_NR;
+			const unsigned int* b_sliver = t->b_packed + jr * t->kc;
+			for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+				const size_t mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+				matrix_kernels.gemm(t->kc, a_packed + ir * t->kc, b_sliver,
+					t->c->data + (ic + ir) * ldc + t->jc + jr, ldc, mr, nr);
+			}
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Count, non-zero count, min, max, mean and squared deviations of
+ *  a chunk of doubles in SIMD lanes, the mean in a first and the deviations
+ *  in a second pass over the chunk while it is in L1
+ * INPUTS: Chunk, its length (at least 1), address to store its statistics
+ * RETURN: Nothing
+ **/
+
+static void chunk_moments (const double* x, size_t n, Moments_t* out) {
+	Stats_vec_t lo[2] = {{x[0], x[0]}, {x[0], x[0]}};
+	Stats_vec_t hi[2] = {lo[0], lo[0]};
+	Stats_vec_t sum[2] = {{0}, {0}};
+	Stats_mask_t nonzero[2] = {{0}, {0}};
+	size_t i = 0;
+	for (; i + STATS_LANES <= n; i += STATS_LANES) {
+		for (int k = 0; k < 2; ++k) {
+			Stats_vec_t v;
+			memcpy(&v, x + i + k * 2, sizeof(v));
+			const Stats_mask_t below = v < lo[k];
+			const Stats_mask_t above = v > hi[k];
+			lo[k] = (Stats_vec_t)((below & (Stats_mask_t)v) | (~below & (Stats_mask_t)lo[k]));
+			hi[k] = (Stats_vec_t)((above & (Stats_mask_t)v) | (~above & (Stats_mask_t)hi[k]));
+			sum[k] += v;
+			nonzero[k] -= v != 0;
+		}
+	}
+	double min = x[0];
+	double max = x[0];
+	double total = 0.0;
+	uint64_t nz = 0;
+	for (int k = 0; k < 2; ++k) {
+		for (int l = 0; l < 2; ++l) {
+			min = lo[k][l] < min ? lo[k][l] : min;
+			max = hi[k][l] > max ? hi[k][l] : max;
+			total += sum[k][l];
+			nz += nonzero[k][l];
+		}
+	}
+	for (size_t k = i; k < n; ++k) {
+		min = x[k] < min ? x[k] : min;
+		max = x[k] > max ? x[k] : max;
+		total += x[k];
+		nz += x[k] != 0;
+	}
+
+	const double mean = total / n;
+	Stats_vec_t dev[2] = {{0}, {0}};
+	for (i = 0; i + STATS_LANES <= n; i += STATS_LANES) {
+		for (int k = 0; k < 2; ++k) {
+			Stats_vec_t v;
+			memcpy(&v, x + i + k * 2, sizeof(v));
+			v -= mean;
+			dev[k] += v * v;
+		}
+	}
+	double m2 = dev[0][0] + dev[0][1] + dev[1][0] + dev[1][1];
+	for (; i < n; ++i) {
+		m2 += (x[i] - mean) * (x[i] - mean);
+	}
+	*out = (Moments_t){.count = n, .nonzero = nz, .min = min, .max = max, .mean = mean, .m2 = m2};
+}
+
+/* 
+ * PURPOSE: Add a contiguous run of elements to running statistics, one
+ *  chunk at a time, widened to double unless the u32 kernel takes it
+ * INPUTS: Elements, their number, their type, address of the statistics
+ * RETURN: Nothing
+ **/
+
+static void run_moments (const void* src, size_t n, Matrix_type_t type, Moments_t* acc) {
+	const Matrix_type_ops_t* ops = &matrix_types[type];
+	const unsigned char* p = src;
+	if (type == MATRIX_U32) {
+		/* the kernel takes everything from the integers, nothing to widen */
+		for (size_t i = 0; i < n; i += STATS_CHUNK) {
+			const size_t len = n - i < STATS_CHUNK ? n - i : STATS_CHUNK;
+			Kernel_moments_t k;
+			matrix_kernels.moments((const unsigned int*)src + i, len, &k);
+			const Moments_t part = {.count = len, .nonzero = k.nonzero, .min = k.min, .max = k.max,
+				.mean = (double)k.sum / len, .m2 = k.m2, .sum = k.sum, .exact = true};
+			merge_moments(acc, &part);
+		}
+		return;
+	}
+	double buf[STATS_CHUNK];
+	for (size_t i = 0; i < n; i += STATS_CHUNK) {
+		const size_t len = n - i < STATS_CHUNK ? n - i : STATS_CHUNK;
+		const void* chunk = p + i * ops->size;
+		ops->widen(buf, chunk, len);
+		Moments_t part;
+		chunk_moments(buf, len, &part);
+		if (!ops->is_float) {
+			Matrix_sum_t exact = {0};
+			ops->sum(chunk, len, &exact);
+			part.sum = exact.integer;
+			part.exact = true;
+		}
+		merge_moments(acc, &part);
+	}
+}
+
+/* 
+ * PURPOSE: Task of stats_matrix and stats_matrix_rows, fills the
+ *  statistics of each unit of unit_rows rows
+ * INPUTS: Address of the Stats_task_t, first unit, one past the last unit
+ * RETURN: Nothing
+ **/
+
+static void stats_units (void* ctx, size_t begin, size_t end) {
+	Stats_task_t* t = ctx;
+	const Matrix_t* m = t->m;
+	for (size_t u = begin; u < end; ++u) {
+		const size_t r0 = u * t->unit_rows;
+		const size_t r1 = r0 + t->unit_rows < m->rows ? r0 + t->unit_rows : m->rows;
+		Moments_t* acc = &t->units[u];
+		if (m->csr) {
+			const size_t first = m->csr->row_ptr[r0];
+			const size_t nnz = m->csr->row_ptr[r1] - first;
+			run_moments(m->csr->vals + first, nnz, MATRIX_U32, acc);
+			const Moments_t zeros = zero_moments((r1 - r0) * m->cols - nnz);
+			merge_moments(acc, &zeros);
+		}
+		else {
+			const size_t size = matrix_types[m->type].size;
+			run_moments((const unsigned char*)m->elems + r0 * m->cols * size, (r1 - r0) * m->cols,
+				m->type, acc);
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Task of the histogram pass of stats_matrix, bins the elements
+ *  of its units and adds the counts to the shared histogram
+ * INPUTS: Address of the Stats_task_t, first unit, one past the last unit
+ * RETURN: Nothing
+ **/
+
+static void stats_histogram (void* ctx, size_t begin, size_t end) {
+	Stats_task_t* t = ctx;
+	const Matrix_t* m = t->m;
+	const Matrix_type_ops_t* ops = &matrix_types[m->csr ? MATRIX_U32 : m->type];
+	uint64_t counts[MATRIX_STATS_MAX_BINS] = {0};
+	double buf[STATS_CHUNK];
+
+	const size_t r0 = begin * t->unit_rows;
+	const size_t r1 = end * t->unit_rows < m->rows ? end * t->unit_rows : m->rows;
+	const unsigned char* src = NULL;
+	size_t n = 0;
+	if (m->csr) {
+		src = (const unsigned char*)(m->csr->vals + m->csr->row_ptr[r0]);
+		n = m->csr->row_ptr[r1] - m->csr->row_ptr[r0];
+	}
+	else {
+		src = (const unsigned char*)m->elems + r0 * m->cols * ops->size;
+		n = (r1 - r0) * m->cols;
+	}
+	for (size_t i = 0; i < n; i += STATS_CHUNK) {
+		const size_t len = n - i < STATS_CHUNK ? n - i : STATS_CHUNK;
+		ops->widen(buf, src + i * ops->size, len);
+		for (size_t k = 0; k < len; ++k) {
+			const double b = (buf[k] - t->lo) * t->scale;
+			/* max lands past the last bin, NaN nowhere in particular */
+			counts[b < t->bins ? (b > 0 ? (unsigned int)b : 0) : t->bins - 1]++;
+		}
+	}
+	for (unsigned int b = 0; b < t->bins; ++b) {
+		if (counts[b]) {
+			__atomic_fetch_add(&t->histogram[b], counts[b], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Task of stats_matrix_cols, walks stripes of STATS_COL_STRIPE
+ *  columns down the rows and keeps each column's statistics in arrays the
+ *  row loop updates in SIMD lanes
+ * INPUTS: Address of the Stats_task_t, first stripe, one past the last stripe
+ * RETURN: Nothing
+ **/
+
+static void stats_col_stripes (void* ctx, size_t begin, size_t end) {
+	Stats_task_t* t = ctx;
+	const Matrix_t* m = t->m;
+	const Matrix_type_ops_t* ops = &matrix_types[m->type];
+	double x[STATS_COL_STRIPE];
+	double mean[STATS_COL_STRIPE];
+	double m2[STATS_COL_STRIPE];
+	double lo[STATS_COL_STRIPE];
+	double hi[STATS_COL_STRIPE];
+	uint64_t nonzero[STATS_COL_STRIPE];
+
+	for (size_t s = begin; s < end; ++s) {
+		const size_t c0 = s * STATS_COL_STRIPE;
+		const size_t w = m->cols - c0 < STATS_COL_STRIPE ? m->cols - c0 : STATS_COL_STRIPE;
+		const unsigned char* row = (const unsigned char*)m->elems + c0 * ops->size;
+		ops->widen(lo, row, w);
+		memcpy(hi, lo, w * sizeof(double));
+		memset(mean, 0, sizeof(mean));
+		memset(m2, 0, sizeof(m2));
+		memset(nonzero, 0, sizeof(nonzero));
+		for (size_t r = 0; r < m->rows; ++r, row += m->cols * ops->size) {
+			ops->widen(x, row, w);
+			const double inv = 1.0 / (double)(r + 1);
+			for (size_t j = 0; j < w; ++j) {
+				const double delta = x[j] - mean[j];
+				mean[j] += delta * inv;
+				m2[j] += delta * (x[j] - mean[j]);
+				lo[j] = x[j] < lo[j] ? x[j] : lo[j];
+				hi[j] = x[j] > hi[j] ? x[j] : hi[j];
+				nonzero[j] += x[j] != 0;
+			}
+		}
+		for (size_t j = 0; j < w; ++j) {
+			t->units[c0 + j] = (Moments_t){.count = m->rows, .nonzero = nonzero[j], .min = lo[j],
+				.max = hi[j], .mean = mean[j], .m2 = m2[j]};
+		}
+	}
 }
@@ -1,27 +1,147 @@
 #ifndef _MATRIX_H_
 #define _MATRIX_H_
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #define MATRIX_NAME_LEN 25
 
+/* 
+ * The on-disk name field is padded to this many bytes so that the element
+ * payload lands on an unsigned int boundary and can be mapped in place.
+ */
+#define MATRIX_NAME_ALIGN 4
+
+/*
+ * Data block of a matrix that has been duplicated. Duplicates point at the
+ * same elements until one of them is written, which then takes a private
+ * copy (or the block back, if it is the last one using it).
+ */
+typedef struct {
+	unsigned int refs;
+	unsigned int *data;
+	size_t bytes;
+	void *map_base;
+	size_t map_len;
+}Matrix_storage_t;
+
+/*
+ * Compressed sparse row form of a matrix that is mostly zeros. The non-zero
+ * elements of row i are vals[row_ptr[i]] up to vals[row_ptr[i + 1]], at
+ * columns col_idx[...] in increasing order. Zeros are never stored.
+ */
+typedef struct {
+	size_t nnz;
+	size_t cap; /* elements col_idx and vals have room for */
+	size_t *row_ptr; /* rows + 1 offsets */
+	unsigned int *col_idx;
+	unsigned int *vals;
+}Matrix_csr_t;
+
+/*
+ * Element types. MATRIX_U32 is 0 so zeroed headers are u32, and it is the
+ * only type stored sparse; the operations for each type are in matrix_types.h.
+ */
+typedef enum {
+	MATRIX_U32,
+	MATRIX_U8,
+	MATRIX_U16,
+	MATRIX_U64,
+	MATRIX_F32,
+	MATRIX_F64,
+	MATRIX_TYPE_COUNT
+}Matrix_type_t;
+
 typedef struct {
 	char name[MATRIX_NAME_LEN];
 	unsigned int rows;
 	unsigned int cols;
-	unsigned int *data;
+	Matrix_type_t type;
+	union {
+		unsigned int *data; /* elements of a MATRIX_U32 matrix */
+		void *elems; /* elements of any type */
+	};
+	void *map_base; /* non-NULL when data points into a private file mapping */
+	size_t map_len;
+	Matrix_storage_t *shared; /* non-NULL while data is shared, the block then owns data and the mapping */
+	Matrix_csr_t *csr; /* non-NULL while the matrix is stored sparse, data is then NULL */
+	uint64_t hash; /* content hash, valid until the next write */
+	bool hash_valid;
 }Matrix_t;
 
+/* flags for write_matrix_ex */
+#define WRITE_MATRIX_DEFAULT 0
+#define WRITE_MATRIX_FSYNC 1
+#define WRITE_MATRIX_DIRECT 2
+#define WRITE_MATRIX_COMPRESS 4
+/* for a fresh file nothing else can have open or mapped, e.g. a memfd */
+#define WRITE_MATRIX_IN_PLACE 8
+
+/* most bytes write_all hands one system call; Linux moves at most about 2 GB per read or write */
+#define MATRIX_IO_CHUNK (1ul << 30)
+
+typedef struct {
+	uint64_t bytes;
+	uint64_t nanoseconds;
+	uint64_t files;
+}Matrix_io_stats_t;
+
+/* most histogram bins stats_matrix fills */
+#define MATRIX_STATS_MAX_BINS 1024
+
+/* descriptive statistics of a matrix, one of its rows or one of its columns */
+typedef struct {
+	uint64_t count;
+	uint64_t nonzero;
+	double min;
+	double max;
+	double mean;
+	double variance; /* population variance */
+	unsigned __int128 sum; /* exact sum of an integer type, 0 for floating point types and columns */
+}Matrix_stats_t;
+
+struct iovec;
+
 bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows, const unsigned int cols);
+bool create_matrix_uninit (Matrix_t** new_matrix, const char* name, const unsigned int rows, const unsigned int cols);
+bool create_matrix_typed (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+			const unsigned int cols, Matrix_type_t type, bool zero);
+bool create_matrix_copy (Matrix_t** new_matrix, const char* name, Matrix_t* src);
+bool unshare_matrix (Matrix_t* m, bool keep_data);
 void destroy_matrix (Matrix_t** m); 
+size_t matrix_data_bytes (const Matrix_t* m);
+bool matrix_size_bytes (unsigned int rows, unsigned int cols, size_t elem_size, size_t* bytes);
 bool write_matrix (const char* matrix_output_filename, Matrix_t* m);
+bool write_matrix_ex (const char* matrix_output_filename, Matrix_t* m, unsigned int flags);
+bool write_all (int fd, struct iovec* iov, int iovcnt);
+void get_matrix_write_stats (Matrix_io_stats_t* stats);
+double matrix_write_bytes_per_sec (void);
 bool read_matrix (const char* matrix_input_filename, Matrix_t** m);
-int sum_matrix (Matrix_t* m);
+bool read_matrix_mmap (const char* matrix_input_filename, Matrix_t** m);
+bool read_matrix_name (const char* matrix_input_filename, char* name);
+bool sum_matrix (Matrix_t* m, unsigned __int128* sum);
+bool sum_matrix_real (Matrix_t* m, double* sum);
+bool sum_matrix_rows (Matrix_t* m, uint64_t* sums);
+bool sum_matrix_cols (Matrix_t* m, uint64_t* sums);
+bool stats_matrix (Matrix_t* m, unsigned int bins, uint64_t* histogram, Matrix_stats_t* stats);
+bool stats_matrix_rows (Matrix_t* m, Matrix_stats_t* stats);
+bool stats_matrix_cols (Matrix_t* m, Matrix_stats_t* stats);
 bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c); 
+bool multiply_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c);
+bool transpose_matrix (Matrix_t* a, Matrix_t* c);
+bool reshape_matrix (Matrix_t* m, unsigned int rows, unsigned int cols);
 bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift);
 bool duplicate_matrix (Matrix_t* src, Matrix_t* dest);
 bool equal_matrices (Matrix_t* a, Matrix_t* b); 
-void display_matrix (Matrix_t* m); 
+bool equal_matrices_ex (Matrix_t* a, Matrix_t* b, size_t* first_diff);
+bool hash_matrix (Matrix_t* m, uint64_t* hash);
+void display_matrix (Matrix_t* m, FILE* out);
+void set_matrix_messages (FILE* out);
+FILE* matrix_messages (void);
+void matrix_perror (const char* msg);
 bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range);
-unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigned int num_mats);
 
 
 #endif
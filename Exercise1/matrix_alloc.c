@@ -0,0 +1,506 @@
+#define _GNU_SOURCE /* MADV_HUGEPAGE, MAP_HUGETLB */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "matrix.h"
+#include "matrix_alloc.h"
+#include "stats.h"
+
+/* small buffers come from size classes 64 B .. 64 KiB */
+#define SMALL_CLASS_MIN_SHIFT 6
+#define SMALL_CLASS_MAX_SHIFT 16
+#define NUM_SMALL_CLASSES (SMALL_CLASS_MAX_SHIFT - SMALL_CLASS_MIN_SHIFT + 1)
+/* freed small buffers kept per class */
+#define SMALL_CLASS_KEEP 256
+/* headers carved out of each slab */
+#define HEADERS_PER_SLAB 64
+/* freed large buffers kept for reuse, and the bytes they may hold in total */
+#define LARGE_CACHE_ENTRIES 16
+#define LARGE_CACHE_BYTES (512ull * 1024 * 1024)
+
+typedef struct Free_node {
+	struct Free_node* next;
+}Free_node_t;
+
+typedef struct {
+	void* data;
+	size_t bytes;
+}Large_entry_t;
+
+typedef struct Header_slab {
+	struct Header_slab* next;
+}Header_slab_t;
+
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static Matrix_alloc_stats_t alloc_stats;
+static const Matrix_allocator_t* current_allocator = &pooled_matrix_allocator;
+
+static Header_slab_t* header_slabs;
+static Free_node_t* free_headers;
+static Free_node_t* free_small[NUM_SMALL_CLASSES];
+static unsigned int free_small_count[NUM_SMALL_CLASSES];
+static Large_entry_t large_cache[LARGE_CACHE_ENTRIES];
+
+/* 
+ * PURPOSE: Size class index of a small buffer
+ * INPUTS: Requested bytes, at most 1 << SMALL_CLASS_MAX_SHIFT
+ * RETURN: Index into the free_small lists
+ **/
+
+static unsigned int small_class (size_t bytes) {
+	unsigned int shift = SMALL_CLASS_MIN_SHIFT;
+	while (((size_t)1 << shift) < bytes) {
+		++shift;
+	}
+	return shift - SMALL_CLASS_MIN_SHIFT;
+}
+
+/* 
+ * PURPOSE: Round a large request up to the granularity it is mapped with
+ * INPUTS: Requested bytes
+ * RETURN: Bytes actually reserved
+ **/
+
+static size_t large_size (size_t bytes) {
+	const size_t granule = bytes >= MATRIX_HUGE_BYTES ? MATRIX_HUGE_BYTES : MATRIX_ALLOC_ALIGN;
+	return (bytes + granule - 1) / granule * granule;
+}
+
+/* 
+ * PURPOSE: Map a zeroed huge page backed buffer. Very large buffers try the
+ *  reserved 2 MiB hugetlbfs pages first; the pool is usually empty, so the
+ *  usual result is an anonymous mapping advised to use transparent huge pages
+ * INPUTS: Bytes, a multiple of MATRIX_HUGE_BYTES
+ * RETURN: Buffer, MAP_FAILED if out of memory
+ **/
+
+static void* map_huge (size_t bytes) {
+	void* data = MAP_FAILED;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+	if (bytes >= MATRIX_HUGETLB_BYTES) {
+		data = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+		if (data != MAP_FAILED) {
+			return data;
+		}
+	}
+#endif
+	data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+	if (data != MAP_FAILED) {
+		madvise(data, bytes, MADV_HUGEPAGE);
+	}
+#endif
+	return data;
+}
+
+/* 
+ * PURPOSE: Allocate a Matrix_t sized header from the slabs
+ * INPUTS: Size of the header, must not exceed sizeof(Matrix_t)
+ * RETURN: Zeroed header, NULL if out of memory
+ **/
+
+static void* pooled_alloc_header (size_t bytes) {
+	if (bytes > sizeof(Matrix_t)) return NULL;
+
+	pthread_mutex_lock(&alloc_lock);
+	if (free_headers == NULL) {
+		/* slab layout: link to the previous slab, then the headers */
+		const size_t stride = sizeof(Matrix_t);
+		Header_slab_t* slab = malloc(sizeof(Matrix_t) + stride * HEADERS_PER_SLAB);
+		if (!slab) {
+			pthread_mutex_unlock(&alloc_lock);
+			return NULL;
+		}
+		slab->next = header_slabs;
+		header_slabs = slab;
+		unsigned char* first = (unsigned char*)slab + sizeof(Matrix_t);
+		for (int i = HEADERS_PER_SLAB - 1; i >= 0; --i) {
+			Free_node_t* node = (Free_node_t*)(first + i * stride);
+			node->next = free_headers;
+			free_headers = node;
+		}
+	}
+	Free_node_t* header = free_headers;
+	free_headers = header->next;
+	alloc_stats.header_allocs++;
+	pthread_mutex_unlock(&alloc_lock);
+
+	memset(header, 0, sizeof(Matrix_t));
+	return header;
+}
+
+/* 
+ * PURPOSE: Return a header to the slab free list
+ * INPUTS: Header from pooled_alloc_header, its size
+ * RETURN: Nothing
+ **/
+
+static void pooled_free_header (void* header, size_t bytes) {
+	if (header == NULL) return;
+
+	pthread_mutex_lock(&alloc_lock);
+	Free_node_t* node = header;
+	node->next = free_headers;
+	free_headers = node;
+	alloc_stats.header_frees++;
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+/* 
+ * PURPOSE: Allocate a data buffer, reusing a freed one of the same size class
+ *  or shape when possible
+ * INPUTS: Bytes needed, true if the buffer must be zeroed
+ * RETURN: MATRIX_ALLOC_ALIGN aligned buffer, NULL if out of memory
+ **/
+
+static void* pooled_alloc_data (size_t bytes, bool zero) {
+	if (bytes == 0) return NULL;
+
+	void* data = NULL;
+	bool fresh_zeroed = false;
+	pthread_mutex_lock(&alloc_lock);
+	if (bytes <= ((size_t)1 << SMALL_CLASS_MAX_SHIFT)) {
+		const unsigned int cls = small_class(bytes);
+		if (free_small[cls]) {
+			data = free_small[cls];
+			free_small[cls] = free_small[cls]->next;
+			free_small_count[cls]--;
+			alloc_stats.bytes_cached -= (size_t)1 << (cls + SMALL_CLASS_MIN_SHIFT);
+			alloc_stats.data_reuses++;
+		}
+		bytes = (size_t)1 << (cls + SMALL_CLASS_MIN_SHIFT);
+	}
+	else {
+		bytes = large_size(bytes);
+		for (unsigned int i = 0; i < LARGE_CACHE_ENTRIES; ++i) {
+			if (large_cache[i].data && large_cache[i].bytes == bytes) {
+				data = large_cache[i].data;
+				large_cache[i].data = NULL;
+				alloc_stats.bytes_cached -= bytes;
+				alloc_stats.data_reuses++;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&alloc_lock);
+
+	if (data == NULL) {
+		if (bytes >= MATRIX_HUGE_BYTES) {
+			data = map_huge(bytes);
+			if (data == MAP_FAILED) {
+				return NULL;
+			}
+			fresh_zeroed = true;
+		}
+		else if (posix_memalign(&data, MATRIX_ALLOC_ALIGN, bytes) != 0) {
+			return NULL;
+		}
+	}
+	if (zero && !fresh_zeroed) {
+		memset(data, 0, bytes);
+	}
+
+	pthread_mutex_lock(&alloc_lock);
+	alloc_stats.data_allocs++;
+	alloc_stats.bytes_in_use += bytes;
+	pthread_mutex_unlock(&alloc_lock);
+	return data;
+}
+
+/* 
+ * PURPOSE: Give a buffer back to the OS, matching how it was obtained
+ * INPUTS: Buffer, its rounded size
+ * RETURN: Nothing
+ **/
+
+static void release_data (void* data, size_t bytes) {
+	if (bytes >= MATRIX_HUGE_BYTES) {
+		munmap(data, bytes);
+	}
+	else {
+		free(data);
+	}
+}
+
+/* 
+ * PURPOSE: Free a data buffer, keeping it for reuse if the cache has room
+ * INPUTS: Buffer from pooled_alloc_data, the size it was requested with
+ * RETURN: Nothing
+ **/
+
+static void pooled_free_data (void* data, size_t bytes) {
+	if (data == NULL) return;
+
+	void* evicted = NULL;
+	size_t evicted_bytes = 0;
+	pthread_mutex_lock(&alloc_lock);
+	alloc_stats.data_frees++;
+	if (bytes <= ((size_t)1 << SMALL_CLASS_MAX_SHIFT)) {
+		const unsigned int cls = small_class(bytes);
+		bytes = (size_t)1 << (cls + SMALL_CLASS_MIN_SHIFT);
+		alloc_stats.bytes_in_use -= bytes;
+		if (free_small_count[cls] < SMALL_CLASS_KEEP) {
+			Free_node_t* node = data;
+			node->next = free_small[cls];
+			free_small[cls] = node;
+			free_small_count[cls]++;
+			alloc_stats.bytes_cached += bytes;
+			data = NULL;
+		}
+	}
+	else {
+		bytes = large_size(bytes);
+		alloc_stats.bytes_in_use -= bytes;
+		if (bytes <= LARGE_CACHE_BYTES / 2) {
+			/* take a free entry, or evict the largest one to bound the cache */
+			unsigned int slot = 0;
+			for (unsigned int i = 0; i < LARGE_CACHE_ENTRIES; ++i) {
+				if (large_cache[i].data == NULL) {
+					slot = i;
+					break;
+				}
+				if (large_cache[i].bytes > large_cache[slot].bytes) {
+					slot = i;
+				}
+			}
+			if (large_cache[slot].data) {
+				evicted = large_cache[slot].data;
+				evicted_bytes = large_cache[slot].bytes;
+				large_cache[slot].data = NULL;
+				alloc_stats.bytes_cached -= evicted_bytes;
+			}
+			if (alloc_stats.bytes_cached + bytes <= LARGE_CACHE_BYTES) {
+				large_cache[slot].data = data;
+				large_cache[slot].bytes = bytes;
+				alloc_stats.bytes_cached += bytes;
+				data = NULL;
+			}
+		}
+	}
+	pthread_mutex_unlock(&alloc_lock);
+
+	if (evicted) {
+		release_data(evicted, evicted_bytes);
+	}
+	if (data) {
+		release_data(data, bytes);
+	}
+}
+
+/* 
+ * PURPOSE: Return every cached buffer and header slab to the OS. Only safe
+ *  once no matrix allocated from the pool is alive.
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+static void pooled_release (void) {
+	pthread_mutex_lock(&alloc_lock);
+	for (unsigned int cls = 0; cls < NUM_SMALL_CLASSES; ++cls) {
+		while (free_small[cls]) {
+			Free_node_t* node = free_small[cls];
+			free_small[cls] = node->next;
+			free(node);
+		}
+		free_small_count[cls] = 0;
+	}
+	for (unsigned int i = 0; i < LARGE_CACHE_ENTRIES; ++i) {
+		if (large_cache[i].data) {
+			release_data(large_cache[i].data, large_cache[i].bytes);
+			large_cache[i].data = NULL;
+		}
+	}
+	alloc_stats.bytes_cached = 0;
+	if (alloc_stats.header_allocs == alloc_stats.header_frees) {
+		while (header_slabs) {
+			Header_slab_t* slab = header_slabs;
+			header_slabs = slab->next;
+			free(slab);
+		}
+		free_headers = NULL;
+	}
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+const Matrix_allocator_t pooled_matrix_allocator = {
+	"pooled", pooled_alloc_header, pooled_free_header,
+	pooled_alloc_data, pooled_free_data, pooled_release,
+};
+
+/* 
+ * PURPOSE: calloc based header allocation for the system allocator
+ * INPUTS: Size of the header
+ * RETURN: Zeroed header, NULL if out of memory
+ **/
+
+static void* system_alloc_header (size_t bytes) {
+	void* header = calloc(1, bytes);
+	if (header) {
+		pthread_mutex_lock(&alloc_lock);
+		alloc_stats.header_allocs++;
+		pthread_mutex_unlock(&alloc_lock);
+	}
+	return header;
+}
+
+/* 
+ * PURPOSE: free based header release for the system allocator
+ * INPUTS: Header, its size
+ * RETURN: Nothing
+ **/
+
+static void system_free_header (void* header, size_t bytes) {
+	if (header == NULL) return;
+
+	pthread_mutex_lock(&alloc_lock);
+	alloc_stats.header_frees++;
+	pthread_mutex_unlock(&alloc_lock);
+	free(header);
+}
+
+/* 
+ * PURPOSE: calloc/malloc based data allocation for the system allocator
+ * INPUTS: Bytes needed, true if the buffer must be zeroed
+ * RETURN: Buffer, NULL if out of memory
+ **/
+
+static void* system_alloc_data (size_t bytes, bool zero) {
+	void* data = zero ? calloc(1, bytes) : malloc(bytes);
+	if (data) {
+		pthread_mutex_lock(&alloc_lock);
+		alloc_stats.data_allocs++;
+		alloc_stats.bytes_in_use += bytes;
+		pthread_mutex_unlock(&alloc_lock);
+	}
+	return data;
+}
+
+/* 
+ * PURPOSE: free based data release for the system allocator
+ * INPUTS: Buffer, the size it was requested with
+ * RETURN: Nothing
+ **/
+
+static void system_free_data (void* data, size_t bytes) {
+	if (data == NULL) return;
+
+	pthread_mutex_lock(&alloc_lock);
+	alloc_stats.data_frees++;
+	alloc_stats.bytes_in_use -= bytes;
+	pthread_mutex_unlock(&alloc_lock);
+	free(data);
+}
+
+/* 
+ * PURPOSE: Nothing is cached by the system allocator
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+static void system_release (void) {
+}
+
+const Matrix_allocator_t system_matrix_allocator = {
+	"system", system_alloc_header, system_free_header,
+	system_alloc_data, system_free_data, system_release,
+};
+
+/* 
+ * PURPOSE: Switch the allocator used for new matrices. Must be called while
+ *  no matrix is alive, as buffers are freed through the allocator that is
+ *  current at destroy time.
+ * INPUTS: Address of the allocator
+ * RETURN: True if the allocator was installed, else false
+ **/
+
+bool set_matrix_allocator (const Matrix_allocator_t* allocator) {
+	if (allocator == NULL || !allocator->alloc_header || !allocator->free_header
+		|| !allocator->alloc_data || !allocator->free_data || !allocator->release) {
+		return false;
+	}
+	current_allocator = allocator;
+	return true;
+}
+
+/* 
+ * PURPOSE: Allocator currently used for matrices
+ * INPUTS: Nothing
+ * RETURN: Address of the allocator
+ **/
+
+const Matrix_allocator_t* get_matrix_allocator (void) {
+	return current_allocator;
+}
+
+/* 
+ * PURPOSE: Allocate a zeroed Matrix_t header
+ * INPUTS: Nothing
+ * RETURN: Address of the header, NULL if out of memory
+ **/
+
+void* matrix_alloc_header (void) {
+	return current_allocator->alloc_header(sizeof(Matrix_t));
+}
+
+/* 
+ * PURPOSE: Free a header from matrix_alloc_header
+ * INPUTS: Address of the header
+ * RETURN: Nothing
+ **/
+
+void matrix_free_header (void* header) {
+	current_allocator->free_header(header, sizeof(Matrix_t));
+}
+
+/* 
+ * PURPOSE: Allocate a matrix data buffer
+ * INPUTS: Bytes needed, true if the buffer must be zeroed
+ * RETURN: Address of the buffer, NULL if out of memory
+ **/
+
+void* matrix_alloc_data (size_t bytes, bool zero) {
+	STATS_SCOPE(scope, STAT_ALLOC);
+	scope.bytes = bytes;
+	return current_allocator->alloc_data(bytes, zero);
+}
+
+/* 
+ * PURPOSE: Free a buffer from matrix_alloc_data
+ * INPUTS: Address of the buffer, the size it was requested with
+ * RETURN: Nothing
+ **/
+
+void matrix_free_data (void* data, size_t bytes) {
+	current_allocator->free_data(data, bytes);
+}
+
+/* 
+ * PURPOSE: Snapshot of the allocation counters
+ * INPUTS: Address of the stats structure to fill
+ * RETURN: Nothing
+ **/
+
+void get_matrix_alloc_stats (Matrix_alloc_stats_t* stats) {
+	if (stats == NULL) return;
+
+	pthread_mutex_lock(&alloc_lock);
+	*stats = alloc_stats;
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+/* 
+ * PURPOSE: Drop everything the current allocator keeps cached
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+void release_matrix_allocator (void) {
+	current_allocator->release();
+}
@@ -0,0 +1,53 @@
+#ifndef _MATRIX_ALLOC_H_
+#define _MATRIX_ALLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Allocator layer behind create_matrix/destroy_matrix. The default pooled
+ * allocator keeps Matrix_t headers in slabs, serves small data buffers from
+ * power of two size classes, gives large buffers 64-byte aligned (and above
+ * MATRIX_HUGE_BYTES, huge page backed) memory, and keeps recently freed
+ * buffers of each size around so a matrix of the same shape can reuse them.
+ * Buffers of MATRIX_HUGETLB_BYTES and up come from the reserved hugetlbfs
+ * pool when it has room, and from transparent huge pages when it doesn't.
+ */
+
+#define MATRIX_ALLOC_ALIGN 64
+#define MATRIX_HUGE_BYTES (2u * 1024 * 1024)
+#define MATRIX_HUGETLB_BYTES (64u * 1024 * 1024)
+
+typedef struct {
+	uint64_t header_allocs;
+	uint64_t header_frees;
+	uint64_t data_allocs;
+	uint64_t data_frees;
+	uint64_t data_reuses; /* data_allocs served from a freed buffer */
+	uint64_t bytes_in_use;
+	uint64_t bytes_cached; /* freed but kept for reuse */
+}Matrix_alloc_stats_t;
+
+typedef struct {
+	const char* name;
+	void* (*alloc_header) (size_t bytes);
+	void (*free_header) (void* header, size_t bytes);
+	void* (*alloc_data) (size_t bytes, bool zero);
+	void (*free_data) (void* data, size_t bytes);
+	void (*release) (void);
+}Matrix_allocator_t;
+
+extern const Matrix_allocator_t pooled_matrix_allocator;
+extern const Matrix_allocator_t system_matrix_allocator;
+
+bool set_matrix_allocator (const Matrix_allocator_t* allocator);
+const Matrix_allocator_t* get_matrix_allocator (void);
+void* matrix_alloc_header (void);
+void matrix_free_header (void* header);
+void* matrix_alloc_data (size_t bytes, bool zero);
+void matrix_free_data (void* data, size_t bytes);
+void get_matrix_alloc_stats (Matrix_alloc_stats_t* stats);
+void release_matrix_allocator (void);
+
+#endif
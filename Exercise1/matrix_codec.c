@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix_codec.h"
+#include "matrix_kernels.h"
+#include "threadpool.h"
+
+/* blocks per parallel task, enough elements to cover the task overhead */
+#define PACK_GRAIN (PARALLEL_MIN_ELEMENTS / PACK_BLOCK)
+
+typedef struct {
+	const unsigned int* src;
+	unsigned int* dst;
+	size_t n;
+	unsigned int* refs;
+	unsigned char* widths;
+	uint32_t* words;
+	const size_t* offsets; /* first word of each block */
+}Pack_task_t;
+
+/* 
+ * PURPOSE: Copy a block that may be cut short by the end of the payload,
+ *  padding the missing elements with pad
+ * INPUTS: Destination block, payload, element count, block index, pad value
+ * RETURN: Nothing
+ **/
+
+static void load_block (unsigned int* block, const unsigned int* src, size_t n,
+			size_t b, unsigned int pad) {
+	const size_t first = b * PACK_BLOCK;
+	const size_t count = n - first < PACK_BLOCK ? n - first : PACK_BLOCK;
+	memcpy(block, src + first, count * sizeof(unsigned int));
+	for (size_t i = count; i < PACK_BLOCK; ++i) {
+		block[i] = pad;
+	}
+}
+
+/* 
+ * PURPOSE: Block task for pack_matrix_data, finds the smallest element of
+ *  each block and the bits its largest distance from it needs
+ * INPUTS: Address of the Pack_task_t, first block, one past the last block
+ * RETURN: Nothing
+ **/
+
+static void measure_blocks (void* ctx, size_t begin, size_t end) {
+	const Pack_task_t* task = ctx;
+	for (size_t b = begin; b < end; ++b) {
+		const size_t first = b * PACK_BLOCK;
+		const size_t last = task->n - first < PACK_BLOCK ? task->n : first + PACK_BLOCK;
+		unsigned int lo = task->src[first];
+		unsigned int hi = lo;
+		for (size_t i = first + 1; i < last; ++i) {
+			const unsigned int x = task->src[i];
+			lo = x < lo ? x : lo;
+			hi = x > hi ? x : hi;
+		}
+		task->refs[b] = lo;
+		task->widths[b] = hi == lo ? 0 : 32 - __builtin_clz(hi - lo);
+	}
+}
+
+/* 
+ * PURPOSE: Block task for pack_matrix_data, packs each block at its word
+ *  offset, padding a short last block with its reference
+ * INPUTS: Address of the Pack_task_t, first block, one past the last block
+ * RETURN: Nothing
+ **/
+
+static void pack_blocks (void* ctx, size_t begin, size_t end) {
+	const Pack_task_t* task = ctx;
+	unsigned int block[PACK_BLOCK] __attribute__((aligned(64)));
+	for (size_t b = begin; b < end; ++b) {
+		const unsigned int* src = task->src + b * PACK_BLOCK;
+		if (task->n - b * PACK_BLOCK < PACK_BLOCK) {
+			load_block(block, task->src, task->n, b, task->refs[b]);
+			src = block;
+		}
+		matrix_kernels.pack(task->words + task->offsets[b], src, task->refs[b], task->widths[b]);
+	}
+}
+
+/* 
+ * PURPOSE: Block task for unpack_matrix_data, decodes each block into the
+ *  destination, a short last block through a staging block
+ * INPUTS: Address of the Pack_task_t, first block, one past the last block
+ * RETURN: Nothing
+ **/
+
+static void unpack_blocks (void* ctx, size_t begin, size_t end) {
+	const Pack_task_t* task = ctx;
+	unsigned int block[PACK_BLOCK] __attribute__((aligned(64)));
+	for (size_t b = begin; b < end; ++b) {
+		const size_t first = b * PACK_BLOCK;
+		if (task->n - first >= PACK_BLOCK) {
+			matrix_kernels.unpack(task->dst + first, task->words + task->offsets[b],
+				task->refs[b], task->widths[b]);
+			continue;
+		}
+		matrix_kernels.unpack(block, task->words + task->offsets[b], task->refs[b], task->widths[b]);
+		memcpy(task->dst + first, block, (task->n - first) * sizeof(unsigned int));
+	}
+}
+
+/* 
+ * PURPOSE: Word offset of every block of a packed payload
+ * INPUTS: Bit widths, number of blocks, address to store the total word count
+ * RETURN: Array of num_blocks offsets the caller frees, NULL if out of memory
+ *  or a width is over 32
+ **/
+
+static size_t* block_offsets (const unsigned char* widths, size_t num_blocks, size_t* num_words) {
+	size_t* offsets = malloc((num_blocks ? num_blocks : 1) * sizeof(size_t));
+	if (!offsets) {
+		return NULL;
+	}
+	size_t total = 0;
+	for (size_t b = 0; b < num_blocks; ++b) {
+		if (widths[b] > 32) {
+			free(offsets);
+			return NULL;
+		}
+		offsets[b] = total;
+		total += PACK_WORDS(widths[b]);
+	}
+	*num_words = total;
+	return offsets;
+}
+
+/* 
+ * PURPOSE: Frame-of-reference pack a matrix payload, blocks in parallel
+ * INPUTS: Elements to pack, element count, address of the packed payload to
+ *  fill (free it with free_packed_data)
+ * RETURN: True if packed, false on bad arguments or out of memory
+ **/
+
+bool pack_matrix_data (const unsigned int* data, size_t n, Matrix_packed_t* packed) {
+	if (data == NULL || n == 0 || packed == NULL) return false;
+
+	*packed = (Matrix_packed_t){0};
+	packed->num_blocks = (n + PACK_BLOCK - 1) / PACK_BLOCK;
+	packed->refs = malloc(packed->num_blocks * sizeof(unsigned int));
+	packed->widths = malloc(packed->num_blocks);
+	if (!packed->refs || !packed->widths) {
+		free_packed_data(packed);
+		return false;
+	}
+
+	Pack_task_t task = {.src = data, .n = n, .refs = packed->refs, .widths = packed->widths};
+	parallel_for(packed->num_blocks, PACK_GRAIN, measure_blocks, &task);
+
+	size_t* offsets = block_offsets(packed->widths, packed->num_blocks, &packed->num_words);
+	packed->words = malloc((packed->num_words ? packed->num_words : 1) * sizeof(uint32_t));
+	if (!offsets || !packed->words) {
+		free(offsets);
+		free_packed_data(packed);
+		return false;
+	}
+	task.words = packed->words;
+	task.offsets = offsets;
+	parallel_for(packed->num_blocks, PACK_GRAIN, pack_blocks, &task);
+	free(offsets);
+	return true;
+}
+
+/* 
+ * PURPOSE: Decode a packed payload, blocks in parallel
+ * INPUTS: Destination for n elements, element count, address of the packed
+ *  payload, which may point into a read-only file mapping
+ * RETURN: True if decoded, false if the payload does not describe n elements
+ **/
+
+bool unpack_matrix_data (unsigned int* data, size_t n, const Matrix_packed_t* packed) {
+	if (data == NULL || packed == NULL) return false;
+
+	if (packed->num_blocks != (n + PACK_BLOCK - 1) / PACK_BLOCK) {
+		return false;
+	}
+	size_t num_words = 0;
+	size_t* offsets = block_offsets(packed->widths, packed->num_blocks, &num_words);
+	if (!offsets || num_words != packed->num_words) {
+		free(offsets);
+		return false;
+	}
+	Pack_task_t task = {.dst = data, .n = n, .refs = packed->refs, .widths = packed->widths,
+		.words = packed->words, .offsets = offsets};
+	parallel_for(packed->num_blocks, PACK_GRAIN, unpack_blocks, &task);
+	free(offsets);
+	return true;
+}
+
+/* 
+ * PURPOSE: Free the buffers of a payload filled by pack_matrix_data
+ * INPUTS: Address of the packed payload
+ * RETURN: Nothing
+ **/
+
+void free_packed_data (Matrix_packed_t* packed) {
+	if (packed == NULL) return;
+
+	free(packed->refs);
+	free(packed->widths);
+	free(packed->words);
+	*packed = (Matrix_packed_t){0};
+}
@@ -0,0 +1,30 @@
+#ifndef _MATRIX_CODEC_H_
+#define _MATRIX_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* first unsigned int of a packed matrix file, "MATZ" in little-endian order */
+#define MATRIX_PACKED_MAGIC 0x5A54414Du
+#define MATRIX_PACKED_VERSION 1
+
+/*
+ * A matrix payload split into PACK_BLOCK element blocks, each stored as its
+ * minimum (the reference) and the bit width of its largest offset from it.
+ * The words of every block follow each other in block order.
+ */
+typedef struct {
+	size_t num_blocks;
+	unsigned int* refs;
+	unsigned char* widths;
+	uint32_t* words;
+	size_t num_words;
+}Matrix_packed_t;
+
+bool pack_matrix_data (const unsigned int* data, size_t n, Matrix_packed_t* packed);
+bool unpack_matrix_data (unsigned int* data, size_t n, const Matrix_packed_t* packed);
+void free_packed_data (Matrix_packed_t* packed);
+
+#endif
@@ -0,0 +1,651 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATRIX_KERNELS_X86
+#endif
+
+#include "matrix_kernels.h"
+
+/*
+ * Shifts of 32 or more bits are undefined in C but well defined (zero) for
+ * the SIMD shift instructions, so every implementation clamps to zero.
+ */
+#define MAX_SHIFT (sizeof(unsigned int) * 8)
+
+/* 
+ * PURPOSE: Scalar fallback for dst = a + b over n elements
+ * INPUTS: Destination buffer, two source buffers, number of elements
+ * RETURN: Nothing
+ **/
+
+static void add_scalar (unsigned int* dst, const unsigned int* a,
+			const unsigned int* b, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = a[i] + b[i];
+	}
+}
+
+/* 
+ * PURPOSE: Scalar fallback for dst = src << shift over n elements
+ * INPUTS: Destination buffer, source buffer (may alias dst), number of elements, bits to shift
+ * RETURN: Nothing
+ **/
+
+static void shift_left_scalar (unsigned int* dst, const unsigned int* src,
+			size_t n, unsigned int shift) {
+	if (shift >= MAX_SHIFT) {
+		memset(dst, 0, n * sizeof(unsigned int));
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = src[i] << shift;
+	}
+}
+
+/* 
+ * PURPOSE: Scalar fallback for dst = src >> shift over n elements
+ * INPUTS: Destination buffer, source buffer (may alias dst), number of elements, bits to shift
+ * RETURN: Nothing
+ **/
+
+static void shift_right_scalar (unsigned int* dst, const unsigned int* src,
+			size_t n, unsigned int shift) {
+	if (shift >= MAX_SHIFT) {
+		memset(dst, 0, n * sizeof(unsigned int));
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = src[i] >> shift;
+	}
+}
+
+#ifdef MATRIX_KERNELS_X86
+
+/*
+ * The vector kernels below are all built from one template per operation so
+ * that the SSE2, AVX2 and AVX-512 variants cannot drift apart. Loads and
+ * stores are unaligned because matrices mapped from disk are not guaranteed
+ * to start on a vector boundary; the tail falls back to the scalar loop.
+ */
+
+#define DEFINE_ADD_KERNEL(suffix, isa, vec_t, width, load, store, add)	\
+__attribute__((target(isa)))  						\
+static void add_##suffix (unsigned int* dst, const unsigned int* a,		\
+			const unsigned int* b, size_t n) {			\
+	size_t i = 0;								\
+	for (; i + 4 * width <= n; i += 4 * width) {				\
+		vec_t x0 = add(load((const vec_t*)(a + i)), load((const vec_t*)(b + i)));		\
+		vec_t x1 = add(load((const vec_t*)(a + i + width)), load((const vec_t*)(b + i + width)));	\
+		vec_t x2 = add(load((const vec_t*)(a + i + 2 * width)), load((const vec_t*)(b + i + 2 * width)));	\
+		vec_t x3 = add(load((const vec_t*)(a + i + 3 * width)), load((const vec_t*)(b + i + 3 * width)));	\
+		store((vec_t*)(dst + i), x0);					\
+		store((vec_t*)(dst + i + width), x1);				\
+		store((vec_t*)(dst + i + 2 * width), x2);			\
+		store((vec_t*)(dst + i + 3 * width), x3);			\
+	}									\
+	for (; i + width <= n; i += width) {					\
+		store((vec_t*)(dst + i), add(load((const vec_t*)(a + i)), load((const vec_t*)(b + i))));	\
+	}									\
+	add_scalar(dst + i, a + i, b + i, n - i);				\
+}
+
+#define DEFINE_SHIFT_KERNEL(name, scalar, isa, vec_t, width, load, store, shift_op)	\
+__attribute__((target(isa)))  						\
+static void name (unsigned int* dst, const unsigned int* src,			\
+			size_t n, unsigned int shift) {				\
+	if (shift >= MAX_SHIFT) {						\
+		memset(dst, 0, n * sizeof(unsigned int));			\
+		return;								\
+	}									\
+	const __m128i count = _mm_cvtsi32_si128((int)shift);			\
+	size_t i = 0;								\
+	for (; i + 4 * width <= n; i += 4 * width) {				\
+		vec_t x0 = shift_op(load((const vec_t*)(src + i)), count);		\
+		vec_t x1 = shift_op(load((const vec_t*)(src + i + width)), count);	\
+		vec_t x2 = shift_op(load((const vec_t*)(src + i + 2 * width)), count);	\
+		vec_t x3 = shift_op(load((const vec_t*)(src + i + 3 * width)), count);	\
+		store((vec_t*)(dst + i), x0);					\
+		store((vec_t*)(dst + i + width), x1);				\
+		store((vec_t*)(dst + i + 2 * width), x2);			\
+		store((vec_t*)(dst + i + 3 * width), x3);			\
+	}									\
+	for (; i + width <= n; i += width) {					\
+		store((vec_t*)(dst + i), shift_op(load((const vec_t*)(src + i)), count));	\
+	}									\
+	scalar(dst + i, src + i, n - i, shift);					\
+}
+
+DEFINE_ADD_KERNEL(sse2, "sse2", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi32)
+DEFINE_SHIFT_KERNEL(shift_left_sse2, shift_left_scalar, "sse2", __m128i, 4,
+		_mm_loadu_si128, _mm_storeu_si128, _mm_sll_epi32)
+DEFINE_SHIFT_KERNEL(shift_right_sse2, shift_right_scalar, "sse2", __m128i, 4,
+		_mm_loadu_si128, _mm_storeu_si128, _mm_srl_epi32)
+
+DEFINE_ADD_KERNEL(avx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi32)
+DEFINE_SHIFT_KERNEL(shift_left_avx2, shift_left_scalar, "avx2", __m256i, 8,
+		_mm256_loadu_si256, _mm256_storeu_si256, _mm256_sll_epi32)
+DEFINE_SHIFT_KERNEL(shift_right_avx2, shift_right_scalar, "avx2", __m256i, 8,
+		_mm256_loadu_si256, _mm256_storeu_si256, _mm256_srl_epi32)
+
+DEFINE_ADD_KERNEL(avx512, "avx512f", __m512i, 16, _mm512_loadu_si512, _mm512_storeu_si512, _mm512_add_epi32)
+DEFINE_SHIFT_KERNEL(shift_left_avx512, shift_left_scalar, "avx512f", __m512i, 16,
+		_mm512_loadu_si512, _mm512_storeu_si512, _mm512_sll_epi32)
+DEFINE_SHIFT_KERNEL(shift_right_avx512, shift_right_scalar, "avx512f", __m512i, 16,
+		_mm512_loadu_si512, _mm512_storeu_si512, _mm512_srl_epi32)
+
+#endif
+
+/*
+ * Multiply micro-kernel, written once with GCC vector extensions and built
+ * for each instruction set. A GEMM_NR wide row of B is one 512-bit vector
+ * (two AVX2 or four SSE2 registers), so the GEMM_MR accumulators stay in
+ * registers for the whole k loop. Arithmetic wraps modulo 2^32 like
+ * add_matrices.
+ */
+
+typedef unsigned int gemm_row_t __attribute__((vector_size(GEMM_NR * sizeof(unsigned int))));
+
+#define DEFINE_GEMM_KERNEL(suffix, attrs)					\
+attrs									\
+static void gemm_##suffix (size_t kc, const unsigned int* a_panel,		\
+			const unsigned int* b_panel, unsigned int* c, size_t ldc,	\
+			size_t rows, size_t cols) {				\
+	gemm_row_t acc[GEMM_MR];						\
+	memset(acc, 0, sizeof(acc));						\
+	for (size_t p = 0; p < kc; ++p) {					\
+		gemm_row_t b;							\
+		memcpy(&b, b_panel + p * GEMM_NR, sizeof(b));			\
+		const unsigned int* a = a_panel + p * GEMM_MR;			\
+		for (size_t r = 0; r < GEMM_MR; ++r) {				\
+			acc[r] += a[r] * b;					\
+		}								\
+	}									\
+	if (rows == GEMM_MR && cols == GEMM_NR) {				\
+		for (size_t r = 0; r < GEMM_MR; ++r) {				\
+			gemm_row_t row;						\
+			memcpy(&row, c + r * ldc, sizeof(row));			\
+			row += acc[r];						\
+			memcpy(c + r * ldc, &row, sizeof(row));			\
+		}								\
+		return;								\
+	}									\
+	for (size_t r = 0; r < rows; ++r) {					\
+		for (size_t j = 0; j < cols; ++j) {				\
+			c[r * ldc + j] += acc[r][j];				\
+		}								\
+	}									\
+}
+
+DEFINE_GEMM_KERNEL(scalar, )
+#ifdef MATRIX_KERNELS_X86
+DEFINE_GEMM_KERNEL(sse2, __attribute__((target("sse2"))))
+DEFINE_GEMM_KERNEL(avx2, __attribute__((target("avx2"))))
+DEFINE_GEMM_KERNEL(avx512, __attribute__((target("avx512f"))))
+#endif
+
+/*
+ * Content hash in the style of xxHash32: HASH_LANES independent 32-bit
+ * accumulators, one per vector lane, each a multiply-rotate-multiply chain
+ * over every HASH_LANES-th element, then folded to 64 bits and avalanched.
+ * Written once with vector extensions like the multiply kernel, so every
+ * instruction set computes the identical value.
+ */
+
+#define HASH_LANES 16
+#define HASH_PRIME1 0x9E3779B1u
+#define HASH_PRIME2 0x85EBCA77u
+
+typedef uint32_t hash_vec_t __attribute__((vector_size(HASH_LANES * sizeof(uint32_t))));
+
+/* 
+ * PURPOSE: Mix the tail into the lanes, fold them and avalanche
+ * INPUTS: Lane accumulators, tail elements, tail length, total length, seed
+ * RETURN: The hash
+ **/
+
+static uint64_t hash_finish (uint32_t* lanes, const unsigned int* tail, size_t rem,
+			size_t n, uint64_t seed) {
+	for (size_t j = 0; j < rem; ++j) {
+		uint32_t acc = lanes[j] + tail[j] * HASH_PRIME2;
+		lanes[j] = ((acc << 13) | (acc >> 19)) * HASH_PRIME1;
+	}
+	uint64_t h = seed ^ ((uint64_t)n * 0x9E3779B97F4A7C15ull);
+	for (size_t j = 0; j < HASH_LANES; ++j) {
+		h = (h ^ lanes[j]) * 0xBF58476D1CE4E5B9ull;
+		h ^= h >> 31;
+	}
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ull;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBull;
+	return h ^ (h >> 31);
+}
+
+#define DEFINE_HASH_KERNEL(suffix, attrs)					\
+attrs									\
+static uint64_t hash_##suffix (const unsigned int* data, size_t n, uint64_t seed) {	\
+	hash_vec_t acc;								\
+	for (size_t j = 0; j < HASH_LANES; ++j) {				\
+		acc[j] = (uint32_t)seed + (uint32_t)(seed >> 32) + (j + 1) * HASH_PRIME1;	\
+	}									\
+	size_t i = 0;								\
+	for (; i + HASH_LANES <= n; i += HASH_LANES) {				\
+		hash_vec_t x;							\
+		memcpy(&x, data + i, sizeof(x));				\
+		acc += x * HASH_PRIME2;						\
+		acc = (acc << 13) | (acc >> 19);				\
+		acc *= HASH_PRIME1;						\
+	}									\
+	uint32_t lanes[HASH_LANES];						\
+	memcpy(lanes, &acc, sizeof(lanes));					\
+	return hash_finish(lanes, data + i, n - i, n, seed);			\
+}
+
+DEFINE_HASH_KERNEL(scalar, )
+#ifdef MATRIX_KERNELS_X86
+DEFINE_HASH_KERNEL(sse2, __attribute__((target("sse2"))))
+DEFINE_HASH_KERNEL(avx2, __attribute__((target("avx2"))))
+DEFINE_HASH_KERNEL(avx512, __attribute__((target("avx512f"))))
+#endif
+
+/*
+ * Reductions, again one vector extension template per instruction set, with
+ * the lane count matched to the register width. sum reads pairs of elements
+ * as 64-bit lanes and adds the low and high halves to separate accumulators,
+ * which widens without any shuffles; sum_cols has to keep columns in order
+ * and widens with a conversion instead.
+ */
+
+#define DEFINE_SUM_KERNELS(suffix, attrs, lanes)				\
+typedef uint64_t sum_vec_##suffix##_t __attribute__((vector_size(lanes * sizeof(uint64_t))));	\
+typedef uint32_t sum_in_##suffix##_t __attribute__((vector_size(lanes * sizeof(uint32_t))));	\
+									\
+attrs									\
+static uint64_t sum_##suffix (const unsigned int* data, size_t n) {	\
+	const sum_vec_##suffix##_t low = (sum_vec_##suffix##_t){0} + 0xFFFFFFFFull;	\
+	sum_vec_##suffix##_t acc0 = {0}, acc1 = {0}, acc2 = {0}, acc3 = {0};	\
+	sum_vec_##suffix##_t x0, x1;						\
+	size_t i = 0;								\
+	for (; i + 4 * lanes <= n; i += 4 * lanes) {				\
+		memcpy(&x0, data + i, sizeof(x0));				\
+		memcpy(&x1, data + i + 2 * lanes, sizeof(x1));			\
+		acc0 += x0 & low;						\
+		acc1 += x0 >> 32;						\
+		acc2 += x1 & low;						\
+		acc3 += x1 >> 32;						\
+	}									\
+	acc0 += acc1 + acc2 + acc3;						\
+	uint64_t total = 0;							\
+	for (size_t j = 0; j < lanes; ++j) {					\
+		total += acc0[j];						\
+	}									\
+	for (; i < n; ++i) {							\
+		total += data[i];						\
+	}									\
+	return total;								\
+}									\
+									\
+attrs									\
+static void sum_cols_##suffix (uint64_t* acc, const unsigned int* row, size_t n) {	\
+	size_t i = 0;								\
+	for (; i + lanes <= n; i += lanes) {					\
+		sum_in_##suffix##_t x;						\
+		sum_vec_##suffix##_t a;						\
+		memcpy(&x, row + i, sizeof(x));					\
+		memcpy(&a, acc + i, sizeof(a));					\
+		a += __builtin_convertvector(x, sum_vec_##suffix##_t);		\
+		memcpy(acc + i, &a, sizeof(a));					\
+	}									\
+	for (; i < n; ++i) {							\
+		acc[i] += row[i];						\
+	}									\
+}
+
+DEFINE_SUM_KERNELS(scalar, , 2)
+#ifdef MATRIX_KERNELS_X86
+DEFINE_SUM_KERNELS(sse2, __attribute__((target("sse2"))), 2)
+DEFINE_SUM_KERNELS(avx2, __attribute__((target("avx2"))), 4)
+DEFINE_SUM_KERNELS(avx512, __attribute__((target("avx512f"))), 8)
+#endif
+
+#define DEFINE_NONZERO_KERNEL(suffix, attrs, lanes)			\
+typedef uint32_t nonzero_vec_##suffix##_t __attribute__((vector_size(lanes * sizeof(uint32_t))));	\
+									\
+attrs									\
+static size_t nonzero_##suffix (const unsigned int* data, size_t n) {	\
+	nonzero_vec_##suffix##_t acc0 = {0}, acc1 = {0};			\
+	nonzero_vec_##suffix##_t x0, x1;					\
+	size_t i = 0;								\
+	/* a true compare is all ones, subtracting it counts one */		\
+	for (; i + 2 * lanes <= n; i += 2 * lanes) {				\
+		memcpy(&x0, data + i, sizeof(x0));				\
+		memcpy(&x1, data + i + lanes, sizeof(x1));			\
+		acc0 -= (nonzero_vec_##suffix##_t)(x0 != 0);			\
+		acc1 -= (nonzero_vec_##suffix##_t)(x1 != 0);			\
+	}									\
+	acc0 += acc1;								\
+	size_t count = 0;							\
+	for (size_t j = 0; j < lanes; ++j) {					\
+		count += acc0[j];						\
+	}									\
+	for (; i < n; ++i) {							\
+		count += data[i] != 0;						\
+	}									\
+	return count;								\
+}
+
+DEFINE_NONZERO_KERNEL(scalar, , 4)
+#ifdef MATRIX_KERNELS_X86
+DEFINE_NONZERO_KERNEL(sse2, __attribute__((target("sse2"))), 4)
+DEFINE_NONZERO_KERNEL(avx2, __attribute__((target("avx2"))), 8)
+DEFINE_NONZERO_KERNEL(avx512, __attribute__((target("avx512f"))), 16)
+#endif
+
+/*
+ * The first pass of moments sums pairs of elements as 64-bit lanes like sum
+ * does. The second converts to double through signed 32-bit lanes, which
+ * every instruction set converts directly: x ^ 2^31 reads as x - 2^31. The
+ * deviation is taken from the integer pivot sum / n first, which with the
+ * 2^31 is exactly representable, and then from the fraction (sum % n) / n,
+ * so no bits of the mean are lost to the 2^31.
+ */
+
+#define DEFINE_MOMENTS_KERNEL(suffix, attrs, lanes)			\
+typedef uint32_t mo_vec_##suffix##_t __attribute__((vector_size((lanes) * sizeof(uint32_t))));	\
+typedef int32_t mo_ivec_##suffix##_t __attribute__((vector_size((lanes) * sizeof(int32_t))));	\
+typedef uint64_t mo_wide_##suffix##_t __attribute__((vector_size((lanes) / 2 * sizeof(uint64_t))));	\
+typedef double mo_real_##suffix##_t __attribute__((vector_size((lanes) * sizeof(double))));	\
+									\
+attrs									\
+static void moments_##suffix (const unsigned int* data, size_t n, Kernel_moments_t* out) {	\
+	const mo_wide_##suffix##_t low = (mo_wide_##suffix##_t){0} + 0xFFFFFFFFull;	\
+	mo_vec_##suffix##_t lo = (mo_vec_##suffix##_t){0} + data[0];		\
+	mo_vec_##suffix##_t hi = lo;						\
+	mo_vec_##suffix##_t nonzero = {0};					\
+	mo_wide_##suffix##_t acc0 = {0}, acc1 = {0};				\
+	size_t i = 0;								\
+	for (; i + (lanes) <= n; i += (lanes)) {				\
+		mo_vec_##suffix##_t x;						\
+		mo_wide_##suffix##_t w;						\
+		memcpy(&x, data + i, sizeof(x));				\
+		memcpy(&w, data + i, sizeof(w));				\
+		const mo_vec_##suffix##_t below = (mo_vec_##suffix##_t)(x < lo);	\
+		const mo_vec_##suffix##_t above = (mo_vec_##suffix##_t)(x > hi);	\
+		lo = (x & below) | (lo & ~below);				\
+		hi = (x & above) | (hi & ~above);				\
+		nonzero -= (mo_vec_##suffix##_t)(x != 0);			\
+		acc0 += w & low;						\
+		acc1 += w >> 32;						\
+	}									\
+	acc0 += acc1;								\
+	uint32_t min = data[0], max = data[0];					\
+	uint64_t nz = 0, sum = 0;						\
+	for (size_t j = 0; j < (lanes); ++j) {					\
+		min = lo[j] < min ? lo[j] : min;				\
+		max = hi[j] > max ? hi[j] : max;				\
+		nz += nonzero[j];						\
+	}									\
+	for (size_t j = 0; j < (lanes) / 2; ++j) {				\
+		sum += acc0[j];							\
+	}									\
+	for (size_t k = i; k < n; ++k) {					\
+		min = data[k] < min ? data[k] : min;				\
+		max = data[k] > max ? data[k] : max;				\
+		nz += data[k] != 0;						\
+		sum += data[k];							\
+	}									\
+									\
+	const uint64_t pivot = sum / n;						\
+	const double base = (double)pivot - 2147483648.0;			\
+	const double frac = (double)(sum - pivot * n) / n;			\
+	const mo_vec_##suffix##_t flip = (mo_vec_##suffix##_t){0} + 0x80000000u;	\
+	mo_real_##suffix##_t dev = {0};						\
+	for (i = 0; i + (lanes) <= n; i += (lanes)) {				\
+		mo_vec_##suffix##_t x;						\
+		memcpy(&x, data + i, sizeof(x));				\
+		mo_real_##suffix##_t d = __builtin_convertvector((mo_ivec_##suffix##_t)(x ^ flip),	\
+			mo_real_##suffix##_t) - base - frac;			\
+		dev += d * d;							\
+	}									\
+	double m2 = 0.0;							\
+	for (size_t j = 0; j < (lanes); ++j) {					\
+		m2 += dev[j];							\
+	}									\
+	for (; i < n; ++i) {							\
+		const double d = ((double)data[i] - pivot) - frac;		\
+		m2 += d * d;							\
+	}									\
+	*out = (Kernel_moments_t){.min = min, .max = max, .nonzero = nz, .sum = sum, .m2 = m2};	\
+}
+
+DEFINE_MOMENTS_KERNEL(scalar, , 4)
+#ifdef MATRIX_KERNELS_X86
+DEFINE_MOMENTS_KERNEL(sse2, __attribute__((target("sse2"))), 4)
+DEFINE_MOMENTS_KERNEL(avx2, __attribute__((target("avx2"))), 8)
+DEFINE_MOMENTS_KERNEL(avx512, __attribute__((target("avx512f"))), 16)
+#endif
+
+/*
+ * Bit-packing. Row j of a block (elements j * PACK_LANES onwards) starts at
+ * bit j * width of every lane, so the word and shift are the same for all
+ * lanes and each row is a couple of whole-vector shifts, ors and masks.
+ */
+
+#define PACK_ROWS (PACK_BLOCK / PACK_LANES)
+
+/* each row is processed as PACK_LANES / lanes vectors of the ISA's width */
+#define DEFINE_PACK_KERNELS(suffix, attrs, lanes)				\
+typedef uint32_t pack_vec_##suffix##_t						\
+	__attribute__((vector_size((lanes) * sizeof(uint32_t))));		\
+									\
+attrs									\
+static void pack_##suffix (uint32_t* words, const unsigned int* src,	\
+			unsigned int ref, unsigned int width) {			\
+	memset(words, 0, PACK_WORDS(width) * sizeof(uint32_t));		\
+	if (width == 0) {							\
+		return;								\
+	}									\
+	for (size_t j = 0; j < PACK_ROWS; ++j) {				\
+		const size_t bit = j * width;					\
+		const unsigned int s = bit % 32;				\
+		uint32_t* w = words + bit / 32 * PACK_LANES;			\
+		for (size_t l = 0; l < PACK_LANES; l += (lanes)) {		\
+			pack_vec_##suffix##_t v;				\
+			pack_vec_##suffix##_t lo;				\
+			memcpy(&v, src + j * PACK_LANES + l, sizeof(v));	\
+			memcpy(&lo, w + l, sizeof(lo));				\
+			v -= ref;						\
+			lo |= v << s;						\
+			memcpy(w + l, &lo, sizeof(lo));				\
+			if (s + width > 32) {					\
+				pack_vec_##suffix##_t hi;			\
+				memcpy(&hi, w + PACK_LANES + l, sizeof(hi));	\
+				hi |= v >> (32 - s);				\
+				memcpy(w + PACK_LANES + l, &hi, sizeof(hi));	\
+			}							\
+		}								\
+	}									\
+}									\
+									\
+attrs									\
+static void unpack_##suffix (unsigned int* dst, const uint32_t* words,	\
+			unsigned int ref, unsigned int width) {			\
+	const uint32_t mask = width >= 32 ? 0xFFFFFFFFu : (1u << width) - 1;	\
+	for (size_t j = 0; j < PACK_ROWS; ++j) {				\
+		const size_t bit = j * width;					\
+		const unsigned int s = bit % 32;				\
+		const uint32_t* w = words + bit / 32 * PACK_LANES;		\
+		for (size_t l = 0; l < PACK_LANES; l += (lanes)) {		\
+			pack_vec_##suffix##_t v = {0};				\
+			if (width != 0) {					\
+				memcpy(&v, w + l, sizeof(v));			\
+				v >>= s;					\
+				if (s + width > 32) {				\
+					pack_vec_##suffix##_t hi;		\
+					memcpy(&hi, w + PACK_LANES + l, sizeof(hi)); \
+					v |= hi << (32 - s);			\
+				}						\
+				v &= mask;					\
+			}							\
+			v += ref;						\
+			memcpy(dst + j * PACK_LANES + l, &v, sizeof(v));	\
+		}								\
+	}									\
+}
+
+DEFINE_PACK_KERNELS(scalar, , 4)
+#ifdef MATRIX_KERNELS_X86
+DEFINE_PACK_KERNELS(sse2, __attribute__((target("sse2"))), 4)
+DEFINE_PACK_KERNELS(avx2, __attribute__((target("avx2"))), 8)
+DEFINE_PACK_KERNELS(avx512, __attribute__((target("avx512f"))), 16)
+#endif
+
+/*
+ * Register transposes of lanes x lanes blocks. Stage h pairs rows r and r + h
+ * and swaps the h wide halves of every 2h wide group of lanes between them,
+ * which swaps bit h of the row and column index; after the log2(lanes)
+ * stages every element is at its transposed position. lo and hi pick lanes
+ * out of the concatenation of the two rows for __builtin_shuffle.
+ */
+#define TRANSPOSE_LO(l, h, j) (((j) % (2 * (h)) < (h)) ? (j) : (l) + (j) - (h))
+#define TRANSPOSE_HI(l, h, j) (((j) % (2 * (h)) < (h)) ? (j) + (h) : (l) + (j))
+#define TRANSPOSE_LANES_4(f, l, h) f(l, h, 0), f(l, h, 1), f(l, h, 2), f(l, h, 3)
+#define TRANSPOSE_LANES_8(f, l, h) TRANSPOSE_LANES_4(f, l, h), f(l, h, 4), f(l, h, 5), f(l, h, 6), f(l, h, 7)
+#define TRANSPOSE_LANES_16(f, l, h) TRANSPOSE_LANES_8(f, l, h), f(l, h, 8), f(l, h, 9), f(l, h, 10),	\
+	f(l, h, 11), f(l, h, 12), f(l, h, 13), f(l, h, 14), f(l, h, 15)
+
+#define TRANSPOSE_STAGE(suffix, lanes, h)					\
+	if ((h) < (lanes)) {							\
+		const tr_mask_##suffix##_t lo = {TRANSPOSE_LANES_##lanes(TRANSPOSE_LO, lanes, h)};	\
+		const tr_mask_##suffix##_t hi = {TRANSPOSE_LANES_##lanes(TRANSPOSE_HI, lanes, h)};	\
+		_Pragma("GCC unroll 16")					\
+		for (size_t r = 0; r < (lanes); ++r) {				\
+			if (r & (h)) {						\
+				continue;					\
+			}							\
+			const tr_vec_##suffix##_t a = v[r];			\
+			v[r] = __builtin_shuffle(a, v[r + (h)], lo);		\
+			v[r + (h)] = __builtin_shuffle(a, v[r + (h)], hi);	\
+		}								\
+	}
+
+#define DEFINE_TRANSPOSE_KERNEL(suffix, attrs, lanes)				\
+typedef uint32_t tr_vec_##suffix##_t __attribute__((vector_size((lanes) * sizeof(uint32_t))));	\
+typedef int32_t tr_mask_##suffix##_t __attribute__((vector_size((lanes) * sizeof(int32_t))));	\
+									\
+attrs									\
+static void transpose_##suffix (unsigned int* dst, size_t ld_dst,	\
+			const unsigned int* src, size_t ld_src) {		\
+	for (size_t bi = 0; bi < TRANSPOSE_TILE; bi += (lanes)) {		\
+		for (size_t bj = 0; bj < TRANSPOSE_TILE; bj += (lanes)) {	\
+			tr_vec_##suffix##_t v[(lanes)];				\
+			_Pragma("GCC unroll 16")				\
+			for (size_t r = 0; r < (lanes); ++r) {			\
+				memcpy(&v[r], src + (bi + r) * ld_src + bj, sizeof(v[r]));	\
+			}							\
+			TRANSPOSE_STAGE(suffix, lanes, 8)			\
+			TRANSPOSE_STAGE(suffix, lanes, 4)			\
+			TRANSPOSE_STAGE(suffix, lanes, 2)			\
+			TRANSPOSE_STAGE(suffix, lanes, 1)			\
+			_Pragma("GCC unroll 16")				\
+			for (size_t r = 0; r < (lanes); ++r) {			\
+				memcpy(dst + (bj + r) * ld_dst + bi, &v[r], sizeof(v[r]));	\
+			}							\
+		}								\
+	}									\
+}
+
+DEFINE_TRANSPOSE_KERNEL(scalar, , 4)
+#ifdef MATRIX_KERNELS_X86
+DEFINE_TRANSPOSE_KERNEL(sse2, __attribute__((target("sse2"))), 4)
+DEFINE_TRANSPOSE_KERNEL(avx2, __attribute__((target("avx2"))), 8)
+DEFINE_TRANSPOSE_KERNEL(avx512, __attribute__((target("avx512f"))), 16)
+#endif
+
+static const Matrix_kernels_t kernel_table[] = {
+#ifdef MATRIX_KERNELS_X86
+	{"avx512", add_avx512, shift_left_avx512, shift_right_avx512, gemm_avx512, hash_avx512,
+		sum_avx512, sum_cols_avx512, pack_avx512, unpack_avx512, nonzero_avx512,
+		transpose_avx512, moments_avx512},
+	{"avx2", add_avx2, shift_left_avx2, shift_right_avx2, gemm_avx2, hash_avx2,
+		sum_avx2, sum_cols_avx2, pack_avx2, unpack_avx2, nonzero_avx2,
+		transpose_avx2, moments_avx2},
+	{"sse2", add_sse2, shift_left_sse2, shift_right_sse2, gemm_sse2, hash_sse2,
+		sum_sse2, sum_cols_sse2, pack_sse2, unpack_sse2, nonzero_sse2,
+		transpose_sse2, moments_sse2},
+#endif
+	{"scalar", add_scalar, shift_left_scalar, shift_right_scalar, gemm_scalar, hash_scalar,
+		sum_scalar, sum_cols_scalar, pack_scalar, unpack_scalar, nonzero_scalar,
+		transpose_scalar, moments_scalar},
+};
+
+#define NUM_KERNEL_SETS (sizeof(kernel_table) / sizeof(kernel_table[0]))
+
+/* Usable before init_matrix_kernels runs, e.g. from static initializers */
+Matrix_kernels_t matrix_kernels = {"scalar", add_scalar, shift_left_scalar, shift_right_scalar, gemm_scalar, hash_scalar,
+	sum_scalar, sum_cols_scalar, pack_scalar, unpack_scalar, nonzero_scalar,
+	transpose_scalar, moments_scalar};
+
+/* 
+ * PURPOSE: Check whether the running CPU can execute the named kernel set
+ * INPUTS: Name of the kernel set
+ * RETURN: True if the kernel set is usable on this CPU, else false
+ **/
+
+static bool cpu_supports_kernels (const char* name) {
+#ifdef MATRIX_KERNELS_X86
+	__builtin_cpu_init();
+	if (strcmp(name, "avx512") == 0) {
+		return __builtin_cpu_supports("avx512f");
+	}
+	if (strcmp(name, "avx2") == 0) {
+		return __builtin_cpu_supports("avx2");
+	}
+	if (strcmp(name, "sse2") == 0) {
+		return __builtin_cpu_supports("sse2");
+	}
+#endif
+	return strcmp(name, "scalar") == 0;
+}
+
+/* 
+ * PURPOSE: Force a specific kernel set, used for benchmarking and debugging
+ * INPUTS: Name of the kernel set (avx512, avx2, sse2 or scalar)
+ * RETURN: True if the kernel set exists and the CPU supports it, else false
+ **/
+
+bool select_matrix_kernels (const char* name) {
+	if (name == NULL) return false;
+
+	for (size_t i = 0; i < NUM_KERNEL_SETS; ++i) {
+		if (strcmp(kernel_table[i].name, name) == 0 && cpu_supports_kernels(name)) {
+			matrix_kernels = kernel_table[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+/* 
+ * PURPOSE: Pick the widest kernel set the CPU supports, honouring the
+ *  MATLAB_KERNELS environment variable when it names a usable set
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+void init_matrix_kernels (void) {
+	const char* forced = getenv("MATLAB_KERNELS");
+	if (forced != NULL && select_matrix_kernels(forced)) {
+		return;
+	}
+	for (size_t i = 0; i < NUM_KERNEL_SETS; ++i) {
+		if (cpu_supports_kernels(kernel_table[i].name)) {
+			matrix_kernels = kernel_table[i];
+			return;
+		}
+	}
+}
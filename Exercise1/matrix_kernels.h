@@ -0,0 +1,109 @@
+#ifndef _MATRIX_KERNELS_H_
+#define _MATRIX_KERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Element-wise kernels over flat unsigned int buffers. Each kernel has a
+ * scalar, SSE2, AVX2 and AVX-512 implementation; init_matrix_kernels picks
+ * the widest one the running CPU supports.
+ */
+
+typedef void (*add_kernel_t) (unsigned int* dst, const unsigned int* a,
+			const unsigned int* b, size_t n);
+typedef void (*shift_kernel_t) (unsigned int* dst, const unsigned int* src,
+			size_t n, unsigned int shift);
+
+/*
+ * Register tile of the multiply micro-kernel: C[MR][NR] += A[MR][kc] * B[kc][NR]
+ * with A packed column by column (MR values per k) and B packed row by row
+ * (NR values per k). The tile is written back to C at stride ldc, limited to
+ * the rows x cols that lie inside the matrix.
+ */
+#define GEMM_MR 6
+#define GEMM_NR 16
+
+typedef void (*gemm_kernel_t) (size_t kc, const unsigned int* a_panel,
+			const unsigned int* b_panel, unsigned int* c, size_t ldc,
+			size_t rows, size_t cols);
+
+/*
+ * 64-bit content hash of n elements, seeded so equal runs at different
+ * positions hash differently. Every kernel set returns the same value.
+ */
+typedef uint64_t (*hash_kernel_t) (const unsigned int* data, size_t n, uint64_t seed);
+
+/*
+ * Reductions widen to 64 bits, so sum is exact for n < 2^32 and sum_cols
+ * for fewer than 2^32 accumulated rows: acc[j] += row[j] for j < n.
+ */
+typedef uint64_t (*sum_kernel_t) (const unsigned int* data, size_t n);
+typedef void (*sum_cols_kernel_t) (uint64_t* acc, const unsigned int* row, size_t n);
+
+/* number of non-zero elements, counted in 32-bit lanes so exact for n < 2^32 */
+typedef size_t (*nonzero_kernel_t) (const unsigned int* data, size_t n);
+
+/*
+ * Statistics of a run of n (at least 1, at most a few thousand) elements:
+ * extremes, non-zero count and exact sum in one pass, then the squared
+ * deviations from the mean in a second pass while the run is still in L1.
+ */
+typedef struct {
+	uint32_t min;
+	uint32_t max;
+	uint64_t nonzero;
+	uint64_t sum;
+	double m2;
+}Kernel_moments_t;
+
+typedef void (*moments_kernel_t) (const unsigned int* data, size_t n, Kernel_moments_t* out);
+
+/*
+ * Frame-of-reference bit-packing of PACK_BLOCK elements: every element minus
+ * ref is stored in width bits (0 to 32), laid out vertically over
+ * PACK_LANES 32-bit lanes so one vector holds one bit position of PACK_LANES
+ * elements. A packed block is PACK_WORDS(width) words.
+ */
+#define PACK_BLOCK 1024
+#define PACK_LANES 16
+#define PACK_WORDS(width) ((size_t)(width) * (PACK_BLOCK / 32))
+
+typedef void (*pack_kernel_t) (uint32_t* words, const unsigned int* src,
+			unsigned int ref, unsigned int width);
+typedef void (*unpack_kernel_t) (unsigned int* dst, const uint32_t* words,
+			unsigned int ref, unsigned int width);
+
+/*
+ * Transpose of one TRANSPOSE_TILE x TRANSPOSE_TILE tile, dst[j][i] = src[i][j],
+ * with source and destination rows ld_src and ld_dst elements apart. The tile
+ * is moved as lanes x lanes blocks, each transposed in registers.
+ */
+#define TRANSPOSE_TILE 16
+
+typedef void (*transpose_kernel_t) (unsigned int* dst, size_t ld_dst,
+			const unsigned int* src, size_t ld_src);
+
+typedef struct {
+	const char* name;
+	add_kernel_t add;
+	shift_kernel_t shift_left;
+	shift_kernel_t shift_right;
+	gemm_kernel_t gemm;
+	hash_kernel_t hash;
+	sum_kernel_t sum;
+	sum_cols_kernel_t sum_cols;
+	pack_kernel_t pack;
+	unpack_kernel_t unpack;
+	nonzero_kernel_t nonzero;
+	transpose_kernel_t transpose;
+	moments_kernel_t moments;
+}Matrix_kernels_t;
+
+extern Matrix_kernels_t matrix_kernels;
+
+void init_matrix_kernels (void);
+bool select_matrix_kernels (const char* name);
+
+#endif
@@ -0,0 +1,483 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix_sparse.h"
+#include "matrix_kernels.h"
+#include "matrix_alloc.h"
+#include "threadpool.h"
+
+/* arguments shared by the row block tasks handed to parallel_for */
+typedef struct {
+	Matrix_csr_t* csr;
+	const unsigned int* src;
+	unsigned int* dst;
+	size_t cols;
+}Sparse_task_t;
+
+/*
+ * PURPOSE: Decide whether a matrix with nnz non-zero elements should be sparse
+ * INPUTS: Rows, cols, number of non-zero elements
+ * RETURN: True if at most one element in MATRIX_SPARSE_RATIO is non-zero
+ **/
+
+bool sparse_fits (unsigned int rows, unsigned int cols, size_t nnz) {
+	return nnz <= (uint64_t)rows * cols / MATRIX_SPARSE_RATIO;
+}
+
+/*
+ * PURPOSE: Allocate an empty CSR matrix. The header comes from the matrix
+ *  header slabs and the arrays from the matrix allocator
+ * INPUTS: Rows, elements to make room for
+ * RETURN: Address of the CSR matrix, NULL if out of memory
+ **/
+
+Matrix_csr_t* create_csr (unsigned int rows, size_t cap) {
+	_Static_assert(sizeof(Matrix_csr_t) <= sizeof(Matrix_t),
+		"CSR headers are carved from the header slabs");
+	Matrix_csr_t* csr = matrix_alloc_header();
+	if (!csr) {
+		return NULL;
+	}
+	csr->row_ptr = matrix_alloc_data(((size_t)rows + 1) * sizeof(size_t), true);
+	if (cap) {
+		csr->col_idx = matrix_alloc_data(cap * sizeof(unsigned int), false);
+		csr->vals = matrix_alloc_data(cap * sizeof(unsigned int), false);
+	}
+	csr->cap = cap;
+	if (!csr->row_ptr || (cap && (!csr->col_idx || !csr->vals))) {
+		destroy_csr(csr, rows);
+		return NULL;
+	}
+	return csr;
+}
+
+/*
+ * PURPOSE: Free a CSR matrix
+ * INPUTS: Address of the CSR matrix (may be NULL), rows
+ * RETURN: Nothing
+ **/
+
+void destroy_csr (Matrix_csr_t* csr, unsigned int rows) {
+	if (csr == NULL) return;
+
+	if (csr->row_ptr) {
+		matrix_free_data(csr->row_ptr, ((size_t)rows + 1) * sizeof(size_t));
+	}
+	if (csr->col_idx) {
+		matrix_free_data(csr->col_idx, csr->cap * sizeof(unsigned int));
+	}
+	if (csr->vals) {
+		matrix_free_data(csr->vals, csr->cap * sizeof(unsigned int));
+	}
+	matrix_free_header(csr);
+}
+
+/*
+ * PURPOSE: Copy a CSR matrix, sized to its elements
+ * INPUTS: Address of the CSR matrix, rows
+ * RETURN: Address of the copy, NULL if out of memory
+ **/
+
+Matrix_csr_t* copy_csr (const Matrix_csr_t* csr, unsigned int rows) {
+	Matrix_csr_t* copy = create_csr(rows, csr->nnz);
+	if (!copy) {
+		return NULL;
+	}
+	copy->nnz = csr->nnz;
+	memcpy(copy->row_ptr, csr->row_ptr, ((size_t)rows + 1) * sizeof(size_t));
+	if (csr->nnz) {
+		memcpy(copy->col_idx, csr->col_idx, csr->nnz * sizeof(unsigned int));
+		memcpy(copy->vals, csr->vals, csr->nnz * sizeof(unsigned int));
+	}
+	return copy;
+}
+
+/*
+ * PURPOSE: Row block task for dense_to_csr, stores each row's nonzero count
+ *  in row_ptr[r + 1] ahead of the prefix sum
+ * INPUTS: Address of the Sparse_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void count_rows (void* ctx, size_t begin, size_t end) {
+	const Sparse_task_t* t = ctx;
+	for (size_t r = begin; r < end; ++r) {
+		t->csr->row_ptr[r + 1] = matrix_kernels.nonzero(t->src + r * t->cols, t->cols);
+	}
+}
+
+/*
+ * PURPOSE: Row block task for dense_to_csr, copies the nonzeros of each row
+ *  to the columns and values starting at its row offset
+ * INPUTS: Address of the Sparse_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void fill_rows (void* ctx, size_t begin, size_t end) {
+	const Sparse_task_t* t = ctx;
+	for (size_t r = begin; r < end; ++r) {
+		const unsigned int* row = t->src + r * t->cols;
+		size_t k = t->csr->row_ptr[r];
+		for (size_t j = 0; j < t->cols; ++j) {
+			if (row[j]) {
+				t->csr->col_idx[k] = j;
+				t->csr->vals[k] = row[j];
+				++k;
+			}
+		}
+	}
+}
+
+/*
+ * PURPOSE: Row block task for csr_to_dense, zeroes the dense rows and writes
+ *  the stored elements into them
+ * INPUTS: Address of the Sparse_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void scatter_rows (void* ctx, size_t begin, size_t end) {
+	const Sparse_task_t* t = ctx;
+	unsigned int* row = t->dst + begin * t->cols;
+	memset(row, 0, (end - begin) * t->cols * sizeof(unsigned int));
+	for (size_t r = begin; r < end; ++r, row += t->cols) {
+		for (size_t k = t->csr->row_ptr[r]; k < t->csr->row_ptr[r + 1]; ++k) {
+			row[t->csr->col_idx[k]] = t->csr->vals[k];
+		}
+	}
+}
+
+/*
+ * PURPOSE: Row block task for add_csr_dense, adds the stored elements of
+ *  each row into the dense row
+ * INPUTS: Address of the Sparse_task_t, first row, one past the last row
+ * RETURN: Nothing
+ **/
+
+static void add_scatter_rows (void* ctx, size_t begin, size_t end) {
+	const Sparse_task_t* t = ctx;
+	unsigned int* row = t->dst + begin * t->cols;
+	for (size_t r = begin; r < end; ++r, row += t->cols) {
+		for (size_t k = t->csr->row_ptr[r]; k < t->csr->row_ptr[r + 1]; ++k) {
+			row[t->csr->col_idx[k]] += t->csr->vals[k];
+		}
+	}
+}
+
+/*
+ * PURPOSE: Build the CSR form of a dense matrix, counting and then filling
+ *  the rows in parallel
+ * INPUTS: Dense elements, rows, cols
+ * RETURN: Address of the CSR matrix, NULL if out of memory
+ **/
+
+Matrix_csr_t* dense_to_csr (const unsigned int* data, unsigned int rows, unsigned int cols) {
+	Matrix_csr_t* csr = create_csr(rows, 0);
+	if (!csr) {
+		return NULL;
+	}
+	Sparse_task_t task = {.csr = csr, .src = data, .cols = cols};
+	parallel_for(rows, parallel_grain_rows(cols), count_rows, &task);
+	for (size_t r = 0; r < rows; ++r) {
+		csr->row_ptr[r + 1] += csr->row_ptr[r];
+	}
+	csr->nnz = csr->row_ptr[rows];
+	if (csr->nnz) {
+		csr->col_idx = matrix_alloc_data(csr->nnz * sizeof(unsigned int), false);
+		csr->vals = matrix_alloc_data(csr->nnz * sizeof(unsigned int), false);
+		csr->cap = csr->nnz;
+		if (!csr->col_idx || !csr->vals) {
+			destroy_csr(csr, rows);
+			return NULL;
+		}
+	}
+	parallel_for(rows, parallel_grain_rows(cols), fill_rows, &task);
+	return csr;
+}
+
+/*
+ * PURPOSE: Write every element of a CSR matrix, zeros included, to a dense
+ *  buffer, rows in parallel
+ * INPUTS: Address of the CSR matrix, rows * cols element buffer, rows, cols
+ * RETURN: Nothing
+ **/
+
+void csr_to_dense (const Matrix_csr_t* csr, unsigned int* data, unsigned int rows, unsigned int cols) {
+	Sparse_task_t task = {.csr = (Matrix_csr_t*)csr, .dst = data, .cols = cols};
+	parallel_for(rows, parallel_grain_rows(cols), scatter_rows, &task);
+}
+
+/*
+ * PURPOSE: Write a run of elements of a CSR matrix, zeros included, to a
+ *  dense buffer, so an operation can read a sparse matrix a block at a time
+ * INPUTS: Address of the CSR matrix, cols, row-major index of the first
+ *  element, element count, buffer of n elements
+ * RETURN: Nothing
+ **/
+
+void csr_range_to_dense (const Matrix_csr_t* csr, unsigned int cols, size_t first, size_t n,
+			unsigned int* data) {
+	memset(data, 0, n * sizeof(unsigned int));
+	const size_t last = first + n;
+	for (size_t r = first / cols; r * cols < last; ++r) {
+		const size_t row_start = r * cols;
+		const size_t c0 = first > row_start ? first - row_start : 0;
+		const size_t c1 = last - row_start < cols ? last - row_start : cols;
+		/* first stored column at or after c0, the columns of a row increase */
+		size_t lo = csr->row_ptr[r];
+		size_t hi = csr->row_ptr[r + 1];
+		while (lo < hi) {
+			const size_t mid = lo + (hi - lo) / 2;
+			if (csr->col_idx[mid] < c0) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		for (size_t k = lo; k < csr->row_ptr[r + 1] && csr->col_idx[k] < c1; ++k) {
+			data[row_start + csr->col_idx[k] - first] = csr->vals[k];
+		}
+	}
+}
+
+/*
+ * PURPOSE: Check that a CSR matrix read from outside is well formed: offsets
+ *  in order, columns in range and increasing along each row, no stored zeros
+ * INPUTS: Address of the CSR matrix, rows, cols
+ * RETURN: True if it may be used, else false
+ **/
+
+bool valid_csr (const Matrix_csr_t* csr, unsigned int rows, unsigned int cols) {
+	if (csr->row_ptr[0] != 0 || csr->row_ptr[rows] != csr->nnz || csr->nnz > csr->cap) {
+		return false;
+	}
+	for (size_t r = 0; r < rows; ++r) {
+		const size_t begin = csr->row_ptr[r];
+		const size_t end = csr->row_ptr[r + 1];
+		if (end < begin || end > csr->nnz) {
+			return false;
+		}
+		for (size_t k = begin; k < end; ++k) {
+			if (csr->col_idx[k] >= cols || csr->vals[k] == 0
+				|| (k > begin && csr->col_idx[k] <= csr->col_idx[k - 1])) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Add two CSR matrices of the same shape by merging their rows.
+ *  Sums that wrap around to zero are dropped
+ * INPUTS: Addresses of the two CSR matrices, rows
+ * RETURN: Address of the new CSR sum, NULL if out of memory
+ **/
+
+Matrix_csr_t* add_csr (const Matrix_csr_t* a, const Matrix_csr_t* b, unsigned int rows) {
+	Matrix_csr_t* c = create_csr(rows, a->nnz + b->nnz);
+	if (!c) {
+		return NULL;
+	}
+	size_t k = 0;
+	for (size_t r = 0; r < rows; ++r) {
+		size_t i = a->row_ptr[r];
+		size_t j = b->row_ptr[r];
+		const size_t i_end = a->row_ptr[r + 1];
+		const size_t j_end = b->row_ptr[r + 1];
+		while (i < i_end || j < j_end) {
+			unsigned int col;
+			unsigned int val;
+			if (j == j_end || (i < i_end && a->col_idx[i] < b->col_idx[j])) {
+				col = a->col_idx[i];
+				val = a->vals[i++];
+			}
+			else if (i == i_end || b->col_idx[j] < a->col_idx[i]) {
+				col = b->col_idx[j];
+				val = b->vals[j++];
+			}
+			else {
+				col = a->col_idx[i];
+				val = a->vals[i++] + b->vals[j++];
+			}
+			if (val) {
+				c->col_idx[k] = col;
+				c->vals[k] = val;
+				++k;
+			}
+		}
+		c->row_ptr[r + 1] = k;
+	}
+	c->nnz = k;
+	return c;
+}
+
+/*
+ * PURPOSE: Add a CSR matrix into a dense one in place, rows in parallel
+ * INPUTS: rows * cols element buffer to add to, address of the CSR matrix,
+ *  rows, cols
+ * RETURN: Nothing
+ **/
+
+void add_csr_dense (unsigned int* data, const Matrix_csr_t* csr, unsigned int rows, unsigned int cols) {
+	Sparse_task_t task = {.csr = (Matrix_csr_t*)csr, .dst = data, .cols = cols};
+	parallel_for(rows, parallel_grain_rows(cols), add_scatter_rows, &task);
+}
+
+/*
+ * PURPOSE: Shift every element of a CSR matrix with the shift kernels, then
+ *  drop the elements shifted out to zero
+ * INPUTS: Address of the CSR matrix, rows, 'l' or 'r', bits to shift
+ * RETURN: Nothing
+ **/
+
+void shift_csr (Matrix_csr_t* csr, unsigned int rows, char direction, unsigned int shift) {
+	if (csr->nnz == 0) {
+		return;
+	}
+	if (direction == 'l') {
+		matrix_kernels.shift_left(csr->vals, csr->vals, csr->nnz, shift);
+	}
+	else {
+		matrix_kernels.shift_right(csr->vals, csr->vals, csr->nnz, shift);
+	}
+
+	size_t k = 0;
+	size_t begin = 0;
+	for (size_t r = 0; r < rows; ++r) {
+		const size_t end = csr->row_ptr[r + 1];
+		csr->row_ptr[r] = k;
+		for (size_t i = begin; i < end; ++i) {
+			if (csr->vals[i]) {
+				csr->col_idx[k] = csr->col_idx[i];
+				csr->vals[k] = csr->vals[i];
+				++k;
+			}
+		}
+		begin = end;
+	}
+	csr->row_ptr[rows] = k;
+	csr->nnz = k;
+}
+
+/*
+ * PURPOSE: Find the first element at which two CSR matrices differ
+ * INPUTS: Addresses of the two CSR matrices, rows, cols
+ * RETURN: Row-major index of the first difference, SIZE_MAX if equal
+ **/
+
+size_t compare_csr (const Matrix_csr_t* a, const Matrix_csr_t* b, unsigned int rows, unsigned int cols) {
+	for (size_t r = 0; r < rows; ++r) {
+		size_t i = a->row_ptr[r];
+		size_t j = b->row_ptr[r];
+		const size_t i_end = a->row_ptr[r + 1];
+		const size_t j_end = b->row_ptr[r + 1];
+		for (; i < i_end && j < j_end; ++i, ++j) {
+			if (a->col_idx[i] != b->col_idx[j]) {
+				/* the side with the lower column has a non-zero the other lacks */
+				const unsigned int col = a->col_idx[i] < b->col_idx[j] ? a->col_idx[i] : b->col_idx[j];
+				return r * cols + col;
+			}
+			if (a->vals[i] != b->vals[j]) {
+				return r * cols + a->col_idx[i];
+			}
+		}
+		if (i < i_end) {
+			return r * cols + a->col_idx[i];
+		}
+		if (j < j_end) {
+			return r * cols + b->col_idx[j];
+		}
+	}
+	return SIZE_MAX;
+}
+
+/*
+ * PURPOSE: Find the first element at which a CSR and a dense matrix differ
+ * INPUTS: Address of the CSR matrix, dense elements, rows, cols
+ * RETURN: Row-major index of the first difference, SIZE_MAX if equal
+ **/
+
+size_t compare_csr_dense (const Matrix_csr_t* csr, const unsigned int* data, unsigned int rows,
+			unsigned int cols) {
+	const unsigned int* row = data;
+	for (size_t r = 0; r < rows; ++r, row += cols) {
+		size_t k = csr->row_ptr[r];
+		for (size_t j = 0; j < cols; ++j) {
+			unsigned int expected = 0;
+			if (k < csr->row_ptr[r + 1] && csr->col_idx[k] == j) {
+				expected = csr->vals[k++];
+			}
+			if (row[j] != expected) {
+				return r * cols + j;
+			}
+		}
+	}
+	return SIZE_MAX;
+}
+
+/*
+ * PURPOSE: Transpose a CSR matrix with a counting sort on the columns. Rows
+ *  are visited in order, so every row of the result comes out sorted
+ * INPUTS: Address of the CSR matrix, rows, cols
+ * RETURN: Address of the cols x rows CSR transpose, NULL if out of memory
+ **/
+
+Matrix_csr_t* transpose_csr (const Matrix_csr_t* csr, unsigned int rows, unsigned int cols) {
+	Matrix_csr_t* t = create_csr(cols, csr->nnz);
+	if (!t) {
+		return NULL;
+	}
+	for (size_t k = 0; k < csr->nnz; ++k) {
+		t->row_ptr[csr->col_idx[k] + 1]++;
+	}
+	for (size_t j = 0; j < cols; ++j) {
+		t->row_ptr[j + 1] += t->row_ptr[j];
+	}
+	/* row_ptr[j] is the next free slot of row j while scattering, shifted back after */
+	for (size_t r = 0; r < rows; ++r) {
+		for (size_t k = csr->row_ptr[r]; k < csr->row_ptr[r + 1]; ++k) {
+			const size_t slot = t->row_ptr[csr->col_idx[k]]++;
+			t->col_idx[slot] = r;
+			t->vals[slot] = csr->vals[k];
+		}
+	}
+	memmove(t->row_ptr + 1, t->row_ptr, (size_t)cols * sizeof(size_t));
+	t->row_ptr[0] = 0;
+	t->nnz = csr->nnz;
+	return t;
+}
+
+/*
+ * PURPOSE: Give a CSR matrix a new shape with the same number of elements,
+ *  keeping every element at its row-major index. The elements stay in order,
+ *  only their row and column are recomputed
+ * INPUTS: Address of the CSR matrix, rows, cols, new rows, new cols
+ * RETURN: Address of the reshaped CSR matrix, NULL if out of memory
+ **/
+
+Matrix_csr_t* reshape_csr (const Matrix_csr_t* csr, unsigned int rows, unsigned int cols,
+			unsigned int new_rows, unsigned int new_cols) {
+	Matrix_csr_t* t = create_csr(new_rows, csr->nnz);
+	if (!t) {
+		return NULL;
+	}
+	for (size_t r = 0; r < rows; ++r) {
+		for (size_t k = csr->row_ptr[r]; k < csr->row_ptr[r + 1]; ++k) {
+			const size_t index = r * cols + csr->col_idx[k];
+			t->row_ptr[index / new_cols + 1]++;
+			t->col_idx[k] = index % new_cols;
+		}
+	}
+	for (size_t r = 0; r < new_rows; ++r) {
+		t->row_ptr[r + 1] += t->row_ptr[r];
+	}
+	if (csr->nnz) {
+		memcpy(t->vals, csr->vals, csr->nnz * sizeof(unsigned int));
+	}
+	t->nnz = csr->nnz;
+	return t;
+}
@@ -0,0 +1,41 @@
+#ifndef _MATRIX_SPARSE_H_
+#define _MATRIX_SPARSE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+
+/*
+ * A matrix is kept sparse while at most one element in MATRIX_SPARSE_RATIO
+ * is non-zero. Denser than that, the column index stored per element costs
+ * more memory and time than the zeros it saves.
+ */
+#define MATRIX_SPARSE_RATIO 8
+
+/* first unsigned int of a sparse matrix file, "MATS" in little-endian order */
+#define MATRIX_SPARSE_MAGIC 0x5354414Du
+#define MATRIX_SPARSE_VERSION 1
+
+bool sparse_fits (unsigned int rows, unsigned int cols, size_t nnz);
+Matrix_csr_t* create_csr (unsigned int rows, size_t cap);
+void destroy_csr (Matrix_csr_t* csr, unsigned int rows);
+Matrix_csr_t* copy_csr (const Matrix_csr_t* csr, unsigned int rows);
+Matrix_csr_t* dense_to_csr (const unsigned int* data, unsigned int rows, unsigned int cols);
+void csr_to_dense (const Matrix_csr_t* csr, unsigned int* data, unsigned int rows, unsigned int cols);
+void csr_range_to_dense (const Matrix_csr_t* csr, unsigned int cols, size_t first, size_t n,
+			unsigned int* data);
+bool valid_csr (const Matrix_csr_t* csr, unsigned int rows, unsigned int cols);
+Matrix_csr_t* add_csr (const Matrix_csr_t* a, const Matrix_csr_t* b, unsigned int rows);
+void add_csr_dense (unsigned int* data, const Matrix_csr_t* csr, unsigned int rows, unsigned int cols);
+void shift_csr (Matrix_csr_t* csr, unsigned int rows, char direction, unsigned int shift);
+size_t compare_csr (const Matrix_csr_t* a, const Matrix_csr_t* b, unsigned int rows, unsigned int cols);
+size_t compare_csr_dense (const Matrix_csr_t* csr, const unsigned int* data, unsigned int rows,
+			unsigned int cols);
+Matrix_csr_t* transpose_csr (const Matrix_csr_t* csr, unsigned int rows, unsigned int cols);
+Matrix_csr_t* reshape_csr (const Matrix_csr_t* csr, unsigned int rows, unsigned int cols,
+			unsigned int new_rows, unsigned int new_cols);
+
+#endif
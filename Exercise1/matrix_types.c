@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix_types.h"
+#include "matrix_kernels.h"
+#include "prng.h"
+
+/* elements drawn from the generator per call before being narrowed or scaled */
+#define TYPE_RANDOM_CHUNK 1024
+
+/* elements per sum kernel call, the kernel is exact below 2^32 */
+#define TYPE_SUM_CHUNK (1u << 31)
+
+#define TYPE_LANES(elem_t) (TYPE_VECTOR_BYTES / sizeof(elem_t))
+
+/*
+ * MATRIX_U32 wrappers around the dispatched kernels, so code that works on
+ * any type through the tables gets the widest instruction set for u32 too.
+ */
+
+static void add_u32 (void* dst, const void* a, const void* b, size_t n) {
+	matrix_kernels.add(dst, a, b, n);
+}
+
+static void shift_u32 (void* data, size_t n, char direction, unsigned int shift) {
+	if (direction == 'l') {
+		matrix_kernels.shift_left(data, data, n, shift);
+	}
+	else {
+		matrix_kernels.shift_right(data, data, n, shift);
+	}
+}
+
+static void random_u32 (void* dst, size_t first, size_t n, uint64_t seed, uint32_t stream,
+			unsigned int start, unsigned int range) {
+	prng_fill_range(dst, first, n, seed, stream, start, range);
+}
+
+static void sum_u32 (const void* src, size_t n, Matrix_sum_t* sum) {
+	const unsigned int* s = src;
+	for (size_t i = 0; i < n; i += TYPE_SUM_CHUNK) {
+		sum->integer += matrix_kernels.sum(s + i, n - i < TYPE_SUM_CHUNK ? n - i : TYPE_SUM_CHUNK);
+	}
+}
+
+/*
+ * Templates for the other types. Loads and stores go through memcpy like the
+ * vector kernels of matrix_kernels.c, since rows of narrow types start on any
+ * byte; the tails fall back to scalar loops. Integer arithmetic wraps modulo
+ * the width of the type, as u32 does.
+ */
+
+#define DEFINE_TYPE_VECTOR(suffix, elem_t)					\
+typedef elem_t type_vec_##suffix##_t __attribute__((vector_size(TYPE_VECTOR_BYTES)));
+
+#define DEFINE_ADD_OP(suffix, elem_t)						\
+static void add_##suffix (void* dst, const void* a, const void* b, size_t n) {	\
+	elem_t* d = dst;							\
+	const elem_t* x = a;							\
+	const elem_t* y = b;							\
+	size_t i = 0;								\
+	for (; i + TYPE_LANES(elem_t) <= n; i += TYPE_LANES(elem_t)) {		\
+		type_vec_##suffix##_t va;					\
+		type_vec_##suffix##_t vb;					\
+		memcpy(&va, x + i, sizeof(va));					\
+		memcpy(&vb, y + i, sizeof(vb));					\
+		va += vb;							\
+		memcpy(d + i, &va, sizeof(va));					\
+	}									\
+	for (; i < n; ++i) {							\
+		d[i] = x[i] + y[i];						\
+	}									\
+}
+
+#define DEFINE_SHIFT_OP(suffix, elem_t)						\
+static void shift_##suffix (void* data, size_t n, char direction, unsigned int shift) {	\
+	elem_t* d = data;							\
+	if (shift >= sizeof(elem_t) * 8) {					\
+		memset(d, 0, n * sizeof(elem_t));				\
+		return;								\
+	}									\
+	size_t i = 0;								\
+	for (; i + TYPE_LANES(elem_t) <= n; i += TYPE_LANES(elem_t)) {		\
+		type_vec_##suffix##_t v;					\
+		memcpy(&v, d + i, sizeof(v));					\
+		v = direction == 'l' ? v << (elem_t)shift : v >> (elem_t)shift;	\
+		memcpy(d + i, &v, sizeof(v));					\
+	}									\
+	for (; i < n; ++i) {							\
+		d[i] = direction == 'l' ? (elem_t)(d[i] << shift) : (elem_t)(d[i] >> shift);	\
+	}									\
+}
+
+/* integers keep the generator's draws, random_matrix checked they fit the type */
+#define DEFINE_RANDOM_INT_OP(suffix, elem_t)					\
+static void random_##suffix (void* dst, size_t first, size_t n, uint64_t seed, uint32_t stream,	\
+			unsigned int start, unsigned int range) {		\
+	elem_t* d = dst;							\
+	unsigned int draws[TYPE_RANDOM_CHUNK];					\
+	for (size_t i = 0; i < n; i += TYPE_RANDOM_CHUNK) {			\
+		const size_t len = n - i < TYPE_RANDOM_CHUNK ? n - i : TYPE_RANDOM_CHUNK;	\
+		prng_fill_range(draws, first + i, len, seed, stream, start, range);	\
+		for (size_t k = 0; k < len; ++k) {				\
+			d[i + k] = (elem_t)draws[k];				\
+		}								\
+	}									\
+}
+
+/* floating point types scale full 32-bit draws onto [start, end] */
+#define DEFINE_RANDOM_REAL_OP(suffix, elem_t)					\
+static void random_##suffix (void* dst, size_t first, size_t n, uint64_t seed, uint32_t stream,	\
+			unsigned int start, unsigned int range) {		\
+	elem_t* d = dst;							\
+	unsigned int draws[TYPE_RANDOM_CHUNK];					\
+	const double step = (double)(unsigned int)(range - 1) / UINT32_MAX;	\
+	for (size_t i = 0; i < n; i += TYPE_RANDOM_CHUNK) {			\
+		const size_t len = n - i < TYPE_RANDOM_CHUNK ? n - i : TYPE_RANDOM_CHUNK;	\
+		prng_fill_range(draws, first + i, len, seed, stream, 0, 0);	\
+		for (size_t k = 0; k < len; ++k) {				\
+			d[i + k] = (elem_t)(start + draws[k] * step);		\
+		}								\
+	}									\
+}
+
+/*
+ * Integer sums load each vector as lane_t lanes of twice the element width
+ * and add its low and high halves, which is only masks and shifts on any
+ * instruction set. A lane takes a bounded block of vectors before it could
+ * wrap, then the lanes are folded into the total. u64 can't be widened, so
+ * its lanes count their wrap-arounds in a second vector instead.
+ */
+#define DEFINE_SUM_INT_OP(suffix, elem_t, lane_t)				\
+typedef lane_t sum_vec_##suffix##_t __attribute__((vector_size(TYPE_VECTOR_BYTES)));	\
+									\
+static void sum_##suffix (const void* src, size_t n, Matrix_sum_t* sum) {	\
+	const elem_t* s = src;							\
+	const bool split = sizeof(lane_t) > sizeof(elem_t);			\
+	const lane_t low = (elem_t)-1;						\
+	const size_t block = split ? (lane_t)-1 / (2 * low) * TYPE_LANES(elem_t) : n;	\
+	unsigned __int128 total = 0;						\
+	size_t i = 0;								\
+	while (i + TYPE_LANES(elem_t) <= n) {					\
+		const size_t stop = n - i <= block ? n - n % TYPE_LANES(elem_t) : i + block;	\
+		sum_vec_##suffix##_t acc = {0};					\
+		sum_vec_##suffix##_t carry = {0};				\
+		for (; i < stop; i += TYPE_LANES(elem_t)) {			\
+			sum_vec_##suffix##_t w;					\
+			memcpy(&w, s + i, sizeof(w));				\
+			if (split) {						\
+				acc += (w & low) + (w >> (sizeof(elem_t) * 4) >> (sizeof(elem_t) * 4));	\
+			}							\
+			else {							\
+				acc += w;					\
+				carry -= (sum_vec_##suffix##_t)(acc < w);	\
+			}							\
+		}								\
+		for (size_t l = 0; l < TYPE_VECTOR_BYTES / sizeof(lane_t); ++l) {	\
+			total += acc[l] + ((unsigned __int128)carry[l] << (sizeof(lane_t) * 4) << (sizeof(lane_t) * 4));	\
+		}								\
+	}									\
+	for (; i < n; ++i) {							\
+		total += s[i];							\
+	}									\
+	sum->integer += total;							\
+}
+
+#define DEFINE_SUM_REAL_OP(suffix, elem_t)					\
+typedef double sum_vec_##suffix##_t						\
+	__attribute__((vector_size(TYPE_LANES(elem_t) * sizeof(double))));	\
+									\
+static void sum_##suffix (const void* src, size_t n, Matrix_sum_t* sum) {	\
+	const elem_t* s = src;							\
+	sum_vec_##suffix##_t acc = {0};						\
+	size_t i = 0;								\
+	for (; i + TYPE_LANES(elem_t) <= n; i += TYPE_LANES(elem_t)) {		\
+		type_vec_##suffix##_t v;					\
+		memcpy(&v, s + i, sizeof(v));					\
+		acc += __builtin_convertvector(v, sum_vec_##suffix##_t);	\
+	}									\
+	double total = 0.0;							\
+	for (size_t l = 0; l < TYPE_LANES(elem_t); ++l) {			\
+		total += acc[l];						\
+	}									\
+	for (; i < n; ++i) {							\
+		total += s[i];							\
+	}									\
+	sum->real += total;							\
+}
+
+/* four elements at a time, the width of the double vectors of stats_matrix */
+typedef double type_widen_vec_t __attribute__((vector_size(TYPE_VECTOR_BYTES)));
+
+#define DEFINE_WIDEN_OP(suffix, elem_t)						\
+typedef elem_t widen_src_##suffix##_t						\
+	__attribute__((vector_size(TYPE_VECTOR_BYTES / sizeof(double) * sizeof(elem_t))));	\
+									\
+static void widen_##suffix (double* dst, const void* src, size_t n) {	\
+	const elem_t* s = src;							\
+	size_t i = 0;								\
+	for (; i + TYPE_VECTOR_BYTES / sizeof(double) <= n; i += TYPE_VECTOR_BYTES / sizeof(double)) {	\
+		widen_src_##suffix##_t v;					\
+		memcpy(&v, s + i, sizeof(v));					\
+		const type_widen_vec_t d = __builtin_convertvector(v, type_widen_vec_t);	\
+		memcpy(dst + i, &d, sizeof(d));					\
+	}									\
+	for (; i < n; ++i) {							\
+		dst[i] = (double)s[i];						\
+	}									\
+}
+
+#define DEFINE_FORMAT_OP(suffix, elem_t, fmt, print_t)				\
+static int format_##suffix (char* buf, size_t len, const void* elems, size_t i) {	\
+	return snprintf(buf, len, fmt, (print_t)((const elem_t*)elems)[i]);	\
+}
+
+#define DEFINE_INT_TYPE(suffix, elem_t, lane_t, fmt, print_t)			\
+	DEFINE_TYPE_VECTOR(suffix, elem_t)					\
+	DEFINE_ADD_OP(suffix, elem_t)						\
+	DEFINE_SHIFT_OP(suffix, elem_t)						\
+	DEFINE_RANDOM_INT_OP(suffix, elem_t)					\
+	DEFINE_SUM_INT_OP(suffix, elem_t, lane_t)				\
+	DEFINE_WIDEN_OP(suffix, elem_t)						\
+	DEFINE_FORMAT_OP(suffix, elem_t, fmt, print_t)
+
+#define DEFINE_REAL_TYPE(suffix, elem_t)					\
+	DEFINE_TYPE_VECTOR(suffix, elem_t)					\
+	DEFINE_ADD_OP(suffix, elem_t)						\
+	DEFINE_RANDOM_REAL_OP(suffix, elem_t)					\
+	DEFINE_SUM_REAL_OP(suffix, elem_t)					\
+	DEFINE_WIDEN_OP(suffix, elem_t)						\
+	DEFINE_FORMAT_OP(suffix, elem_t, "%g", double)
+
+DEFINE_WIDEN_OP(u32, uint32_t)
+DEFINE_FORMAT_OP(u32, uint32_t, "%u", unsigned int)
+DEFINE_INT_TYPE(u8, uint8_t, uint16_t, "%u", unsigned int)
+DEFINE_INT_TYPE(u16, uint16_t, uint32_t, "%u", unsigned int)
+DEFINE_INT_TYPE(u64, uint64_t, uint64_t, "%llu", unsigned long long)
+DEFINE_REAL_TYPE(f32, float)
+DEFINE_REAL_TYPE(f64, double)
+
+const Matrix_type_ops_t matrix_types[MATRIX_TYPE_COUNT] = {
+	[MATRIX_U32] = {"u32", sizeof(uint32_t), false, UINT32_MAX,
+		add_u32, shift_u32, random_u32, sum_u32, format_u32, widen_u32},
+	[MATRIX_U8] = {"u8", sizeof(uint8_t), false, UINT8_MAX,
+		add_u8, shift_u8, random_u8, sum_u8, format_u8, widen_u8},
+	[MATRIX_U16] = {"u16", sizeof(uint16_t), false, UINT16_MAX,
+		add_u16, shift_u16, random_u16, sum_u16, format_u16, widen_u16},
+	[MATRIX_U64] = {"u64", sizeof(uint64_t), false, UINT64_MAX,
+		add_u64, shift_u64, random_u64, sum_u64, format_u64, widen_u64},
+	[MATRIX_F32] = {"f32", sizeof(float), true, 0,
+		add_f32, NULL, random_f32, sum_f32, format_f32, widen_f32},
+	[MATRIX_F64] = {"f64", sizeof(double), true, 0,
+		add_f64, NULL, random_f64, sum_f64, format_f64, widen_f64},
+};
+
+/*
+ * PURPOSE: Look up an element type by its name (u8, u16, u32, u64, f32, f64)
+ * INPUTS: Name, address to store the type
+ * RETURN: True if the name is a type, else false
+ **/
+
+bool parse_matrix_type (const char* name, Matrix_type_t* type) {
+	if (name == NULL || type == NULL) return false;
+
+	for (int i = 0; i < MATRIX_TYPE_COUNT; ++i) {
+		if (strcmp(matrix_types[i].name, name) == 0) {
+			*type = (Matrix_type_t)i;
+			return true;
+		}
+	}
+	return false;
+}
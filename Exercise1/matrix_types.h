@@ -0,0 +1,55 @@
+#ifndef _MATRIX_TYPES_H_
+#define _MATRIX_TYPES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+/*
+ * Element type specialized operations, one table per Matrix_type_t. The
+ * MATRIX_U32 table forwards to the per-ISA kernels of matrix_kernels.h;
+ * every other table is generated from one set of templates in
+ * matrix_types.c working on TYPE_VECTOR_BYTES wide vectors of the element
+ * type, so narrow types move 2-4x as many elements per instruction.
+ */
+
+#define TYPE_VECTOR_BYTES 32
+
+/* first unsigned int of the file of a matrix of any type but u32, "MATT" in little-endian order */
+#define MATRIX_TYPED_MAGIC 0x5454414Du
+#define MATRIX_TYPED_VERSION 1
+
+/* running total of a sum, integer types add to integer and floating point types to real */
+typedef struct {
+	unsigned __int128 integer;
+	double real;
+}Matrix_sum_t;
+
+typedef void (*type_add_t) (void* dst, const void* a, const void* b, size_t n);
+typedef void (*type_shift_t) (void* data, size_t n, char direction, unsigned int shift);
+typedef void (*type_random_t) (void* dst, size_t first, size_t n, uint64_t seed, uint32_t stream,
+			unsigned int start, unsigned int range);
+typedef void (*type_sum_t) (const void* src, size_t n, Matrix_sum_t* sum);
+typedef int (*type_format_t) (char* buf, size_t len, const void* elems, size_t i);
+typedef void (*type_widen_t) (double* dst, const void* src, size_t n);
+
+typedef struct {
+	const char* name;
+	size_t size;
+	bool is_float;
+	uint64_t max; /* largest value of an integer type, 0 for floating point types */
+	type_add_t add;
+	type_shift_t shift; /* NULL for floating point types */
+	type_random_t random;
+	type_sum_t sum;
+	type_format_t format;
+	type_widen_t widen; /* converts elements to double for the statistics */
+}Matrix_type_ops_t;
+
+extern const Matrix_type_ops_t matrix_types[MATRIX_TYPE_COUNT];
+
+bool parse_matrix_type (const char* name, Matrix_type_t* type);
+
+#endif
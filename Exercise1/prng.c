@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "prng.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+/* counters run through the rounds together, 4 outputs each */
+#define PHILOX_LANES 8
+#define PHILOX_OUTPUTS (PHILOX_LANES * 4)
+
+/* counter word 3 values: bulk draws, then per element redraws after a rejection */
+#define STREAM_BULK 0u
+#define STREAM_REDRAW 1u
+
+typedef uint32_t lanes32_t __attribute__((vector_size(PHILOX_LANES * sizeof(uint32_t))));
+typedef uint64_t lanes64_t __attribute__((vector_size(PHILOX_LANES * sizeof(uint64_t))));
+
+static uint64_t current_seed;
+static uint32_t next_stream;
+
+/* 
+ * PURPOSE: Philox4x32-10 over PHILOX_LANES counters at once. The counters'
+ *  first two words vary per lane, the last two are shared.
+ * INPUTS: Key, addresses of the per lane counter words 0 and 1, shared
+ *  counter words 2 and 3, output array receiving the four result words of
+ *  every lane
+ * RETURN: Nothing
+ **/
+
+static void philox_lanes (uint64_t key, const lanes32_t* c0, const lanes32_t* c1,
+			uint32_t c2, uint32_t c3, lanes32_t out[4]) {
+	uint32_t k0 = (uint32_t)key;
+	uint32_t k1 = (uint32_t)(key >> 32);
+	lanes32_t x0 = *c0, x1 = *c1;
+	lanes32_t x2 = {0}, x3 = {0};
+	x2 += c2;
+	x3 += c3;
+	for (int round = 0; round < PHILOX_ROUNDS; ++round) {
+		const lanes64_t p0 = __builtin_convertvector(x0, lanes64_t) * (uint64_t)PHILOX_M0;
+		const lanes64_t p1 = __builtin_convertvector(x2, lanes64_t) * (uint64_t)PHILOX_M1;
+		const lanes32_t hi0 = __builtin_convertvector(p0 >> 32, lanes32_t);
+		const lanes32_t lo0 = __builtin_convertvector(p0, lanes32_t);
+		const lanes32_t hi1 = __builtin_convertvector(p1 >> 32, lanes32_t);
+		const lanes32_t lo1 = __builtin_convertvector(p1, lanes32_t);
+		x0 = hi1 ^ x1 ^ k0;
+		x1 = lo1;
+		x2 = hi0 ^ x3 ^ k1;
+		x3 = lo0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	out[0] = x0;
+	out[1] = x1;
+	out[2] = x2;
+	out[3] = x3;
+}
+
+/* 
+ * PURPOSE: Draw a replacement value for an element whose bulk draw was
+ *  rejected, from a counter space of its own
+ * INPUTS: Seed, stream, element index, range, rejection threshold
+ * RETURN: Unbiased value in [0, range)
+ **/
+
+static unsigned int redraw (uint64_t seed, uint32_t stream, size_t index,
+			unsigned int range, unsigned int threshold) {
+	lanes32_t c0 = {0}, c1 = {0};
+	c0 += (uint32_t)index;
+	c1 += (uint32_t)((uint64_t)index >> 32);
+	for (uint32_t attempt = 0; ; ++attempt) {
+		lanes32_t out[4];
+		/* stream in word 2, redraw space and attempt in word 3 */
+		philox_lanes(seed, &c0, &c1, stream, STREAM_REDRAW + attempt, out);
+		/* every lane holds the same counter, lane 0 is enough */
+		for (int w = 0; w < 4; ++w) {
+			const uint64_t m = (uint64_t)out[w][0] * range;
+			if ((uint32_t)m >= threshold) {
+				return (unsigned int)(m >> 32);
+			}
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Fill out[0..count) with the values of elements first..first+count
+ *  of a stream, mapped into [start, start + range) with Lemire's multiply
+ *  and reject method (range 0 means the full unsigned int range)
+ * INPUTS: Output buffer, index of the first element, number of elements,
+ *  seed, stream, start of the range, size of the range
+ * RETURN: Nothing
+ **/
+
+void prng_fill_range (unsigned int* out, size_t first, size_t count,
+			uint64_t seed, uint32_t stream, unsigned int start, unsigned int range) {
+	/* values below threshold in the low half would bias the result */
+	const unsigned int threshold = range ? (0u - range) % range : 0;
+	const lanes32_t lane_ids = {0, 1, 2, 3, 4, 5, 6, 7};
+
+	size_t block = first / PHILOX_OUTPUTS;
+	size_t skip = first % PHILOX_OUTPUTS;
+	size_t done = 0;
+	while (done < count) {
+		/* each lane counts blocks of 4 outputs */
+		const uint64_t counter = (uint64_t)block * PHILOX_LANES;
+		lanes32_t c0 = lane_ids, c1 = {0};
+		c0 += (uint32_t)counter;
+		c1 += (uint32_t)(counter >> 32);
+		lanes32_t words[4];
+		philox_lanes(seed, &c0, &c1, stream, STREAM_BULK, words);
+
+		uint32_t raw[PHILOX_OUTPUTS];
+		for (int lane = 0; lane < PHILOX_LANES; ++lane) {
+			for (int w = 0; w < 4; ++w) {
+				raw[lane * 4 + w] = words[w][lane];
+			}
+		}
+
+		size_t n = PHILOX_OUTPUTS - skip;
+		if (n > count - done) {
+			n = count - done;
+		}
+		if (range == 0) {
+			memcpy(out + done, raw + skip, n * sizeof(unsigned int));
+		}
+		else {
+			for (size_t i = 0; i < n; ++i) {
+				const uint64_t m = (uint64_t)raw[skip + i] * range;
+				unsigned int value = (unsigned int)(m >> 32);
+				if ((uint32_t)m < threshold) {
+					value = redraw(seed, stream, first + done + i, range, threshold);
+				}
+				out[done + i] = value + start;
+			}
+		}
+		done += n;
+		skip = 0;
+		++block;
+	}
+}
+
+/* 
+ * PURPOSE: Set the seed and restart the stream sequence
+ * INPUTS: Seed
+ * RETURN: Nothing
+ **/
+
+void seed_prng (uint64_t seed) {
+	current_seed = seed;
+	next_stream = 0;
+}
+
+/* 
+ * PURPOSE: Seed set by the last seed_prng call
+ * INPUTS: Nothing
+ * RETURN: Seed
+ **/
+
+uint64_t prng_seed (void) {
+	return current_seed;
+}
+
+/* 
+ * PURPOSE: Hand out the stream for the next fill
+ * INPUTS: Nothing
+ * RETURN: Stream number
+ **/
+
+uint32_t prng_next_stream (void) {
+	return next_stream++;
+}
@@ -0,0 +1,20 @@
+#ifndef _PRNG_H_
+#define _PRNG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Philox4x32-10 counter-based generator. Every output is a pure function of
+ * (seed, stream, element index), so a matrix can be filled in any order, by
+ * any number of threads, and still come out identical for a given seed.
+ * Each random_matrix call takes the next stream, which seed_prng resets.
+ */
+
+void seed_prng (uint64_t seed);
+uint64_t prng_seed (void);
+uint32_t prng_next_stream (void);
+void prng_fill_range (unsigned int* out, size_t first, size_t count,
+			uint64_t seed, uint32_t stream, unsigned int start, unsigned int range);
+
+#endif
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "registry.h"
+#include "stats.h"
+
+#define REGISTRY_MIN_CAPACITY 16
+
+/* marks a deleted slot so probe chains running through it stay intact */
+static Matrix_t tombstone;
+#define REGISTRY_TOMBSTONE (&tombstone)
+
+/* 
+ * PURPOSE: FNV-1a hash of a matrix name
+ * INPUTS: NUL terminated name
+ * RETURN: 64-bit hash of the name
+ **/
+
+static uint64_t hash_name (const char* name) {
+	uint64_t hash = 14695981039346656037ull;
+	for (const unsigned char* p = (const unsigned char*)name; *p; ++p) {
+		hash ^= *p;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/* 
+ * PURPOSE: Locate the slot holding name, or the slot it should be inserted into
+ * INPUTS: Address of registry, name to look for, its hash, set to true if found
+ * RETURN: Index of the matching slot if found, else of the first free or
+ *  deleted slot on its probe chain
+ **/
+
+static size_t find_slot (Registry_t* reg, const char* name, uint64_t hash, bool* found) {
+	const size_t mask = reg->capacity - 1;
+	size_t insert_at = reg->capacity;
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		Registry_slot_t* slot = &reg->slots[i];
+		if (slot->matrix == NULL) {
+			*found = false;
+			return insert_at < reg->capacity ? insert_at : i;
+		}
+		if (slot->matrix == REGISTRY_TOMBSTONE) {
+			if (insert_at == reg->capacity) {
+				insert_at = i;
+			}
+		}
+		else if (slot->hash == hash
+			&& strncmp(slot->matrix->name, name, MATRIX_NAME_LEN) == 0) {
+			*found = true;
+			return i;
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Rehash every live entry into a new table, dropping tombstones
+ * INPUTS: Address of registry, new capacity (power of two)
+ * RETURN: True if the table was rebuilt, false if it couldn't be allocated
+ **/
+
+static bool rehash (Registry_t* reg, size_t capacity) {
+	Registry_slot_t* old_slots = reg->slots;
+	const size_t old_capacity = reg->capacity;
+
+	Registry_slot_t* slots = calloc(capacity, sizeof(Registry_slot_t));
+	if (!slots) {
+		return false;
+	}
+	reg->slots = slots;
+	reg->capacity = capacity;
+	reg->tombstones = 0;
+
+	const size_t mask = capacity - 1;
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (old_slots[i].matrix == NULL || old_slots[i].matrix == REGISTRY_TOMBSTONE) {
+			continue;
+		}
+		size_t j = old_slots[i].hash & mask;
+		while (slots[j].matrix != NULL) {
+			j = (j + 1) & mask;
+		}
+		slots[j] = old_slots[i];
+	}
+	free(old_slots);
+	return true;
+}
+
+/* 
+ * PURPOSE: Allocate an empty registry
+ * INPUTS: Address to address of registry to populate, expected number of matrices
+ * RETURN: True if the registry was created, else false
+ **/
+
+bool create_registry (Registry_t** reg, size_t initial_capacity) {
+	if (reg == NULL) return false;
+
+	size_t capacity = REGISTRY_MIN_CAPACITY;
+	while (capacity < initial_capacity * 2) {
+		capacity *= 2;
+	}
+
+	*reg = calloc(1, sizeof(Registry_t));
+	if (!(*reg)) {
+		return false;
+	}
+	(*reg)->slots = calloc(capacity, sizeof(Registry_slot_t));
+	if (!(*reg)->slots) {
+		free(*reg);
+		*reg = NULL;
+		return false;
+	}
+	(*reg)->capacity = capacity;
+	return true;
+}
+
+/* 
+ * PURPOSE: Free the registry and every matrix still held in it
+ * INPUTS: Address to address of registry
+ * RETURN: Nothing
+ **/
+
+void destroy_registry (Registry_t** reg) {
+	if (reg == NULL || *reg == NULL) return;
+
+	for (size_t i = 0; i < (*reg)->capacity; ++i) {
+		Matrix_t* m = (*reg)->slots[i].matrix;
+		if (m != NULL && m != REGISTRY_TOMBSTONE) {
+			destroy_matrix(&m);
+		}
+	}
+	free((*reg)->slots);
+	free(*reg);
+	*reg = NULL;
+}
+
+/* 
+ * PURPOSE: Look up a matrix by its exact name
+ * INPUTS: Address of registry, name of matrix
+ * RETURN: Address of the matrix, NULL if there is no matrix with that name
+ **/
+
+Matrix_t* registry_find (Registry_t* reg, const char* name) {
+	STATS_SCOPE(scope, STAT_LOOKUP);
+	if (reg == NULL || name == NULL) return NULL;
+
+	bool found = false;
+	size_t i = find_slot(reg, name, hash_name(name), &found);
+	return found ? reg->slots[i].matrix : NULL;
+}
+
+/* 
+ * PURPOSE: Add a matrix under its name, destroying any matrix it replaces.
+ *  The registry takes ownership of the matrix.
+ * INPUTS: Address of registry, address of matrix
+ * RETURN: True if the matrix was stored, false if the table couldn't grow
+ **/
+
+bool registry_insert (Registry_t* reg, Matrix_t* m) {
+	if (reg == NULL || m == NULL) return false;
+
+	if ((reg->count + reg->tombstones + 1) * 10 > reg->capacity * 7) {
+		size_t capacity = reg->capacity;
+		if ((reg->count + 1) * 10 > capacity * 7 / 2) {
+			capacity *= 2; /* otherwise mostly tombstones, rebuild in place */
+		}
+		if (!rehash(reg, capacity)) {
+			return false;
+		}
+	}
+
+	const uint64_t hash = hash_name(m->name);
+	bool found = false;
+	size_t i = find_slot(reg, m->name, hash, &found);
+	Registry_slot_t* slot = &reg->slots[i];
+	if (found) {
+		if (slot->matrix != m) {
+			destroy_matrix(&slot->matrix);
+		}
+	}
+	else {
+		if (slot->matrix == REGISTRY_TOMBSTONE) {
+			reg->tombstones--;
+		}
+		reg->count++;
+	}
+	slot->hash = hash;
+	slot->matrix = m;
+	return true;
+}
+
+/* 
+ * PURPOSE: Destroy the matrix with the given name and drop it from the registry
+ * INPUTS: Address of registry, name of matrix
+ * RETURN: True if a matrix was removed, false if none had that name
+ **/
+
+bool registry_remove (Registry_t* reg, const char* name) {
+	if (reg == NULL || name == NULL) return false;
+
+	bool found = false;
+	size_t i = find_slot(reg, name, hash_name(name), &found);
+	if (!found) {
+		return false;
+	}
+	destroy_matrix(&reg->slots[i].matrix);
+	reg->slots[i].matrix = REGISTRY_TOMBSTONE;
+	reg->count--;
+	reg->tombstones++;
+	return true;
+}
+
+/* 
+ * PURPOSE: Iterate over the registry in table order
+ * INPUTS: Address of registry, cursor which must start at 0
+ * RETURN: Next matrix, NULL once every matrix has been visited
+ **/
+
+Matrix_t* registry_next (Registry_t* reg, size_t* cursor) {
+	if (reg == NULL || cursor == NULL) return NULL;
+
+	while (*cursor < reg->capacity) {
+		Matrix_t* m = reg->slots[(*cursor)++].matrix;
+		if (m != NULL && m != REGISTRY_TOMBSTONE) {
+			return m;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef _REGISTRY_H_
+#define _REGISTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+/*
+ * Workspace of named matrices. Open addressing with linear probing over a
+ * power of two table that doubles once it is 70% full (live + deleted
+ * slots), so lookups, inserts, replacements and deletes are O(1) on average.
+ */
+
+typedef struct {
+	uint64_t hash;
+	Matrix_t* matrix; /* NULL for empty, REGISTRY_TOMBSTONE for deleted */
+}Registry_slot_t;
+
+typedef struct {
+	Registry_slot_t* slots;
+	size_t capacity;
+	size_t count;
+	size_t tombstones;
+}Registry_t;
+
+bool create_registry (Registry_t** reg, size_t initial_capacity);
+void destroy_registry (Registry_t** reg);
+Matrix_t* registry_find (Registry_t* reg, const char* name);
+bool registry_insert (Registry_t* reg, Matrix_t* m);
+bool registry_remove (Registry_t* reg, const char* name);
+Matrix_t* registry_next (Registry_t* reg, size_t* cursor);
+
+#endif
@@ -0,0 +1,864 @@
+#define _GNU_SOURCE /* splice, memfd_create, accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "io_ring.h"
+#include "stats.h"
+
+/* bytes asked of one splice or sendfile call, and the pipe size splice goes through */
+#define SERVER_SPLICE_CHUNK (1 << 20)
+#define SERVER_EVENTS 64
+
+typedef struct Server_client {
+	int fd;
+	struct Server_client* next; /* in the ready queue */
+	struct Server_client* prev_open; /* in the list of connected clients */
+	struct Server_client* next_open;
+}Server_client_t;
+
+typedef struct {
+	const Server_workspace_t* ws;
+	int epoll_fd;
+	bool stopping;
+	Server_client_t* ready_head; /* clients with a request waiting, oldest first */
+	Server_client_t* ready_tail;
+	Server_client_t* open; /* every connected client */
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_rwlock_t workspace_lock;
+}Server_t;
+
+typedef struct {
+	Server_t* server;
+	pthread_t thread;
+	Commands_t cmd; /* reused for every request, like the batch queue slots */
+	char* line;
+	size_t line_cap;
+}Server_worker_t;
+
+/* written by the SIGINT and SIGTERM handler to stop the event loop */
+static int stop_event = -1;
+
+/*
+ * PURPOSE: Signal handler of a running server, wakes the event loop
+ * INPUTS: Signal number
+ * RETURN: Nothing
+ **/
+
+static void request_stop (int sig) {
+	(void)sig;
+	const int saved = errno;
+	const uint64_t one = 1;
+	if (write(stop_event, &one, sizeof(one)) < 0) {
+		/* the counter is already non-zero, the loop wakes anyway */
+	}
+	errno = saved;
+}
+
+/*
+ * PURPOSE: Read exactly len bytes from a socket
+ * INPUTS: Socket, destination, length
+ * RETURN: True if everything arrived, false on error, timeout or end of stream
+ **/
+
+static bool recv_all (int fd, void* buf, size_t len) {
+	unsigned char* p = buf;
+	while (len > 0) {
+		ssize_t got = recv(fd, p, len, 0);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		p += got;
+		len -= got;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Send a frame header followed by a payload held in memory
+ * INPUTS: Socket, frame type, status, payload (NULL sends just the header,
+ *  the caller then streams the len bytes itself), payload length
+ * RETURN: True if sent, else false
+ **/
+
+static bool send_frame (int fd, uint32_t type, uint32_t status, const void* payload, size_t len) {
+	Server_frame_t frame = {type, status, len};
+	struct iovec iov[2] = {
+		{&frame, sizeof(frame)},
+		{(void*)payload, len},
+	};
+	return write_all(fd, iov, payload && len ? 2 : 1);
+}
+
+/*
+ * PURPOSE: Move len bytes from the current position of one descriptor to
+ *  another through a user space buffer, for ends splice can't handle
+ * INPUTS: Source, destination, byte count
+ * RETURN: True if every byte was moved, else false
+ **/
+
+static bool copy_all (int in, int out, uint64_t len) {
+	unsigned char buf[1 << 16];
+	while (len > 0) {
+		ssize_t got = read(in, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		struct iovec iov = {buf, got};
+		if (!write_all(out, &iov, 1)) {
+			return false;
+		}
+		len -= got;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Move len bytes from one descriptor to another through a pipe
+ *  with splice, so the payload never passes through user space
+ * INPUTS: Source, destination, byte count
+ * RETURN: True if every byte was moved, else false
+ **/
+
+static bool splice_all (int in, int out, uint64_t len) {
+	int pipe_fds[2];
+	if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+		return false;
+	}
+	/* best effort, unprivileged processes may be held to a smaller pipe */
+	fcntl(pipe_fds[1], F_SETPIPE_SZ, SERVER_SPLICE_CHUNK);
+
+	bool ok = true;
+	bool first = true;
+	while (ok && len > 0) {
+		const size_t want = len < SERVER_SPLICE_CHUNK ? len : SERVER_SPLICE_CHUNK;
+		ssize_t got = splice(in, NULL, pipe_fds[1], NULL, want, SPLICE_F_MOVE);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got < 0 && errno == EINVAL && first) {
+			/* nothing is in the pipe yet, take the slow path for all of it */
+			ok = copy_all(in, out, len);
+			break;
+		}
+		if (got <= 0) {
+			ok = false;
+			break;
+		}
+		first = false;
+		len -= got;
+		while (got > 0) {
+			ssize_t put = splice(pipe_fds[0], NULL, out, NULL, got, SPLICE_F_MOVE);
+			if (put < 0 && errno == EINTR) {
+				continue;
+			}
+			if (put <= 0) {
+				ok = false;
+				break;
+			}
+			got -= put;
+		}
+	}
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+	return ok;
+}
+
+/*
+ * PURPOSE: Send len bytes of a file from its start with sendfile
+ * INPUTS: Socket, file, byte count
+ * RETURN: True if every byte was sent, else false
+ **/
+
+static bool sendfile_all (int out, int in, uint64_t len) {
+	off_t offset = 0;
+	while (len > 0) {
+		const size_t want = len < SERVER_SPLICE_CHUNK ? len : SERVER_SPLICE_CHUNK;
+		ssize_t sent = sendfile(out, in, &offset, want);
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent < 0 && (errno == EINVAL || errno == ENOSYS) && offset == 0) {
+			return lseek(in, 0, SEEK_SET) == 0 && copy_all(in, out, len);
+		}
+		if (sent <= 0) {
+			return false;
+		}
+		len -= sent;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Receive a request payload that is a line of text
+ * INPUTS: Address of the worker, socket, payload length
+ * RETURN: True with the NUL terminated line in w->line, false if it is too
+ *  long or didn't arrive
+ **/
+
+static bool recv_line (Server_worker_t* w, int fd, uint64_t len) {
+	if (len > SERVER_MAX_LINE) {
+		return false;
+	}
+	if (len + 1 > w->line_cap) {
+		char* line = realloc(w->line, len + 1);
+		if (!line) {
+			return false;
+		}
+		w->line = line;
+		w->line_cap = len + 1;
+	}
+	if (!recv_all(fd, w->line, len)) {
+		return false;
+	}
+	w->line[len] = '\0';
+	return true;
+}
+
+/*
+ * PURPOSE: Run a command under the exclusive workspace lock and send back
+ *  what it printed
+ * INPUTS: Address of the worker, socket, payload length
+ * RETURN: True if answered, false if the client has to be dropped
+ **/
+
+static bool serve_command (Server_worker_t* w, int fd, uint64_t len) {
+	Server_t* s = w->server;
+	if (!recv_line(w, fd, len)) {
+		return false;
+	}
+	char* text = NULL;
+	size_t text_len = 0;
+	FILE* out = open_memstream(&text, &text_len);
+	if (out == NULL) {
+		return false;
+	}
+	if (!parse_user_input(w->line, &w->cmd)) {
+		fprintf(out, "Failed at parsing command (%s)\n", strerror(errno));
+	}
+	else if (w->cmd.num_cmds > 0) {
+		pthread_rwlock_wrlock(&s->workspace_lock);
+		s->ws->run(&w->cmd, out, s->ws->ctx);
+		pthread_rwlock_unlock(&s->workspace_lock);
+	}
+	if (fclose(out) != 0) {
+		free(text);
+		return false;
+	}
+	const bool sent = send_frame(fd, SERVER_OUTPUT, 0, text, text_len);
+	free(text);
+	return sent;
+}
+
+/*
+ * PURPOSE: Take an uploaded matrix file into the workspace. The payload is
+ *  spliced into a memfd and mapped in place like read --map maps a file,
+ *  and what the decoder prints goes back to the client with the reply.
+ * INPUTS: Address of the worker, socket, payload length
+ * RETURN: True if answered, false if the client has to be dropped
+ **/
+
+static bool serve_upload (Server_worker_t* w, int fd, uint64_t len) {
+	STATS_SCOPE(scope, STAT_SERVER_UPLOAD);
+	Server_t* s = w->server;
+	const int file = memfd_create("matlab-upload", MFD_CLOEXEC);
+	if (file < 0) {
+		perror("memfd_create");
+		return false;
+	}
+	if (!splice_all(fd, file, len)) {
+		close(file);
+		return false;
+	}
+	scope.bytes = len;
+
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", file);
+	char* text = NULL;
+	size_t text_len = 0;
+	FILE* out = open_memstream(&text, &text_len);
+	if (out == NULL) {
+		close(file);
+		return false;
+	}
+	Matrix_t* m = NULL;
+	/* packed files decode on the thread pool, which a command may be resizing */
+	set_matrix_messages(out);
+	pthread_rwlock_rdlock(&s->workspace_lock);
+	const bool decoded = read_matrix_mmap(path, &m);
+	pthread_rwlock_unlock(&s->workspace_lock);
+	close(file);
+
+	bool stored = false;
+	char name[MATRIX_NAME_LEN] = "";
+	if (decoded) {
+		/* the registry owns m once stored, or has destroyed it */
+		memcpy(name, m->name, sizeof(name));
+		pthread_rwlock_wrlock(&s->workspace_lock);
+		stored = s->ws->store(m, s->ws->ctx);
+		pthread_rwlock_unlock(&s->workspace_lock);
+	}
+	set_matrix_messages(NULL);
+	if (stored) {
+		fprintf(out, "Matrix (%s) is uploaded\n", name);
+	}
+	else {
+		fprintf(out, "Upload Failed\n");
+	}
+	if (fclose(out) != 0) {
+		free(text);
+		return false;
+	}
+	const bool sent = send_frame(fd, SERVER_OUTPUT, !stored, text, text_len);
+	free(text);
+	return sent;
+}
+
+/*
+ * PURPOSE: Send a matrix to the client as write would save it. The matrix
+ *  is written to a memfd under the shared workspace lock, then sent with
+ *  sendfile once the lock is released.
+ * INPUTS: Address of the worker, socket, payload length
+ * RETURN: True if answered, false if the client has to be dropped
+ **/
+
+static bool serve_download (Server_worker_t* w, int fd, uint64_t len) {
+	STATS_SCOPE(scope, STAT_SERVER_DOWNLOAD);
+	Server_t* s = w->server;
+	if (!recv_line(w, fd, len)) {
+		return false;
+	}
+	char reply[MATRIX_NAME_LEN + 64];
+	const Commands_t* cmd = &w->cmd;
+	if (!parse_user_input(w->line, &w->cmd) || cmd->num_cmds < 1 || cmd->num_cmds > 2
+		|| (cmd->num_cmds == 2 && strcmp(cmd->cmds[1], "compress") != 0)) {
+		snprintf(reply, sizeof(reply), "Not a command in this application\n");
+		return send_frame(fd, SERVER_OUTPUT, 1, reply, strlen(reply));
+	}
+	/* the memfd is new, no rename is needed to keep mappings of it intact */
+	const unsigned int flags = WRITE_MATRIX_IN_PLACE
+		| (cmd->num_cmds == 2 ? WRITE_MATRIX_COMPRESS : WRITE_MATRIX_DEFAULT);
+
+	const int file = memfd_create("matlab-download", MFD_CLOEXEC);
+	if (file < 0) {
+		perror("memfd_create");
+		return false;
+	}
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", file);
+	pthread_rwlock_rdlock(&s->workspace_lock);
+	Matrix_t* m = s->ws->find(cmd->cmds[0], s->ws->ctx);
+	const bool written = m && write_matrix_ex(path, m, flags);
+	pthread_rwlock_unlock(&s->workspace_lock);
+
+	struct stat st;
+	if (!written || fstat(file, &st) != 0) {
+		close(file);
+		if (m) {
+			snprintf(reply, sizeof(reply), "Download Failed\n");
+		}
+		else {
+			snprintf(reply, sizeof(reply), "Matrix (%.*s) doesn't exist\n", MATRIX_NAME_LEN, cmd->cmds[0]);
+		}
+		return send_frame(fd, SERVER_OUTPUT, 1, reply, strlen(reply));
+	}
+	scope.bytes = st.st_size;
+	const bool sent = send_frame(fd, SERVER_MATRIX, 0, NULL, st.st_size)
+		&& sendfile_all(fd, file, st.st_size);
+	close(file);
+	return sent;
+}
+
+/*
+ * PURPOSE: Read one request from a client and answer it
+ * INPUTS: Address of the worker, socket of the client
+ * RETURN: True if the client can send another request, false if it left or
+ *  has to be dropped (an unknown frame can't be skipped reliably)
+ **/
+
+static bool serve_request (Server_worker_t* w, int fd) {
+	Server_frame_t frame;
+	if (!recv_all(fd, &frame, sizeof(frame))) {
+		return false;
+	}
+	switch (frame.type) {
+		case SERVER_COMMAND: return serve_command(w, fd, frame.length);
+		case SERVER_UPLOAD: return serve_upload(w, fd, frame.length);
+		case SERVER_DOWNLOAD: return serve_download(w, fd, frame.length);
+		default: return false;
+	}
+}
+
+/*
+ * PURPOSE: Disconnect a client and forget it
+ * INPUTS: Address of the server, address of the client
+ * RETURN: Nothing
+ **/
+
+static void close_client (Server_t* s, Server_client_t* c) {
+	pthread_mutex_lock(&s->lock);
+	if (c->prev_open) {
+		c->prev_open->next_open = c->next_open;
+	}
+	else {
+		s->open = c->next_open;
+	}
+	if (c->next_open) {
+		c->next_open->prev_open = c->prev_open;
+	}
+	pthread_mutex_unlock(&s->lock);
+	/* closing also takes it out of the epoll set */
+	close(c->fd);
+	free(c);
+}
+
+/*
+ * PURPOSE: Worker thread, answers one request of a ready client at a time
+ *  and hands the client back to the event loop
+ * INPUTS: Address of the Server_worker_t
+ * RETURN: NULL
+ **/
+
+static void* worker_main (void* arg) {
+	Server_worker_t* w = arg;
+	Server_t* s = w->server;
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (s->ready_head == NULL && !s->stopping) {
+			pthread_cond_wait(&s->work_ready, &s->lock);
+		}
+		if (s->stopping) {
+			break;
+		}
+		Server_client_t* c = s->ready_head;
+		s->ready_head = c->next;
+		if (s->ready_head == NULL) {
+			s->ready_tail = NULL;
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		bool keep = serve_request(w, c->fd);
+		if (keep) {
+			struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = c};
+			keep = epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == 0;
+		}
+		if (!keep) {
+			close_client(s, c);
+		}
+		pthread_mutex_lock(&s->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+	io_ring_release();
+	return NULL;
+}
+
+/*
+ * PURPOSE: Accept every pending connection and start watching it
+ * INPUTS: Address of the server, listening socket
+ * RETURN: Nothing
+ **/
+
+static void accept_clients (Server_t* s, int listen_fd) {
+	for (;;) {
+		/* blocking, a worker reads a whole request once epoll says it started */
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("accept");
+			}
+			return;
+		}
+		const struct timeval timeout = {SERVER_IO_TIMEOUT, 0};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		Server_client_t* c = calloc(1, sizeof(Server_client_t));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		pthread_mutex_lock(&s->lock);
+		c->next_open = s->open;
+		if (s->open) {
+			s->open->prev_open = c;
+		}
+		s->open = c;
+		pthread_mutex_unlock(&s->lock);
+
+		struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = c};
+		if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			close_client(s, c);
+		}
+	}
+}
+
+/*
+ * PURPOSE: Create the listening socket, replacing a stale socket file left
+ *  by an earlier server (any other file at path is left alone)
+ * INPUTS: Socket path
+ * RETURN: The socket, or -1 on failure
+ **/
+
+static int listen_on (const char* path) {
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SERVER_BACKLOG) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * PURPOSE: Serve the workspace on a Unix domain socket until SIGINT or
+ *  SIGTERM. Requests already being answered are finished, clients are then
+ *  disconnected and the socket file removed.
+ * INPUTS: Socket path, workspace callbacks
+ * RETURN: True after a clean stop, false if the server couldn't start
+ **/
+
+bool run_server (const char* path, const Server_workspace_t* ws) {
+	if (path == NULL || ws == NULL) return false;
+
+	Server_t s = {.ws = ws, .epoll_fd = -1};
+	Server_worker_t workers[SERVER_WORKERS];
+	memset(workers, 0, sizeof(workers));
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	/* a stream of uploads must not keep commands waiting */
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&s.workspace_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.work_ready, NULL);
+
+	bool ok = false;
+	unsigned int started = 0;
+	struct sigaction stop_action = {.sa_handler = request_stop};
+	struct sigaction ignore_action = {.sa_handler = SIG_IGN};
+	struct sigaction old_int, old_term, old_pipe;
+	sigemptyset(&stop_action.sa_mask);
+	sigemptyset(&ignore_action.sa_mask);
+
+	const int listen_fd = listen_on(path);
+	stop_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	s.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (listen_fd < 0 || stop_event < 0 || s.epoll_fd < 0) {
+		goto cleanup;
+	}
+	/* the data pointer tells the two apart from clients */
+	struct epoll_event listen_ev = {.events = EPOLLIN, .data.ptr = (void*)&listen_fd};
+	struct epoll_event stop_ev = {.events = EPOLLIN, .data.ptr = &stop_event};
+	if (epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_ev) != 0
+		|| epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, stop_event, &stop_ev) != 0) {
+		goto cleanup;
+	}
+	for (; started < SERVER_WORKERS; ++started) {
+		workers[started].server = &s;
+		if (pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		goto cleanup;
+	}
+	/* a client that hangs up mid-reply is an error return, not a signal */
+	sigaction(SIGPIPE, &ignore_action, &old_pipe);
+	sigaction(SIGINT, &stop_action, &old_int);
+	sigaction(SIGTERM, &stop_action, &old_term);
+	printf("Serving the workspace on (%s)\n", path);
+	fflush(stdout);
+
+	ok = true;
+	bool stopping = false;
+	while (!stopping) {
+		struct epoll_event events[SERVER_EVENTS];
+		int n = epoll_wait(s.epoll_fd, events, SERVER_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.ptr == &stop_event) {
+				stopping = true;
+			}
+			else if (events[i].data.ptr == &listen_fd) {
+				accept_clients(&s, listen_fd);
+			}
+			else {
+				/* one shot, the client isn't watched again until a worker re-arms it */
+				Server_client_t* c = events[i].data.ptr;
+				c->next = NULL;
+				pthread_mutex_lock(&s.lock);
+				if (s.ready_tail) {
+					s.ready_tail->next = c;
+				}
+				else {
+					s.ready_head = c;
+				}
+				s.ready_tail = c;
+				pthread_cond_signal(&s.work_ready);
+				pthread_mutex_unlock(&s.lock);
+			}
+		}
+	}
+
+	/* workers finish the request they are on, a half sent request ends at once */
+	pthread_mutex_lock(&s.lock);
+	s.stopping = true;
+	for (Server_client_t* c = s.open; c; c = c->next_open) {
+		shutdown(c->fd, SHUT_RD);
+	}
+	pthread_cond_broadcast(&s.work_ready);
+	pthread_mutex_unlock(&s.lock);
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+	sigaction(SIGPIPE, &old_pipe, NULL);
+
+cleanup:
+	if (!ok) {
+		perror("Failed to start the server");
+		s.stopping = true;
+	}
+	for (unsigned int i = 0; i < started; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		destroy_commands(&workers[i].cmd);
+		free(workers[i].line);
+	}
+	while (s.open) {
+		close_client(&s, s.open);
+	}
+	if (s.epoll_fd >= 0) {
+		close(s.epoll_fd);
+	}
+	if (stop_event >= 0) {
+		close(stop_event);
+		stop_event = -1;
+	}
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		unlink(path);
+	}
+	pthread_cond_destroy(&s.work_ready);
+	pthread_mutex_destroy(&s.lock);
+	pthread_rwlock_destroy(&s.workspace_lock);
+	return ok;
+}
+
+/*
+ * PURPOSE: Receive a SERVER_OUTPUT payload and print it
+ * INPUTS: Socket, frame header already received
+ * RETURN: True if it arrived, else false
+ **/
+
+static bool print_output (int fd, const Server_frame_t* frame) {
+	char* text = malloc(frame->length ? frame->length : 1);
+	if (!text || !recv_all(fd, text, frame->length)) {
+		free(text);
+		return false;
+	}
+	fwrite(text, 1, frame->length, stdout);
+	free(text);
+	return true;
+}
+
+/*
+ * PURPOSE: Receive the reply to a request and print it
+ * INPUTS: Socket
+ * RETURN: True if a reply arrived, else false
+ **/
+
+static bool print_reply (int fd) {
+	Server_frame_t frame;
+	return recv_all(fd, &frame, sizeof(frame)) && frame.type == SERVER_OUTPUT
+		&& print_output(fd, &frame);
+}
+
+/*
+ * PURPOSE: Upload a matrix file, sent straight from the page cache with sendfile
+ * INPUTS: Socket, filename
+ * RETURN: True if the connection is still usable, else false
+ **/
+
+static bool upload_file (int fd, const char* filename) {
+	const int file = open(filename, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (file < 0 || fstat(file, &st) != 0) {
+		printf("FAILED TO OPEN FOR READING\n");
+		if (file >= 0) {
+			close(file);
+		}
+		return true;
+	}
+	const bool sent = send_frame(fd, SERVER_UPLOAD, 0, NULL, st.st_size)
+		&& sendfile_all(fd, file, st.st_size);
+	close(file);
+	return sent && print_reply(fd);
+}
+
+/*
+ * PURPOSE: Download a matrix into a file, spliced from the socket
+ * INPUTS: Socket, matrix name, filename, whether to ask for the packed format
+ * RETURN: True if the connection is still usable, else false
+ **/
+
+static bool download_file (int fd, const char* name, const char* filename, bool compress) {
+	char request[MATRIX_NAME_LEN + sizeof(" compress")];
+	if (strlen(name) + 1 > MATRIX_NAME_LEN) {
+		printf("Not a command in this application\n");
+		return true;
+	}
+	snprintf(request, sizeof(request), "%s%s", name, compress ? " compress" : "");
+	Server_frame_t frame;
+	if (!send_frame(fd, SERVER_DOWNLOAD, 0, request, strlen(request))
+		|| !recv_all(fd, &frame, sizeof(frame))) {
+		return false;
+	}
+	if (frame.type != SERVER_MATRIX) {
+		return frame.type == SERVER_OUTPUT && print_output(fd, &frame);
+	}
+	/* written next to filename and renamed over it, a server may have it mapped */
+	char tmp_name[PATH_MAX];
+	const bool named = snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename) < (int)sizeof(tmp_name);
+	const int file = named ? open(tmp_name, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644) : -1;
+	if (file < 0) {
+		printf("FAILED TO CREATE/OPEN FILE FOR WRITING\n");
+		/* the matrix still has to come off the socket */
+		const int sink = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		const bool drained = sink >= 0 && splice_all(fd, sink, frame.length);
+		if (sink >= 0) {
+			close(sink);
+		}
+		return drained;
+	}
+	const bool received = splice_all(fd, file, frame.length);
+	if (close(file) == 0 && received && rename(tmp_name, filename) == 0) {
+		printf("Matrix (%s) is downloaded to (%s)\n", name, filename);
+	}
+	else {
+		unlink(tmp_name);
+	}
+	return received;
+}
+
+/*
+ * PURPOSE: Client of a running server. Reads command lines from input and
+ *  prints what the server answers; upload <file> and download <matrix>
+ *  <file> [compress] move matrix files, exit or the end of input leaves.
+ * INPUTS: Socket path, stream of command lines
+ * RETURN: True if input ran out or said exit, false if the connection failed
+ **/
+
+bool run_client (const char* path, FILE* input) {
+	if (path == NULL || input == NULL) return false;
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		perror("Failed to connect to the server");
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		perror("Failed to connect to the server");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	const bool prompt = isatty(fileno(input));
+	Commands_t cmd = {0};
+	char* line = NULL;
+	size_t line_cap = 0;
+	bool ok = true;
+	for (;;) {
+		if (prompt) {
+			printf("> ");
+			fflush(stdout);
+		}
+		ssize_t len = getline(&line, &line_cap, input);
+		if (len < 0) {
+			break;
+		}
+		if (len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+		if (!parse_user_input(line, &cmd)) {
+			printf("Failed at parsing command (%s)\n\n", strerror(errno));
+			continue;
+		}
+		if (cmd.num_cmds == 0) {
+			continue;
+		}
+		if (strcmp(cmd.cmds[0], "exit") == 0) {
+			break;
+		}
+		if (strcmp(cmd.cmds[0], "upload") == 0 && cmd.num_cmds == 2) {
+			ok = upload_file(fd, cmd.cmds[1]);
+		}
+		else if (strcmp(cmd.cmds[0], "download") == 0 && (cmd.num_cmds == 3
+			|| (cmd.num_cmds == 4 && strcmp(cmd.cmds[3], "compress") == 0))) {
+			ok = download_file(fd, cmd.cmds[1], cmd.cmds[2], cmd.num_cmds == 4);
+		}
+		else {
+			ok = send_frame(fd, SERVER_COMMAND, 0, line, len) && print_reply(fd);
+		}
+		fflush(stdout);
+		if (!ok) {
+			perror("Lost the connection to the server");
+			break;
+		}
+	}
+	free(line);
+	destroy_commands(&cmd);
+	close(fd);
+	return ok;
+}
@@ -0,0 +1,56 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "command.h"
+#include "matrix.h"
+
+/*
+ * Resident workspace behind a Unix domain socket. An epoll loop on the
+ * calling thread accepts clients and waits for their requests; a client
+ * with a request is handed to one of SERVER_WORKERS threads, which reads
+ * that one request, answers it and gives the client back to the loop.
+ * Commands run one at a time under the workspace lock and still spread
+ * over the thread pool. Matrix uploads and downloads move between the
+ * socket and a memfd with splice and sendfile, and only hold the lock,
+ * shared, while the matrix is decoded or encoded.
+ */
+
+#define SERVER_WORKERS 4
+#define SERVER_BACKLOG 64
+#define SERVER_MAX_LINE (1 << 16) /* longest command or download request */
+#define SERVER_IO_TIMEOUT 30 /* seconds a worker waits on a stalled client */
+
+/* every frame starts with this header, in host byte order, then length payload bytes */
+typedef struct {
+	uint32_t type;
+	uint32_t status; /* 0 in requests and in replies that succeeded */
+	uint64_t length;
+}Server_frame_t;
+
+/* requests */
+#define SERVER_COMMAND 1 /* a command line, answered with SERVER_OUTPUT */
+#define SERVER_UPLOAD 2 /* a matrix file in any format read takes, answered with SERVER_OUTPUT */
+#define SERVER_DOWNLOAD 3 /* matrix name [compress], answered with SERVER_MATRIX or a failed SERVER_OUTPUT */
+/* replies */
+#define SERVER_OUTPUT 4 /* what the request printed */
+#define SERVER_MATRIX 5 /* the matrix as write saves it */
+
+/*
+ * The workspace the server serves. run and store are called with the lock
+ * held exclusively, find with it held shared.
+ */
+typedef struct {
+	void (*run) (Commands_t* cmd, FILE* out, void* ctx);
+	bool (*store) (Matrix_t* m, void* ctx);
+	Matrix_t* (*find) (const char* name, void* ctx);
+	void* ctx;
+}Server_workspace_t;
+
+bool run_server (const char* path, const Server_workspace_t* ws);
+bool run_client (const char* path, FILE* input);
+
+#endif
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "stats.h"
+
+/* bucket i counts latencies in [2^i, 2^(i+1)) ns, bucket 0 also holds 0 ns */
+#define STAT_BUCKETS 64
+
+typedef struct {
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[STAT_BUCKETS];
+}Stat_counter_t;
+
+typedef struct Stat_thread {
+	struct Stat_thread* next;
+	Stat_counter_t counters[STAT_COUNT];
+}Stat_thread_t;
+
+static const char* stat_names[STAT_COUNT] = {
+	[STAT_CMD_DISPLAY] = "cmd display",
+	[STAT_CMD_ADD] = "cmd add",
+	[STAT_CMD_MUL] = "cmd mul",
+	[STAT_CMD_DUPLICATE] = "cmd duplicate",
+	[STAT_CMD_EQUAL] = "cmd equal",
+	[STAT_CMD_SHIFT] = "cmd shift",
+	[STAT_CMD_READ] = "cmd read",
+	[STAT_CMD_MMAP] = "cmd mmap",
+	[STAT_CMD_WRITE] = "cmd write",
+	[STAT_CMD_CREATE] = "cmd create",
+	[STAT_CMD_DELETE] = "cmd delete",
+	[STAT_CMD_RANDOM] = "cmd random",
+	[STAT_CMD_EVAL] = "cmd eval",
+	[STAT_CMD_SUM] = "cmd sum",
+	[STAT_CMD_SAVE] = "cmd save",
+	[STAT_CMD_LOAD] = "cmd load",
+	[STAT_CMD_TRANSPOSE] = "cmd transpose",
+	[STAT_CMD_RESHAPE] = "cmd reshape",
+	[STAT_CMD_DESCRIBE] = "cmd describe",
+	[STAT_CMD_OTHER] = "cmd other",
+	[STAT_PARSE] = "parse",
+	[STAT_LOOKUP] = "lookup",
+	[STAT_ALLOC] = "alloc",
+	[STAT_CREATE_MATRIX] = "create_matrix",
+	[STAT_DESTROY_MATRIX] = "destroy_matrix",
+	[STAT_ADD_MATRICES] = "add_matrices",
+	[STAT_MULTIPLY_MATRICES] = "multiply_matrices",
+	[STAT_SHIFT_MATRIX] = "bitwise_shift",
+	[STAT_RANDOM_MATRIX] = "random_matrix",
+	[STAT_DUPLICATE_MATRIX] = "duplicate_matrix",
+	[STAT_EQUAL_MATRICES] = "equal_matrices",
+	[STAT_DISPLAY_MATRIX] = "display_matrix",
+	[STAT_READ_MATRIX] = "read_matrix",
+	[STAT_READ_MATRIX_MMAP] = "read_matrix_mmap",
+	[STAT_WRITE_MATRIX] = "write_matrix",
+	[STAT_EVAL_EXPRESSION] = "eval_expression",
+	[STAT_SUM_MATRIX] = "sum_matrix",
+	[STAT_SAVE_WORKSPACE] = "save_workspace",
+	[STAT_LOAD_WORKSPACE] = "load_workspace",
+	[STAT_TRANSPOSE_MATRIX] = "transpose_matrix",
+	[STAT_STATS_MATRIX] = "stats_matrix",
+	[STAT_SERVER_UPLOAD] = "server upload",
+	[STAT_SERVER_DOWNLOAD] = "server download",
+};
+
+/* threads only take this lock once, to register their counters */
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static Stat_thread_t* all_threads;
+static __thread Stat_thread_t* local;
+
+/* 
+ * PURPOSE: Read the monotonic clock
+ * INPUTS: Nothing
+ * RETURN: Nanoseconds since an arbitrary fixed point
+ **/
+
+uint64_t stats_now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* 
+ * PURPOSE: Find or create the calling thread's counters. Blocks of exited
+ *  threads stay on the list so their history survives.
+ * INPUTS: Nothing
+ * RETURN: Address of the counters, NULL if they couldn't be allocated
+ **/
+
+static Stat_thread_t* thread_counters (void) {
+	if (local) return local;
+
+	Stat_thread_t* t = calloc(1, sizeof(Stat_thread_t));
+	if (!t) {
+		return NULL;
+	}
+	pthread_mutex_lock(&threads_lock);
+	t->next = all_threads;
+	all_threads = t;
+	pthread_mutex_unlock(&threads_lock);
+	local = t;
+	return t;
+}
+
+/* 
+ * PURPOSE: Record one call of an operation in the calling thread's counters
+ * INPUTS: Operation, its latency, bytes it touched
+ * RETURN: Nothing
+ **/
+
+void stats_record (Stat_id_t id, uint64_t nanoseconds, uint64_t bytes) {
+	if (id >= STAT_COUNT) return;
+
+	Stat_thread_t* t = thread_counters();
+	if (!t) return;
+
+	/* relaxed atomics only so a concurrent stats reader sees whole values */
+	Stat_counter_t* c = &t->counters[id];
+	const unsigned int bucket = nanoseconds ? 63 - __builtin_clzll(nanoseconds) : 0;
+	__atomic_store_n(&c->calls, c->calls + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->bytes, c->bytes + bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->total_ns, c->total_ns + nanoseconds, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->buckets[bucket], c->buckets[bucket] + 1, __ATOMIC_RELAXED);
+	if (nanoseconds > c->max_ns) {
+		__atomic_store_n(&c->max_ns, nanoseconds, __ATOMIC_RELAXED);
+	}
+}
+
+/* 
+ * PURPOSE: Cleanup handler behind STATS_SCOPE
+ * INPUTS: Address of the scope going out of scope
+ * RETURN: Nothing
+ **/
+
+void stats_scope_end (Stat_scope_t* scope) {
+	stats_record(scope->id, stats_now() - scope->start, scope->bytes);
+}
+
+/* 
+ * PURPOSE: Sum one operation's counters over every thread
+ * INPUTS: Operation, address of the counter to fill
+ * RETURN: Nothing
+ **/
+
+static void merge_counters (Stat_id_t id, Stat_counter_t* sum) {
+	memset(sum, 0, sizeof(*sum));
+	pthread_mutex_lock(&threads_lock);
+	for (Stat_thread_t* t = all_threads; t; t = t->next) {
+		const Stat_counter_t* c = &t->counters[id];
+		sum->calls += __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+		sum->bytes += __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+		sum->total_ns += __atomic_load_n(&c->total_ns, __ATOMIC_RELAXED);
+		const uint64_t max = __atomic_load_n(&c->max_ns, __ATOMIC_RELAXED);
+		if (max > sum->max_ns) {
+			sum->max_ns = max;
+		}
+		for (unsigned int b = 0; b < STAT_BUCKETS; ++b) {
+			sum->buckets[b] += __atomic_load_n(&c->buckets[b], __ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&threads_lock);
+}
+
+/* 
+ * PURPOSE: Latency below which a fraction of the calls fall, to bucket precision
+ * INPUTS: Merged counter, fraction between 0 and 1
+ * RETURN: Upper bound of the bucket holding that percentile, capped at the max
+ **/
+
+static uint64_t percentile (const Stat_counter_t* c, double fraction) {
+	const uint64_t target = (uint64_t)(c->calls * fraction + 0.5);
+	uint64_t seen = 0;
+	for (unsigned int b = 0; b < STAT_BUCKETS; ++b) {
+		seen += c->buckets[b];
+		if (seen >= target && seen > 0) {
+			const uint64_t upper = b < 63 ? (2ull << b) - 1 : UINT64_MAX;
+			return upper < c->max_ns ? upper : c->max_ns;
+		}
+	}
+	return c->max_ns;
+}
+
+/* 
+ * PURPOSE: Print a table of every operation that has been called
+ * INPUTS: Stream to print to
+ * RETURN: Nothing
+ **/
+
+void stats_print (FILE* out) {
+	if (out == NULL) return;
+
+	fprintf(out, "%-18s %10s %14s %12s %12s %12s %12s\n",
+		"operation", "calls", "bytes", "mean us", "p50 us", "p99 us", "max us");
+	for (unsigned int id = 0; id < STAT_COUNT; ++id) {
+		Stat_counter_t c;
+		merge_counters(id, &c);
+		if (c.calls == 0) {
+			continue;
+		}
+		fprintf(out, "%-18s %10llu %14llu %12.2f %12.2f %12.2f %12.2f\n", stat_names[id],
+			(unsigned long long)c.calls, (unsigned long long)c.bytes,
+			c.total_ns / 1e3 / c.calls, percentile(&c, 0.50) / 1e3,
+			percentile(&c, 0.99) / 1e3, c.max_ns / 1e3);
+	}
+}
+
+/* 
+ * PURPOSE: Zero every thread's counters. Calls racing with the reset on other
+ *  threads may survive it or be dropped, which is fine for monitoring.
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+void stats_reset (void) {
+	pthread_mutex_lock(&threads_lock);
+	for (Stat_thread_t* t = all_threads; t; t = t->next) {
+		for (unsigned int id = 0; id < STAT_COUNT; ++id) {
+			Stat_counter_t* c = &t->counters[id];
+			__atomic_store_n(&c->calls, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->bytes, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->total_ns, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->max_ns, 0, __ATOMIC_RELAXED);
+			for (unsigned int b = 0; b < STAT_BUCKETS; ++b) {
+				__atomic_store_n(&c->buckets[b], 0, __ATOMIC_RELAXED);
+			}
+		}
+	}
+	pthread_mutex_unlock(&threads_lock);
+}
+
+/* 
+ * PURPOSE: Write the stats table to a file
+ * INPUTS: Filename
+ * RETURN: True if the file was written, else false
+ **/
+
+bool stats_dump (const char* filename) {
+	if (filename == NULL) return false;
+
+	FILE* out = fopen(filename, "w");
+	if (!out) {
+		return false;
+	}
+	stats_print(out);
+	return fclose(out) == 0;
+}
+
+/* 
+ * PURPOSE: Free every thread's counters at shutdown, once no other thread
+ *  will record again
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+void stats_release (void) {
+	pthread_mutex_lock(&threads_lock);
+	while (all_threads) {
+		Stat_thread_t* t = all_threads;
+		all_threads = t->next;
+		free(t);
+	}
+	local = NULL;
+	pthread_mutex_unlock(&threads_lock);
+}
@@ -0,0 +1,79 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Call counts, bytes touched and log2 bucketed latency histograms for every
+ * command and matrix operation. Each thread records into its own counters,
+ * so the hot path never takes a lock; the stats command merges them.
+ */
+
+typedef enum {
+	STAT_CMD_DISPLAY,
+	STAT_CMD_ADD,
+	STAT_CMD_MUL,
+	STAT_CMD_DUPLICATE,
+	STAT_CMD_EQUAL,
+	STAT_CMD_SHIFT,
+	STAT_CMD_READ,
+	STAT_CMD_MMAP,
+	STAT_CMD_WRITE,
+	STAT_CMD_CREATE,
+	STAT_CMD_DELETE,
+	STAT_CMD_RANDOM,
+	STAT_CMD_EVAL,
+	STAT_CMD_SUM,
+	STAT_CMD_SAVE,
+	STAT_CMD_LOAD,
+	STAT_CMD_TRANSPOSE,
+	STAT_CMD_RESHAPE,
+	STAT_CMD_DESCRIBE,
+	STAT_CMD_OTHER,
+	STAT_PARSE,
+	STAT_LOOKUP,
+	STAT_ALLOC,
+	STAT_CREATE_MATRIX,
+	STAT_DESTROY_MATRIX,
+	STAT_ADD_MATRICES,
+	STAT_MULTIPLY_MATRICES,
+	STAT_SHIFT_MATRIX,
+	STAT_RANDOM_MATRIX,
+	STAT_DUPLICATE_MATRIX,
+	STAT_EQUAL_MATRICES,
+	STAT_DISPLAY_MATRIX,
+	STAT_READ_MATRIX,
+	STAT_READ_MATRIX_MMAP,
+	STAT_WRITE_MATRIX,
+	STAT_EVAL_EXPRESSION,
+	STAT_SUM_MATRIX,
+	STAT_SAVE_WORKSPACE,
+	STAT_LOAD_WORKSPACE,
+	STAT_TRANSPOSE_MATRIX,
+	STAT_STATS_MATRIX,
+	STAT_SERVER_UPLOAD,
+	STAT_SERVER_DOWNLOAD,
+	STAT_COUNT
+}Stat_id_t;
+
+typedef struct {
+	Stat_id_t id;
+	uint64_t start;
+	uint64_t bytes;
+}Stat_scope_t;
+
+uint64_t stats_now (void);
+void stats_record (Stat_id_t id, uint64_t nanoseconds, uint64_t bytes);
+void stats_scope_end (Stat_scope_t* scope);
+void stats_print (FILE* out);
+void stats_reset (void);
+bool stats_dump (const char* filename);
+void stats_release (void);
+
+/* times the rest of the enclosing block, set name.bytes to report bytes touched */
+#define STATS_SCOPE(name, stat) \
+	Stat_scope_t name __attribute__((cleanup(stats_scope_end), unused)) = {(stat), stats_now(), 0}
+
+#endif
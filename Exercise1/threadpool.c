@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+/* upper bound on the number of blocks queued per worker for one call */
+#define BLOCKS_PER_THREAD 4
+#define MAX_THREADS 1024
+
+typedef struct {
+	parallel_task_t task;
+	void* ctx;
+	size_t remaining; /* blocks not finished yet, guarded by pool.lock */
+}Parallel_call_t;
+
+typedef struct {
+	Parallel_call_t* call;
+	size_t begin;
+	size_t end;
+}Block_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	Block_t* blocks;
+	size_t capacity;
+	size_t head; /* thieves take from head */
+	size_t tail; /* the owner pushes and pops at tail */
+}Deque_t;
+
+typedef struct {
+	pthread_t* threads;
+	Deque_t* deques;
+	unsigned int workers; /* threads in the pool, the caller is not counted */
+	size_t queued;
+	bool stopping;
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t call_done;
+}Thread_pool_t;
+
+static Thread_pool_t pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work_ready = PTHREAD_COND_INITIALIZER,
+	.call_done = PTHREAD_COND_INITIALIZER,
+};
+
+/* set while a thread is running a block, nested calls then run inline */
+static __thread bool inside_block;
+
+/* 
+ * PURPOSE: Push a block onto the owner end of a deque, growing it if needed
+ * INPUTS: Address of deque, block to push
+ * RETURN: True if pushed, false if the deque couldn't grow
+ **/
+
+static bool deque_push (Deque_t* dq, Block_t block) {
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail == dq->capacity) {
+		/* compact first, then grow */
+		if (dq->head > 0) {
+			memmove(dq->blocks, dq->blocks + dq->head, (dq->tail - dq->head) * sizeof(Block_t));
+			dq->tail -= dq->head;
+			dq->head = 0;
+		}
+		if (dq->tail == dq->capacity) {
+			size_t capacity = dq->capacity ? dq->capacity * 2 : 16;
+			Block_t* blocks = realloc(dq->blocks, capacity * sizeof(Block_t));
+			if (!blocks) {
+				pthread_mutex_unlock(&dq->lock);
+				return false;
+			}
+			dq->blocks = blocks;
+			dq->capacity = capacity;
+		}
+	}
+	dq->blocks[dq->tail++] = block;
+	pthread_mutex_unlock(&dq->lock);
+	return true;
+}
+
+/* 
+ * PURPOSE: Take a block from a deque, from the owner end or the thief end
+ * INPUTS: Address of deque, true to steal from the head, address of block to fill
+ * RETURN: True if a block was taken, false if the deque was empty
+ **/
+
+static bool deque_take (Deque_t* dq, bool steal, Block_t* block) {
+	bool taken = false;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->head < dq->tail) {
+		*block = steal ? dq->blocks[dq->head++] : dq->blocks[--dq->tail];
+		if (dq->head == dq->tail) {
+			dq->head = dq->tail = 0;
+		}
+		taken = true;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return taken;
+}
+
+/* 
+ * PURPOSE: Find work for a thread: its own deque first, then every other one
+ * INPUTS: Index of the thread's own deque (workers value for the caller), block to fill
+ * RETURN: True if a block was found, else false
+ **/
+
+static bool find_block (unsigned int self, Block_t* block) {
+	if (self < pool.workers && deque_take(&pool.deques[self], false, block)) {
+		return true;
+	}
+	for (unsigned int i = 1; i <= pool.workers; ++i) {
+		unsigned int victim = (self + i) % pool.workers;
+		if (deque_take(&pool.deques[victim], true, block)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* 
+ * PURPOSE: Run one block and signal its call if it was the last one
+ * INPUTS: Block to run
+ * RETURN: Nothing
+ **/
+
+static void run_block (Block_t block) {
+	inside_block = true;
+	block.call->task(block.call->ctx, block.begin, block.end);
+	inside_block = false;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.queued--;
+	if (--block.call->remaining == 0) {
+		pthread_cond_broadcast(&pool.call_done);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* 
+ * PURPOSE: Worker loop, runs and steals blocks until the pool stops
+ * INPUTS: Index of the worker smuggled through the pointer
+ * RETURN: NULL
+ **/
+
+static void* worker_main (void* arg) {
+	const unsigned int self = (unsigned int)(size_t)arg;
+	for (;;) {
+		Block_t block;
+		if (find_block(self, &block)) {
+			run_block(block);
+			continue;
+		}
+		pthread_mutex_lock(&pool.lock);
+		while (pool.queued == 0 && !pool.stopping) {
+			pthread_cond_wait(&pool.work_ready, &pool.lock);
+		}
+		const bool stopping = pool.stopping && pool.queued == 0;
+		pthread_mutex_unlock(&pool.lock);
+		if (stopping) {
+			return NULL;
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Start the worker pool, replacing any running pool
+ * INPUTS: Total number of threads to use including the caller. 0 means the
+ *  MATLAB_THREADS environment variable, or the number of online CPUs.
+ * RETURN: True if the pool is running, else false (operations then stay serial)
+ **/
+
+bool init_thread_pool (unsigned int threads) {
+	shutdown_thread_pool();
+
+	if (threads == 0) {
+		const char* env = getenv("MATLAB_THREADS");
+		if (env != NULL && atoi(env) > 0) {
+			threads = atoi(env);
+		}
+		else {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			threads = cpus > 0 ? (unsigned int)cpus : 1;
+		}
+	}
+	if (threads > MAX_THREADS) {
+		threads = MAX_THREADS;
+	}
+
+	const unsigned int workers = threads - 1;
+	if (workers == 0) {
+		return true;
+	}
+
+	pool.threads = calloc(workers, sizeof(pthread_t));
+	pool.deques = calloc(workers, sizeof(Deque_t));
+	if (!pool.threads || !pool.deques) {
+		free(pool.threads);
+		free(pool.deques);
+		pool.threads = NULL;
+		pool.deques = NULL;
+		return false;
+	}
+	for (unsigned int i = 0; i < workers; ++i) {
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+	}
+	pool.stopping = false;
+	pool.workers = workers;
+	for (unsigned int i = 0; i < workers; ++i) {
+		if (pthread_create(&pool.threads[i], NULL, worker_main, (void*)(size_t)i) != 0) {
+			/* run with the workers that did start */
+			pool.workers = i;
+			break;
+		}
+	}
+	if (pool.workers == 0) {
+		shutdown_thread_pool();
+		return false;
+	}
+	return true;
+}
+
+/* 
+ * PURPOSE: Stop and join every worker and free the pool
+ * INPUTS: Nothing
+ * RETURN: Nothing
+ **/
+
+void shutdown_thread_pool (void) {
+	if (pool.threads == NULL) return;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stopping = true;
+	pthread_cond_broadcast(&pool.work_ready);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (unsigned int i = 0; i < pool.workers; ++i) {
+		pthread_join(pool.threads[i], NULL);
+	}
+	for (unsigned int i = 0; i < pool.workers; ++i) {
+		pthread_mutex_destroy(&pool.deques[i].lock);
+		free(pool.deques[i].blocks);
+	}
+	free(pool.threads);
+	free(pool.deques);
+	pool.threads = NULL;
+	pool.deques = NULL;
+	pool.workers = 0;
+	pool.stopping = false;
+}
+
+/* 
+ * PURPOSE: Number of threads that take part in a parallel_for
+ * INPUTS: Nothing
+ * RETURN: Worker count plus the calling thread
+ **/
+
+unsigned int thread_pool_size (void) {
+	return pool.workers + 1;
+}
+
+/* 
+ * PURPOSE: Row block size that keeps each block above PARALLEL_MIN_ELEMENTS
+ * INPUTS: Number of columns in the matrix
+ * RETURN: Minimum rows per block
+ **/
+
+size_t parallel_grain_rows (size_t cols) {
+	if (cols == 0 || cols >= PARALLEL_MIN_ELEMENTS) return 1;
+
+	return PARALLEL_MIN_ELEMENTS / cols;
+}
+
+/* 
+ * PURPOSE: Run task over [0, n) split into blocks of at least grain items,
+ *  spread over the pool. Returns once every block has finished.
+ * INPUTS: Number of items, minimum items per block, task, context passed to the task
+ * RETURN: Nothing
+ **/
+
+void parallel_for (size_t n, size_t grain, parallel_task_t task, void* ctx) {
+	if (n == 0 || task == NULL) return;
+
+	if (grain == 0) {
+		grain = 1;
+	}
+	if (pool.workers == 0 || inside_block || n <= grain) {
+		task(ctx, 0, n);
+		return;
+	}
+
+	const size_t max_blocks = (size_t)thread_pool_size() * BLOCKS_PER_THREAD;
+	size_t block_size = (n + max_blocks - 1) / max_blocks;
+	if (block_size < grain) {
+		block_size = grain;
+	}
+	const size_t blocks = (n + block_size - 1) / block_size;
+
+	Parallel_call_t call = {task, ctx, blocks};
+
+	/* count the blocks before queueing so a fast worker never sees queued underflow */
+	pthread_mutex_lock(&pool.lock);
+	pool.queued += blocks;
+	pthread_mutex_unlock(&pool.lock);
+
+	for (size_t b = 0; b < blocks; ++b) {
+		const size_t begin = b * block_size;
+		const size_t end = begin + block_size < n ? begin + block_size : n;
+		Block_t block = {&call, begin, end};
+		if (!deque_push(&pool.deques[b % pool.workers], block)) {
+			/* couldn't queue it, run it here */
+			run_block(block);
+		}
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pthread_cond_broadcast(&pool.work_ready);
+	pthread_mutex_unlock(&pool.lock);
+
+	/* help out until nothing is left to steal, then wait for stragglers */
+	Block_t block;
+	while (find_block(pool.workers, &block)) {
+		run_block(block);
+	}
+	pthread_mutex_lock(&pool.lock);
+	while (call.remaining > 0) {
+		pthread_cond_wait(&pool.call_done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
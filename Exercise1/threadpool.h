@@ -0,0 +1,25 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Persistent worker pool used to split whole-matrix operations into row
+ * blocks. Every worker owns a deque of blocks; idle workers (and the calling
+ * thread, which always helps) steal from the other end of a busy worker's
+ * deque. Work that is smaller than the caller's grain runs inline.
+ */
+
+/* element count below which an operation is not worth handing to the pool */
+#define PARALLEL_MIN_ELEMENTS (1u << 16)
+
+typedef void (*parallel_task_t) (void* ctx, size_t begin, size_t end);
+
+bool init_thread_pool (unsigned int threads);
+void shutdown_thread_pool (void);
+unsigned int thread_pool_size (void);
+void parallel_for (size_t n, size_t grain, parallel_task_t task, void* ctx);
+size_t parallel_grain_rows (size_t cols);
+
+#endif
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "workspace.h"
+#include "matrix_types.h"
+#include "matrix_kernels.h"
+#include "matrix_sparse.h"
+#include "matrix_alloc.h"
+#include "io_ring.h"
+#include "stats.h"
+
+/* iovecs gathered per writev, each matrix needs at most 4 */
+#define WORKSPACE_IOV 64
+
+_Static_assert(sizeof(Workspace_header_t) == WORKSPACE_ALIGN, "header keeps the index aligned");
+_Static_assert(sizeof(Workspace_entry_t) == 64, "index entries have a fixed layout");
+_Static_assert(MATRIX_NAME_LEN <= sizeof(((Workspace_entry_t*)0)->name), "names fit the index");
+_Static_assert(sizeof(size_t) == sizeof(uint64_t), "row offsets are stored as 64 bits");
+
+static const unsigned char zero_pad[WORKSPACE_ALIGN];
+
+/*
+ * PURPOSE: Round a payload size up to the next WORKSPACE_ALIGN boundary
+ * INPUTS: Bytes
+ * RETURN: Bytes rounded up
+ **/
+
+static uint64_t align_payload (uint64_t bytes) {
+	return (bytes + WORKSPACE_ALIGN - 1) & ~(uint64_t)(WORKSPACE_ALIGN - 1);
+}
+
+/*
+ * PURPOSE: Payload size of a sparse matrix, row offsets then columns then values
+ * INPUTS: Rows, stored elements
+ * RETURN: Bytes
+ **/
+
+static uint64_t sparse_payload_bytes (unsigned int rows, uint64_t nnz) {
+	return ((uint64_t)rows + 1) * sizeof(size_t) + nnz * 2 * sizeof(unsigned int);
+}
+
+/*
+ * PURPOSE: Checksum of a sparse payload, the three arrays hashed in file order
+ * INPUTS: Address of the CSR matrix, rows
+ * RETURN: The checksum
+ **/
+
+static uint64_t sparse_checksum (const Matrix_csr_t* csr, unsigned int rows) {
+	uint64_t hash = matrix_kernels.hash((const unsigned int*)csr->row_ptr,
+		((size_t)rows + 1) * sizeof(size_t) / sizeof(unsigned int), 0);
+	hash = matrix_kernels.hash(csr->col_idx, csr->nnz, hash);
+	return matrix_kernels.hash(csr->vals, csr->nnz, hash);
+}
+
+/*
+ * PURPOSE: Queue a buffer for the next writev, flushing first if the batch is full
+ * INPUTS: File descriptor, iovec batch, address of its length, buffer, length
+ * RETURN: True unless a flush failed
+ **/
+
+static bool queue_write (int fd, struct iovec* iov, int* iovcnt, const void* buf, size_t len) {
+	if (len == 0) {
+		return true;
+	}
+	if (*iovcnt == WORKSPACE_IOV) {
+		if (!write_all(fd, iov, *iovcnt)) {
+			return false;
+		}
+		*iovcnt = 0;
+	}
+	iov[*iovcnt].iov_base = (void*)buf;
+	iov[*iovcnt].iov_len = len;
+	++*iovcnt;
+	return true;
+}
+
+/*
+ * PURPOSE: Write every matrix of the registry to one workspace file. The
+ *  index is built first so the whole file goes out as one sequential stream
+ *  of gathered writes, into a temporary file that replaces filename only
+ *  once it is complete and synced
+ * INPUTS: Output filename, address of registry, address to store how many
+ *  matrices were saved (may be NULL)
+ * RETURN: True if the workspace was saved, else false
+ **/
+
+bool save_workspace (const char* filename, Registry_t* mats, size_t* saved) {
+	STATS_SCOPE(scope, STAT_SAVE_WORKSPACE);
+
+	if (filename == NULL || mats == NULL) return false;
+
+	char tmp_name[PATH_MAX];
+	if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename) >= (int)sizeof(tmp_name)) {
+		fprintf(matrix_messages(), "FILENAME TOO LONG\n");
+		return false;
+	}
+
+	const size_t count = mats->count;
+	Workspace_entry_t* index = calloc(count ? count : 1, sizeof(Workspace_entry_t));
+	Matrix_t** order = malloc((count ? count : 1) * sizeof(Matrix_t*));
+	if (!index || !order) {
+		free(index);
+		free(order);
+		return false;
+	}
+
+	Workspace_header_t header = {.magic = WORKSPACE_MAGIC, .version = WORKSPACE_VERSION,
+		.entry_size = sizeof(Workspace_entry_t)};
+	uint64_t offset = sizeof(header) + count * sizeof(Workspace_entry_t);
+	size_t cursor = 0;
+	size_t n = 0;
+	Matrix_t* m = NULL;
+	while (n < count && (m = registry_next(mats, &cursor)) != NULL) {
+		Workspace_entry_t* e = &index[n];
+		strncpy(e->name, m->name, sizeof(e->name) - 1);
+		e->rows = m->rows;
+		e->cols = m->cols;
+		e->type = m->type;
+		if (m->csr) {
+			e->kind = WORKSPACE_SPARSE;
+			e->bytes = sparse_payload_bytes(m->rows, m->csr->nnz);
+			e->checksum = sparse_checksum(m->csr, m->rows);
+		}
+		else if (hash_matrix(m, &e->checksum)) {
+			e->kind = WORKSPACE_DENSE;
+			e->bytes = matrix_data_bytes(m);
+		}
+		else {
+			continue;
+		}
+		order[n] = m;
+		/* duplicates still sharing their data point at one copy of it */
+		size_t k = 0;
+		while (m->shared && k < n && (order[k] == NULL || order[k]->data != m->data)) {
+			++k;
+		}
+		if (m->shared && k < n) {
+			e->offset = index[k].offset;
+			order[n] = NULL;
+		}
+		else {
+			e->offset = offset;
+			offset += align_payload(e->bytes);
+		}
+		++n;
+	}
+	header.count = n;
+
+	int fd = open(tmp_name, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(matrix_messages(), "FAILED TO OPEN FOR WRITING\n");
+		matrix_perror("open");
+		free(index);
+		free(order);
+		return false;
+	}
+
+	struct iovec iov[WORKSPACE_IOV];
+	int iovcnt = 0;
+	bool ok = queue_write(fd, iov, &iovcnt, &header, sizeof(header))
+		&& queue_write(fd, iov, &iovcnt, index, n * sizeof(Workspace_entry_t));
+	for (size_t i = 0; ok && i < n; ++i) {
+		const Workspace_entry_t* e = &index[i];
+		m = order[i];
+		if (m == NULL) {
+			continue;
+		}
+		if (e->kind == WORKSPACE_SPARSE) {
+			ok = queue_write(fd, iov, &iovcnt, m->csr->row_ptr, ((size_t)m->rows + 1) * sizeof(size_t))
+				&& queue_write(fd, iov, &iovcnt, m->csr->col_idx, m->csr->nnz * sizeof(unsigned int))
+				&& queue_write(fd, iov, &iovcnt, m->csr->vals, m->csr->nnz * sizeof(unsigned int));
+		}
+		else {
+			ok = queue_write(fd, iov, &iovcnt, m->elems, e->bytes);
+		}
+		ok = ok && queue_write(fd, iov, &iovcnt, zero_pad, align_payload(e->bytes) - e->bytes);
+		scope.bytes += e->bytes;
+	}
+	ok = ok && (iovcnt == 0 || write_all(fd, iov, iovcnt)) && fsync(fd) == 0;
+	if (!ok) {
+		fprintf(matrix_messages(), "FAILED TO WRITE WORKSPACE\n");
+		matrix_perror("write");
+	}
+	if (close(fd) != 0 && ok) {
+		matrix_perror("close");
+		ok = false;
+	}
+	if (ok && rename(tmp_name, filename) != 0) {
+		matrix_perror("rename");
+		ok = false;
+	}
+	if (!ok) {
+		unlink(tmp_name);
+	}
+	else if (saved) {
+		*saved = n;
+	}
+	free(index);
+	free(order);
+	return ok;
+}
+
+/*
+ * PURPOSE: Check an index entry against the file it came from
+ * INPUTS: Address of the entry, file length
+ * RETURN: True if the name, shape and payload range are consistent
+ **/
+
+static bool valid_entry (const Workspace_entry_t* e, uint64_t file_len) {
+	const size_t name_len = strnlen(e->name, sizeof(e->name));
+	if (name_len == 0 || name_len >= MATRIX_NAME_LEN || e->rows == 0 || e->cols == 0) {
+		return false;
+	}
+	if (e->offset % WORKSPACE_ALIGN != 0 || e->offset > file_len || e->bytes > file_len - e->offset) {
+		return false;
+	}
+	if (e->type >= MATRIX_TYPE_COUNT) {
+		return false;
+	}
+	if (e->kind == WORKSPACE_DENSE) {
+		size_t bytes = 0;
+		return matrix_size_bytes(e->rows, e->cols, matrix_types[e->type].size, &bytes) && e->bytes == bytes;
+	}
+	if (e->kind == WORKSPACE_SPARSE && e->type == MATRIX_U32) {
+		const uint64_t ptr_bytes = sparse_payload_bytes(e->rows, 0);
+		return e->bytes >= ptr_bytes && (e->bytes - ptr_bytes) % (2 * sizeof(unsigned int)) == 0
+			&& (e->bytes - ptr_bytes) / (2 * sizeof(unsigned int)) <= (uint64_t)e->rows * e->cols;
+	}
+	return false;
+}
+
+/*
+ * PURPOSE: Map a dense payload in place, private and writable like
+ *  read_matrix_mmap, so nothing is read until the elements are touched
+ * INPUTS: File descriptor, address of the entry, address of matrix
+ * RETURN: True if the matrix was created, else false
+ **/
+
+static bool map_dense_entry (int fd, const Workspace_entry_t* e, Matrix_t** m) {
+	const uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+	const uint64_t map_offset = e->offset & ~(page - 1);
+	const size_t map_len = e->offset - map_offset + e->bytes;
+	unsigned char* base = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)map_offset);
+	if (base == MAP_FAILED) {
+		matrix_perror("mmap");
+		return false;
+	}
+	*m = matrix_alloc_header();
+	if (!(*m)) {
+		munmap(base, map_len);
+		return false;
+	}
+	memcpy((*m)->name, e->name, MATRIX_NAME_LEN - 1); /* valid_entry checked the terminator */
+	(*m)->rows = e->rows;
+	(*m)->cols = e->cols;
+	(*m)->type = (Matrix_type_t)e->type;
+	(*m)->elems = base + (e->offset - map_offset);
+	(*m)->map_base = base;
+	(*m)->map_len = map_len;
+	return true;
+}
+
+/*
+ * PURPOSE: Read a sparse payload straight into a new CSR matrix
+ * INPUTS: File descriptor, address of the entry, address of matrix
+ * RETURN: True if the matrix was created, false on a read error or bad data
+ **/
+
+static bool read_sparse_entry (int fd, const Workspace_entry_t* e, Matrix_t** m) {
+	const size_t ptr_bytes = ((size_t)e->rows + 1) * sizeof(size_t);
+	const size_t nnz = (e->bytes - ptr_bytes) / (2 * sizeof(unsigned int));
+	Matrix_t* sparse = NULL;
+	if (!create_matrix(&sparse, e->name, e->rows, e->cols)) {
+		return false;
+	}
+	Matrix_csr_t* csr = create_csr(e->rows, nnz);
+	if (!csr) {
+		destroy_matrix(&sparse);
+		return false;
+	}
+	destroy_csr(sparse->csr, e->rows);
+	sparse->csr = csr;
+	csr->nnz = nnz;
+	const uint64_t col_offset = e->offset + ptr_bytes;
+	if (!io_ring_read(fd, csr->row_ptr, ptr_bytes, e->offset)
+		|| !io_ring_read(fd, csr->col_idx, nnz * sizeof(unsigned int), col_offset)
+		|| !io_ring_read(fd, csr->vals, nnz * sizeof(unsigned int), col_offset + nnz * sizeof(unsigned int))
+		|| !valid_csr(csr, e->rows, e->cols)) {
+		destroy_matrix(&sparse);
+		return false;
+	}
+	*m = sparse;
+	return true;
+}
+
+/*
+ * PURPOSE: Load matrices from a workspace file into the registry, replacing
+ *  matrices of the same name. Only the header and index are read up front;
+ *  with names given, every other payload is never touched
+ * INPUTS: Input filename, address of registry, names to load (all if
+ *  num_names is 0), whether to check each payload against its checksum,
+ *  address to store how many matrices were loaded (may be NULL)
+ * RETURN: True if every requested matrix was loaded, else false
+ **/
+
+bool load_workspace (const char* filename, Registry_t* mats, char** names, unsigned int num_names,
+			bool verify, size_t* loaded) {
+	STATS_SCOPE(scope, STAT_LOAD_WORKSPACE);
+
+	if (filename == NULL || mats == NULL || (num_names && names == NULL)) return false;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(matrix_messages(), "FAILED TO OPEN FOR READING\n");
+		matrix_perror("open");
+		return false;
+	}
+
+	struct stat st;
+	Workspace_header_t header;
+	if (fstat(fd, &st) != 0 || !io_ring_read(fd, &header, sizeof(header), 0)
+		|| header.magic != WORKSPACE_MAGIC || header.version != WORKSPACE_VERSION
+		|| header.entry_size != sizeof(Workspace_entry_t)
+		|| (uint64_t)header.count * sizeof(Workspace_entry_t) > (uint64_t)st.st_size - sizeof(header)) {
+		fprintf(matrix_messages(), "INVALID WORKSPACE HEADER\n");
+		close(fd);
+		return false;
+	}
+
+	Workspace_entry_t* index = malloc((header.count ? header.count : 1) * sizeof(Workspace_entry_t));
+	bool* found = calloc(num_names ? num_names : 1, sizeof(bool));
+	if (!index || !found || !io_ring_read(fd, index, header.count * sizeof(Workspace_entry_t), sizeof(header))) {
+		fprintf(matrix_messages(), "FAILED TO READ WORKSPACE INDEX\n");
+		free(index);
+		free(found);
+		close(fd);
+		return false;
+	}
+
+	bool ok = true;
+	size_t n = 0;
+	for (uint32_t i = 0; i < header.count; ++i) {
+		const Workspace_entry_t* e = &index[i];
+		if (!valid_entry(e, (uint64_t)st.st_size)) {
+			fprintf(matrix_messages(), "INVALID WORKSPACE ENTRY %u\n", i);
+			ok = false;
+			continue;
+		}
+		bool wanted = num_names == 0;
+		for (unsigned int k = 0; k < num_names; ++k) {
+			if (strcmp(names[k], e->name) == 0) {
+				wanted = found[k] = true;
+			}
+		}
+		if (!wanted) {
+			continue;
+		}
+
+		Matrix_t* m = NULL;
+		if (!(e->kind == WORKSPACE_DENSE ? map_dense_entry(fd, e, &m) : read_sparse_entry(fd, e, &m))) {
+			fprintf(matrix_messages(), "FAILED TO READ MATRIX (%s)\n", e->name);
+			ok = false;
+			continue;
+		}
+		if (verify) {
+			uint64_t checksum = 0;
+			if (m->csr) {
+				checksum = sparse_checksum(m->csr, m->rows);
+			}
+			else {
+				hash_matrix(m, &checksum);
+			}
+			if (checksum != e->checksum) {
+				fprintf(matrix_messages(), "CHECKSUM MISMATCH FOR MATRIX (%s)\n", e->name);
+				destroy_matrix(&m);
+				ok = false;
+				continue;
+			}
+		}
+		if (!registry_insert(mats, m)) {
+			destroy_matrix(&m);
+			ok = false;
+			continue;
+		}
+		scope.bytes += e->bytes;
+		++n;
+	}
+	for (unsigned int k = 0; k < num_names; ++k) {
+		if (!found[k]) {
+			fprintf(matrix_messages(), "Matrix (%s) isn't in the workspace\n", names[k]);
+			ok = false;
+		}
+	}
+
+	if (loaded) {
+		*loaded = n;
+	}
+	free(index);
+	free(found);
+	close(fd);
+	return ok;
+}
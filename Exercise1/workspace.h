@@ -0,0 +1,51 @@
+#ifndef _WORKSPACE_H_
+#define _WORKSPACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "registry.h"
+
+/*
+ * Snapshot of every matrix in the registry in one file. A fixed size header
+ * and an index of fixed size entries (name, shape, payload offset and length,
+ * checksum) come first, so a restart needs one open and two reads to know
+ * what the file holds. Each payload starts on a WORKSPACE_ALIGN boundary:
+ * dense payloads are mapped in place and only paged in when touched, sparse
+ * ones (row offsets, columns, values) are read straight into their arrays.
+ */
+
+/* first unsigned int of a workspace file, "MATW" in little-endian order */
+#define WORKSPACE_MAGIC 0x5754414Du
+#define WORKSPACE_VERSION 1
+#define WORKSPACE_ALIGN 64
+
+#define WORKSPACE_DENSE 0
+#define WORKSPACE_SPARSE 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count; /* index entries following the header */
+	uint32_t entry_size;
+	unsigned char reserved[WORKSPACE_ALIGN - 4 * sizeof(uint32_t)];
+}Workspace_header_t;
+
+typedef struct {
+	char name[28]; /* NUL terminated, MATRIX_NAME_LEN fits */
+	uint16_t kind; /* WORKSPACE_DENSE or WORKSPACE_SPARSE */
+	uint16_t type; /* Matrix_type_t of the elements, MATRIX_U32 for sparse entries */
+	uint32_t rows;
+	uint32_t cols;
+	uint64_t offset; /* from the start of the file, a multiple of WORKSPACE_ALIGN */
+	uint64_t bytes;
+	uint64_t checksum; /* content hash of dense payloads, hash of the arrays of sparse ones */
+}Workspace_entry_t;
+
+bool save_workspace (const char* filename, Registry_t* mats, size_t* saved);
+bool load_workspace (const char* filename, Registry_t* mats, char** names, unsigned int num_names,
+			bool verify, size_t* loaded);
+
+#endif